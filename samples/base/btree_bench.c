@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <endian.h>
+#include <time.h>
+#include "cbox/base/btree.h"
+#include "cbox/base/pbl.h"
+
+#define BENCH_COUNT (1000000)
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, double start, uint64_t count)
+{
+    double ms = now_ms() - start;
+    printf("%-24s %8.2f ms %10.0f ops/s\n", name, ms, count / (ms / 1000.0));
+}
+
+/*
+ * time-indexed keys: ordered inserts, random lookups, then a full ordered scan,
+ * the pbl keys are big-endian so that memcmp() orders them by time too
+ */
+int main(void)
+{
+    uint64_t i = 0, key = 0, sum = 0;
+    uint64_t *keys = (uint64_t *)malloc(BENCH_COUNT * sizeof(uint64_t));
+    double start = 0;
+
+    for (i = 0; i < BENCH_COUNT; ++i)
+        keys[i] = i * 1000 + 7;
+
+    cbox_btree_t *tree = cbox_btree_create(sizeof(uint64_t), sizeof(uint64_t), cbox_btree_compare_u64);
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i)
+        cbox_btree_put(tree, &keys[i], &i);
+    report("cbox_btree put", start, BENCH_COUNT);
+
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        key = keys[i * 7919 % BENCH_COUNT];
+        sum += *(uint64_t *)cbox_btree_get(tree, &key);
+    }
+    report("cbox_btree get", start, BENCH_COUNT);
+
+    start = now_ms();
+    cbox_btree_iter_t iter;
+    void *value = NULL;
+    cbox_btree_seek(tree, NULL, &iter);
+    while (cbox_btree_next(tree, &iter, NULL, &value))
+        sum += *(uint64_t *)value;
+    report("cbox_btree scan", start, BENCH_COUNT);
+
+    cbox_btree_clear(tree);
+    start = now_ms();
+    cbox_btree_build(tree, keys, NULL, BENCH_COUNT);
+    report("cbox_btree build", start, BENCH_COUNT);
+    cbox_btree_destroy(tree);
+
+    PblMap *map = pblMapNewTreeMap();
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        key = htobe64(keys[i]);
+        pblMapAdd(map, &key, sizeof(key), &i, sizeof(i));
+    }
+    report("pblMap tree add", start, BENCH_COUNT);
+
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        size_t length = 0;
+        key = htobe64(keys[i * 7919 % BENCH_COUNT]);
+        sum += *(uint64_t *)pblMapGet(map, &key, sizeof(key), &length);
+    }
+    report("pblMap tree get", start, BENCH_COUNT);
+
+    start = now_ms();
+    PblIterator *it = pblMapIteratorNew(map);
+    while (pblIteratorHasNext(it) > 0) {
+        PblMapEntry *entry = (PblMapEntry *)pblIteratorNext(it);
+        sum += *(uint64_t *)pblMapEntryValue(entry);
+    }
+    pblIteratorFree(it);
+    report("pblMap tree scan", start, BENCH_COUNT);
+    pblMapFree(map);
+
+    free(keys);
+    return sum == 0;
+}
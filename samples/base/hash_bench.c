@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "cbox/base/pbl.h"
+
+#define BENCH_BYTES (256 * 1024 * 1024)
+
+extern int pblHt_J_Zobel_Hash(const unsigned char *key, size_t keylen);
+extern unsigned int pblHt_jenkins_one_at_a_time_hash(const unsigned char *key, size_t key_len);
+extern uint32_t pblHt_SuperFastHash(const unsigned char *data, size_t len);
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint64_t hash_zobel(const unsigned char *key, size_t len)
+{
+    return pblHt_J_Zobel_Hash(key, len);
+}
+
+static uint64_t hash_jenkins(const unsigned char *key, size_t len)
+{
+    return pblHt_jenkins_one_at_a_time_hash(key, len);
+}
+
+static uint64_t hash_superfast(const unsigned char *key, size_t len)
+{
+    return pblHt_SuperFastHash(key, len);
+}
+
+static uint64_t hash_wyhash(const unsigned char *key, size_t len)
+{
+    return pblHtHash64(key, len, 0);
+}
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        uint64_t (*hash)(const unsigned char *, size_t);
+    } funcs[] = {
+        { "zobel", hash_zobel },
+        { "jenkins", hash_jenkins },
+        { "superfast", hash_superfast },
+        { "wyhash", hash_wyhash },
+    };
+    static const size_t sizes[] = { 4, 8, 16, 40, 64, 256, 1024 };
+    unsigned char key[1024];
+    uint64_t sum = 0;
+    size_t f = 0, s = 0, i = 0;
+
+    for (i = 0; i < sizeof(key); ++i)
+        key[i] = (unsigned char)rand();
+
+    printf("%-10s", "bytes");
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+        printf(" %8zu", sizes[s]);
+    printf("   (MB/s)\n");
+
+    for (f = 0; f < sizeof(funcs) / sizeof(funcs[0]); ++f) {
+        printf("%-10s", funcs[f].name);
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            size_t count = BENCH_BYTES / sizes[s] / 8;
+            double start = now_ms();
+            for (i = 0; i < count; ++i) {
+                // vary the key so the calls cannot be hoisted
+                key[0] = (unsigned char)i;
+                sum += funcs[f].hash(key, sizes[s]);
+            }
+            double ms = now_ms() - start;
+            printf(" %8.0f", count * sizes[s] / 1024.0 / 1024.0 / (ms / 1000.0));
+        }
+        printf("\n");
+    }
+
+    return sum == 0;
+}
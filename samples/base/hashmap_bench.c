@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "cbox/base/hashmap.h"
+#include "cbox/base/pbl.h"
+
+#define BENCH_COUNT (1000000)
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, double start)
+{
+    double ms = now_ms() - start;
+    printf("%-24s %8.2f ms %10.0f ops/s\n", name, ms, BENCH_COUNT / (ms / 1000.0));
+}
+
+static uint64_t key_of(uint64_t i)
+{
+    return i * 0x9e3779b97f4a7c15ULL;
+}
+
+int main(void)
+{
+    uint64_t i = 0, key = 0, value = 0, sum = 0;
+    double start = 0;
+
+    cbox_hashmap_t *map = cbox_hashmap_create(sizeof(uint64_t), sizeof(uint64_t), NULL, NULL);
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        key = key_of(i);
+        cbox_hashmap_put(map, &key, &i);
+    }
+    report("cbox_hashmap put", start);
+
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        key = key_of(i * 7 % BENCH_COUNT);
+        sum += *(uint64_t *)cbox_hashmap_get(map, &key);
+    }
+    report("cbox_hashmap get", start);
+
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        key = key_of(i + BENCH_COUNT);
+        sum += cbox_hashmap_get(map, &key) != NULL;
+    }
+    report("cbox_hashmap miss", start);
+
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        key = key_of(i);
+        cbox_hashmap_remove(map, &key, NULL);
+    }
+    report("cbox_hashmap remove", start);
+    cbox_hashmap_destroy(map);
+
+    PblMap *pbl = pblMapNewHashMap();
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        key = key_of(i);
+        pblMapAdd(pbl, &key, sizeof(key), &i, sizeof(i));
+    }
+    report("pblMap add", start);
+
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        size_t length = 0;
+        key = key_of(i * 7 % BENCH_COUNT);
+        sum += *(uint64_t *)pblMapGet(pbl, &key, sizeof(key), &length);
+    }
+    report("pblMap get", start);
+
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        size_t length = 0;
+        key = key_of(i + BENCH_COUNT);
+        sum += pblMapGet(pbl, &key, sizeof(key), &length) != NULL;
+    }
+    report("pblMap miss", start);
+
+    // pblMapFree() removes the first bucket over and over, it is quadratic for hash maps
+    start = now_ms();
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        size_t length = 0;
+        key = key_of(i);
+        void *removed = pblMapRemove(pbl, &key, sizeof(key), &length);
+        PBL_FREE(removed);
+    }
+    report("pblMap remove", start);
+    pblMapFree(pbl);
+
+    value = sum;
+    return value == 0;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cbox/base/log.h"
+#include "cbox/base/utils.h"
+
+#define BENCH_SIZE (1024 * 1024)
+#define BENCH_ROUNDS (20)
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void report(const char *name, double start, size_t bytes)
+{
+    double ms = now_ms() - start;
+    printf("%-24s %8.2f ms %10.2f MB/s\n", name, ms, bytes / 1024.0 / 1024.0 / (ms / 1000.0));
+}
+
+static void sprintf_encode(char *hex, const unsigned char *bin, size_t len)
+{
+    size_t i = 0;
+    for (i = 0; i < len; i++)
+        sprintf(hex + i * 2, "%02x", bin[i]);
+}
+
+static void strtol_decode(unsigned char *bin, const char *hex, size_t len)
+{
+    size_t i = 0;
+    for (i = 0; i < len / 2; i++) {
+        char s[3] = { hex[i * 2], hex[i * 2 + 1], '\0' };
+        bin[i] = (unsigned char)strtol(s, NULL, 16);
+    }
+}
+
+static void drop_line(int level, const char *msg, void *user)
+{
+    (void)level;
+    (void)msg;
+    (void)user;
+}
+
+int main(void)
+{
+    unsigned char *bin = (unsigned char *)malloc(BENCH_SIZE);
+    char *hex = (char *)malloc(BENCH_SIZE * 3 + 1);
+    size_t i = 0;
+    int round = 0;
+    double start = 0;
+
+    if (bin == NULL || hex == NULL)
+        return 1;
+
+    for (i = 0; i < BENCH_SIZE; i++)
+        bin[i] = (unsigned char)rand();
+
+    start = now_ms();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+        sprintf_encode(hex, bin, BENCH_SIZE);
+    report("sprintf encode", start, (size_t)BENCH_SIZE * BENCH_ROUNDS);
+
+    start = now_ms();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+        cbox_utils_hex_encode(hex, BENCH_SIZE * 2, bin, BENCH_SIZE, 0, 0);
+    report("cbox_utils_hex_encode", start, (size_t)BENCH_SIZE * BENCH_ROUNDS);
+
+    start = now_ms();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+        strtol_decode(bin, hex, BENCH_SIZE * 2);
+    report("strtol decode", start, (size_t)BENCH_SIZE * BENCH_ROUNDS);
+
+    start = now_ms();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+        cbox_utils_hex_decode(bin, BENCH_SIZE, hex, BENCH_SIZE * 2);
+    report("cbox_utils_hex_decode", start, (size_t)BENCH_SIZE * BENCH_ROUNDS);
+
+    // formatted lines only, the callback drops them
+    CBOX_LOG_INIT(CBOX_LOG_LEVEL_DEBUG, "hex_bench");
+    CBOX_LOG_REDIRECT(drop_line, NULL, 0);
+    start = now_ms();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+        cbox_log_dump(cbox_log_instance, bin, 65535);
+    report("cbox_log_dump", start, (size_t)65535 * BENCH_ROUNDS);
+    CBOX_LOG_DESTROY();
+
+    free(hex);
+    free(bin);
+    return 0;
+}
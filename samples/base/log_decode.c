@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <libgen.h>
+#include "cbox/base/log.h"
+
+
+static void print_line(int level, const char *msg, void *user)
+{
+    fprintf(stdout, "%s\n", msg);
+    (void)level;
+    (void)user;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <binary log file>\n", basename(argv[0]));
+        return 1;
+    }
+
+    if (cbox_log_decode(argv[1], print_line, NULL) != 0) {
+        fprintf(stderr, "%s: can not decode %s\n", basename(argv[0]), argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
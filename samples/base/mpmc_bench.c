@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "cbox/base/mpmc_queue.h"
+#include "cbox/base/list.h"
+
+#define BENCH_THREADS (4)
+#define BENCH_COUNT (200000)
+
+/*
+ * the list.h plus mutex queue the modules use today
+ */
+typedef struct
+{
+    struct list_head node;
+    uint64_t value;
+} list_elem_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct list_head head;
+} list_queue_t;
+
+static cbox_mpmc_queue_t *g_mpmc = NULL;
+static list_queue_t g_list;
+static volatile uint64_t g_sink = 0;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void *mpmc_producer(void *arg)
+{
+    uint64_t i = 0;
+    for (i = 0; i < BENCH_COUNT; ++i)
+        cbox_mpmc_queue_push(g_mpmc, &i, -1);
+    return arg;
+}
+
+static void *mpmc_consumer(void *arg)
+{
+    uint64_t i = 0, value = 0, sum = 0;
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        cbox_mpmc_queue_pop(g_mpmc, &value, -1);
+        sum += value;
+    }
+    g_sink += sum;
+    return arg;
+}
+
+static void *list_producer(void *arg)
+{
+    uint64_t i = 0;
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        list_elem_t *elem = (list_elem_t *)malloc(sizeof(list_elem_t));
+        elem->value = i;
+        pthread_mutex_lock(&g_list.lock);
+        list_add_tail(&elem->node, &g_list.head);
+        pthread_cond_signal(&g_list.cond);
+        pthread_mutex_unlock(&g_list.lock);
+    }
+    return arg;
+}
+
+static void *list_consumer(void *arg)
+{
+    uint64_t i = 0, sum = 0;
+    for (i = 0; i < BENCH_COUNT; ++i) {
+        pthread_mutex_lock(&g_list.lock);
+        while (list_empty(&g_list.head))
+            pthread_cond_wait(&g_list.cond, &g_list.lock);
+        list_elem_t *elem = list_entry(g_list.head.next, list_elem_t, node);
+        list_del(&elem->node);
+        pthread_mutex_unlock(&g_list.lock);
+        sum += elem->value;
+        free(elem);
+    }
+    g_sink += sum;
+    return arg;
+}
+
+static void run(const char *name, void *(*producer)(void *), void *(*consumer)(void *))
+{
+    pthread_t threads[BENCH_THREADS * 2];
+    int i = 0;
+
+    double start = now_ms();
+    for (i = 0; i < BENCH_THREADS; ++i) {
+        pthread_create(&threads[i], NULL, consumer, NULL);
+        pthread_create(&threads[BENCH_THREADS + i], NULL, producer, NULL);
+    }
+    for (i = 0; i < BENCH_THREADS * 2; ++i)
+        pthread_join(threads[i], NULL);
+    double ms = now_ms() - start;
+
+    printf("%-20s %8.2f ms %10.0f ops/s\n", name, ms, BENCH_THREADS * BENCH_COUNT / (ms / 1000.0));
+}
+
+int main(void)
+{
+    pthread_mutex_init(&g_list.lock, NULL);
+    pthread_cond_init(&g_list.cond, NULL);
+    INIT_LIST_HEAD(&g_list.head);
+    run("list + mutex", list_producer, list_consumer);
+
+    g_mpmc = cbox_mpmc_queue_create(sizeof(uint64_t), 1024, 0);
+    run("mpmc (backoff)", mpmc_producer, mpmc_consumer);
+    cbox_mpmc_queue_destroy(g_mpmc);
+
+    g_mpmc = cbox_mpmc_queue_create(sizeof(uint64_t), 1024, CBOX_MPMC_QUEUE_FUTEX);
+    run("mpmc (futex)", mpmc_producer, mpmc_consumer);
+    cbox_mpmc_queue_destroy(g_mpmc);
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "cbox/base/pbl.h"
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+/*
+ * usage: pblhash_bench [max keys], the key count grows by 10 from 1k
+ */
+int main(int argc, char *argv[])
+{
+    uint64_t max = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+    uint64_t count = 0, i = 0, key = 0;
+    static char value;
+
+    printf("%10s %12s %12s %12s %12s\n", "keys", "insert ns", "worst us", "lookup ns", "remove ns");
+    for (count = 1000; count <= max; count *= 10) {
+        pblHashTable_t *ht = pblHtCreate();
+        double start = 0, worst = 0, insert = 0, lookup = 0, remove = 0;
+
+        start = now_us();
+        for (i = 0; i < count; ++i) {
+            double begin = now_us();
+            key = i * 0x9e3779b97f4a7c15ULL;
+            pblHtInsert(ht, &key, sizeof(key), &value);
+            double spent = now_us() - begin;
+            if (spent > worst)
+                worst = spent;
+        }
+        insert = now_us() - start;
+
+        start = now_us();
+        for (i = 0; i < count; ++i) {
+            key = (i * 7 % count) * 0x9e3779b97f4a7c15ULL;
+            if (pblHtLookup(ht, &key, sizeof(key)) != &value)
+                return 1;
+        }
+        lookup = now_us() - start;
+
+        start = now_us();
+        for (i = 0; i < count; ++i) {
+            key = i * 0x9e3779b97f4a7c15ULL;
+            pblHtRemove(ht, &key, sizeof(key));
+        }
+        remove = now_us() - start;
+        pblHtDelete(ht);
+
+        printf("%10llu %12.1f %12.1f %12.1f %12.1f\n", (unsigned long long)count, insert * 1000 / count, worst,
+               lookup * 1000 / count, remove * 1000 / count);
+    }
+
+    return 0;
+}
@@ -0,0 +1,628 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "btree.h"
+#include "macros.h"
+
+#define CBOX_BTREE_NODE_SIZE (512)      //!< bytes of the keys and the values or children of a node
+#define CBOX_BTREE_MIN_FANOUT (4)
+#define CBOX_BTREE_MAX_FANOUT (65535)
+#define CBOX_BTREE_MAX_DEPTH (48)       //!< far beyond the height of any tree that fits in memory
+#define CBOX_BTREE_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+enum
+{
+    CBOX_BTREE_KEY_OTHER = 0,
+    CBOX_BTREE_KEY_INT,
+    CBOX_BTREE_KEY_I64,
+    CBOX_BTREE_KEY_U64,
+};
+
+/*
+ * a leaf holds count keys and count values, an inner node count keys and count + 1 children,
+ * child i holds the keys in [key i - 1, key i)
+ */
+typedef struct cbox_btree_node_s
+{
+    struct cbox_btree_node_s *prev;     //!< leaves only, the linked list in key order
+    struct cbox_btree_node_s *next;
+    uint32_t count;
+    uint32_t leaf;
+    uint64_t data[];                    //!< the keys, then the values or the children, 8 bytes aligned
+} cbox_btree_node_t;
+
+struct cbox_btree_s
+{
+    cbox_btree_node_t *root;
+    size_t size;
+    size_t key_size;
+    size_t value_size;
+    size_t leaf_cap;
+    size_t inner_cap;
+    size_t values_offset;       //!< of the values in the data of a leaf
+    size_t children_offset;     //!< of the children in the data of an inner node
+    cbox_btree_compare_t compare;
+    int kind;
+    unsigned char *scratch;     //!< 2 keys, the separators moving up while splitting
+};
+
+static inline unsigned char *cbox_btree_key(const cbox_btree_t *tree, const cbox_btree_node_t *node, size_t index)
+{
+    return (unsigned char *)node->data + index * tree->key_size;
+}
+
+static inline unsigned char *cbox_btree_value(const cbox_btree_t *tree, const cbox_btree_node_t *node, size_t index)
+{
+    return (unsigned char *)node->data + tree->values_offset + index * tree->value_size;
+}
+
+static inline cbox_btree_node_t **cbox_btree_children(const cbox_btree_t *tree, const cbox_btree_node_t *node)
+{
+    return (cbox_btree_node_t **)((unsigned char *)node->data + tree->children_offset);
+}
+
+static inline int cbox_btree_compare(const cbox_btree_t *tree, const void *a, const void *b)
+{
+    return tree->compare ? tree->compare(a, b, tree->key_size) : memcmp(a, b, tree->key_size);
+}
+
+#define CBOX_BTREE_LOWER_BOUND(type)                                \
+    do {                                                            \
+        const type *keys = (const type *)node->data;                \
+        type k;                                                     \
+        memcpy(&k, key, sizeof(k));                                 \
+        while (lo < hi) {                                           \
+            size_t mid = (lo + hi) / 2;                             \
+            if (keys[mid] < k) lo = mid + 1; else hi = mid;         \
+        }                                                           \
+        *found = lo < node->count && keys[lo] == k;                 \
+        return lo;                                                  \
+    } while (0)
+
+/*
+ *@return index of the first key not less than key
+ *@param found - set to 1 if that key equals key
+ */
+static size_t cbox_btree_lower_bound(const cbox_btree_t *tree, const cbox_btree_node_t *node, const void *key, int *found)
+{
+    size_t lo = 0, hi = node->count;
+
+    switch (tree->kind) {
+    case CBOX_BTREE_KEY_INT:
+        CBOX_BTREE_LOWER_BOUND(int);
+    case CBOX_BTREE_KEY_I64:
+        CBOX_BTREE_LOWER_BOUND(int64_t);
+    case CBOX_BTREE_KEY_U64:
+        CBOX_BTREE_LOWER_BOUND(uint64_t);
+    default:
+        break;
+    }
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cbox_btree_compare(tree, cbox_btree_key(tree, node, mid), key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *found = lo < node->count && cbox_btree_compare(tree, cbox_btree_key(tree, node, lo), key) == 0;
+    return lo;
+}
+
+/*
+ *@return index of the child of an inner node that holds key
+ */
+static inline size_t cbox_btree_child_index(const cbox_btree_t *tree, const cbox_btree_node_t *node, const void *key)
+{
+    int found = 0;
+    size_t index = cbox_btree_lower_bound(tree, node, key, &found);
+    return index + found;
+}
+
+static cbox_btree_node_t *cbox_btree_node_new(const cbox_btree_t *tree, int leaf)
+{
+    size_t bytes = leaf ? tree->values_offset + tree->leaf_cap * tree->value_size
+                        : tree->children_offset + (tree->inner_cap + 1) * sizeof(cbox_btree_node_t *);
+    void *ptr = NULL;
+
+    // cache line aligned, so a node spans the fewest lines
+    if (posix_memalign(&ptr, 64, sizeof(cbox_btree_node_t) + bytes) != 0)
+        return NULL;
+
+    cbox_btree_node_t *node = (cbox_btree_node_t *)ptr;
+    node->prev = NULL;
+    node->next = NULL;
+    node->count = 0;
+    node->leaf = leaf;
+    return node;
+}
+
+static void cbox_btree_node_free(const cbox_btree_t *tree, cbox_btree_node_t *node)
+{
+    size_t i = 0;
+
+    if (!node->leaf) {
+        for (i = 0; i <= node->count; ++i)
+            cbox_btree_node_free(tree, cbox_btree_children(tree, node)[i]);
+    }
+    free(node);
+}
+
+static void cbox_btree_leaf_insert(cbox_btree_t *tree, cbox_btree_node_t *leaf, size_t index, const void *key)
+{
+    size_t move = leaf->count - index;
+
+    memmove(cbox_btree_key(tree, leaf, index + 1), cbox_btree_key(tree, leaf, index), move * tree->key_size);
+    memmove(cbox_btree_value(tree, leaf, index + 1), cbox_btree_value(tree, leaf, index), move * tree->value_size);
+    memcpy(cbox_btree_key(tree, leaf, index), key, tree->key_size);
+    memset(cbox_btree_value(tree, leaf, index), 0, tree->value_size);
+    ++leaf->count;
+    ++tree->size;
+}
+
+/*
+ *@brief insert key at index and child right after it, i.e., at index + 1
+ */
+static void cbox_btree_inner_insert(cbox_btree_t *tree, cbox_btree_node_t *node, size_t index, const void *key,
+                                    cbox_btree_node_t *child)
+{
+    cbox_btree_node_t **children = cbox_btree_children(tree, node);
+
+    memmove(cbox_btree_key(tree, node, index + 1), cbox_btree_key(tree, node, index), (node->count - index) * tree->key_size);
+    memmove(children + index + 2, children + index + 1, (node->count - index) * sizeof(*children));
+    memcpy(cbox_btree_key(tree, node, index), key, tree->key_size);
+    children[index + 1] = child;
+    ++node->count;
+}
+
+/*
+ *@brief split the full leaf and insert the key
+ *@param spare - the nodes allocated by the caller, one per split, so the tree never
+ *               changes halfway because of memory
+ *@return the value of the key
+ */
+static void *cbox_btree_split_insert(cbox_btree_t *tree, cbox_btree_node_t **path, size_t *indexes, size_t depth,
+                                     cbox_btree_node_t *leaf, size_t index, const void *key, cbox_btree_node_t **spare)
+{
+    unsigned char *sep = tree->scratch, *up = tree->scratch + tree->key_size, *swap = NULL;
+    cbox_btree_node_t *right = *spare++, *child = NULL, *target = leaf;
+    size_t split = 0, d = 0;
+
+    // appending at the end of the last leaf leaves it full, so sorted inserts pack the leaves
+    split = (leaf->next == NULL && index == leaf->count) ? leaf->count : leaf->count / 2;
+
+    right->count = leaf->count - split;
+    memcpy(cbox_btree_key(tree, right, 0), cbox_btree_key(tree, leaf, split), right->count * tree->key_size);
+    memcpy(cbox_btree_value(tree, right, 0), cbox_btree_value(tree, leaf, split), right->count * tree->value_size);
+    leaf->count = split;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    leaf->next = right;
+
+    if (index >= split) {
+        target = right;
+        index -= split;
+    }
+    cbox_btree_leaf_insert(tree, target, index, key);
+    void *value = cbox_btree_value(tree, target, index);
+
+    memcpy(sep, cbox_btree_key(tree, right, 0), tree->key_size);
+    child = right;
+
+    for (d = depth; d-- > 0;) {
+        cbox_btree_node_t *node = path[d], *sibling = NULL;
+        size_t pos = indexes[d];
+
+        if (node->count < tree->inner_cap) {
+            cbox_btree_inner_insert(tree, node, pos, sep, child);
+            return value;
+        }
+
+        sibling = *spare++;
+        cbox_btree_node_t **children = cbox_btree_children(tree, node), **sibling_children = cbox_btree_children(tree, sibling);
+
+        if (pos == node->count) {
+            // appending, the separator itself moves up and the sibling only holds the new child
+            sibling->count = 0;
+            sibling_children[0] = child;
+        } else {
+            size_t mid = node->count / 2;
+
+            memcpy(up, cbox_btree_key(tree, node, mid), tree->key_size);
+            sibling->count = node->count - mid - 1;
+            memcpy(cbox_btree_key(tree, sibling, 0), cbox_btree_key(tree, node, mid + 1), sibling->count * tree->key_size);
+            memcpy(sibling_children, children + mid + 1, (sibling->count + 1) * sizeof(*children));
+            node->count = mid;
+
+            if (pos <= mid)
+                cbox_btree_inner_insert(tree, node, pos, sep, child);
+            else
+                cbox_btree_inner_insert(tree, sibling, pos - mid - 1, sep, child);
+
+            swap = sep, sep = up, up = swap;
+        }
+
+        child = sibling;
+    }
+
+    // the root is split, the tree grows by one level
+    cbox_btree_node_t *root = *spare;
+    root->count = 1;
+    memcpy(cbox_btree_key(tree, root, 0), sep, tree->key_size);
+    cbox_btree_children(tree, root)[0] = tree->root;
+    cbox_btree_children(tree, root)[1] = child;
+    tree->root = root;
+
+    return value;
+}
+
+cbox_btree_t *cbox_btree_create(size_t key_size, size_t value_size, cbox_btree_compare_t compare)
+{
+    if (key_size == 0)
+        return NULL;
+
+    cbox_btree_t *tree = (cbox_btree_t *)calloc(1, sizeof(cbox_btree_t));
+    if (tree == NULL)
+        return NULL;
+
+    tree->scratch = (unsigned char *)malloc(2 * key_size);
+    if (tree->scratch == NULL) {
+        CBOX_SAFETY_FREE(tree);
+        return NULL;
+    }
+
+    tree->key_size = key_size;
+    tree->value_size = value_size;
+    tree->compare = compare;
+
+    tree->leaf_cap = CBOX_BTREE_NODE_SIZE / (key_size + value_size);
+    tree->leaf_cap = CBOX_MIN(CBOX_MAX(tree->leaf_cap, CBOX_BTREE_MIN_FANOUT), CBOX_BTREE_MAX_FANOUT);
+    tree->inner_cap = CBOX_BTREE_NODE_SIZE / (key_size + sizeof(cbox_btree_node_t *));
+    tree->inner_cap = CBOX_MIN(CBOX_MAX(tree->inner_cap, CBOX_BTREE_MIN_FANOUT), CBOX_BTREE_MAX_FANOUT);
+    tree->values_offset = CBOX_BTREE_ALIGN(tree->leaf_cap * key_size);
+    tree->children_offset = CBOX_BTREE_ALIGN(tree->inner_cap * key_size);
+
+    if (compare == cbox_btree_compare_int && key_size == sizeof(int))
+        tree->kind = CBOX_BTREE_KEY_INT;
+    else if (compare == cbox_btree_compare_i64 && key_size == sizeof(int64_t))
+        tree->kind = CBOX_BTREE_KEY_I64;
+    else if (compare == cbox_btree_compare_u64 && key_size == sizeof(uint64_t))
+        tree->kind = CBOX_BTREE_KEY_U64;
+
+    return tree;
+}
+
+void cbox_btree_destroy(cbox_btree_t *tree)
+{
+    if (tree == NULL)
+        return;
+
+    cbox_btree_clear(tree);
+    CBOX_SAFETY_FREE(tree->scratch);
+    CBOX_SAFETY_FREE(tree);
+}
+
+void *cbox_btree_get(const cbox_btree_t *tree, const void *key)
+{
+    const cbox_btree_node_t *node = tree->root;
+    int found = 0;
+
+    if (node == NULL)
+        return NULL;
+
+    while (!node->leaf)
+        node = cbox_btree_children(tree, node)[cbox_btree_child_index(tree, node, key)];
+
+    size_t index = cbox_btree_lower_bound(tree, node, key, &found);
+    return found ? cbox_btree_value(tree, node, index) : NULL;
+}
+
+void *cbox_btree_emplace(cbox_btree_t *tree, const void *key, int *inserted)
+{
+    cbox_btree_node_t *path[CBOX_BTREE_MAX_DEPTH], *spare[CBOX_BTREE_MAX_DEPTH + 2];
+    size_t indexes[CBOX_BTREE_MAX_DEPTH], depth = 0, needed = 0, i = 0;
+    int found = 0;
+
+    if (inserted)
+        *inserted = 0;
+
+    if (tree->root == NULL) {
+        tree->root = cbox_btree_node_new(tree, 1);
+        if (tree->root == NULL)
+            return NULL;
+    }
+
+    cbox_btree_node_t *node = tree->root;
+    while (!node->leaf) {
+        path[depth] = node;
+        indexes[depth] = cbox_btree_child_index(tree, node, key);
+        node = cbox_btree_children(tree, node)[indexes[depth++]];
+    }
+
+    size_t index = cbox_btree_lower_bound(tree, node, key, &found);
+    if (found)
+        return cbox_btree_value(tree, node, index);
+
+    if (inserted)
+        *inserted = 1;
+
+    if (node->count < tree->leaf_cap) {
+        cbox_btree_leaf_insert(tree, node, index, key);
+        return cbox_btree_value(tree, node, index);
+    }
+
+    // a new leaf, a new inner node for every full ancestor, and a new root if they all are
+    needed = 1;
+    while (needed <= depth && path[depth - needed]->count == tree->inner_cap)
+        ++needed;
+    if (needed > depth)
+        ++needed;
+
+    for (i = 0; i < needed; ++i) {
+        spare[i] = cbox_btree_node_new(tree, i == 0);
+        if (spare[i] == NULL) {
+            while (i-- > 0)
+                free(spare[i]);
+            return NULL;
+        }
+    }
+
+    return cbox_btree_split_insert(tree, path, indexes, depth, node, index, key, spare);
+}
+
+int cbox_btree_put(cbox_btree_t *tree, const void *key, const void *value)
+{
+    void *slot = cbox_btree_emplace(tree, key, NULL);
+    if (slot == NULL)
+        return -1;
+
+    if (value)
+        memcpy(slot, value, tree->value_size);
+    return 0;
+}
+
+int cbox_btree_remove(cbox_btree_t *tree, const void *key, void *value)
+{
+    cbox_btree_node_t *path[CBOX_BTREE_MAX_DEPTH];
+    size_t indexes[CBOX_BTREE_MAX_DEPTH], depth = 0;
+    int found = 0;
+
+    cbox_btree_node_t *node = tree->root;
+    if (node == NULL)
+        return -1;
+
+    while (!node->leaf) {
+        path[depth] = node;
+        indexes[depth] = cbox_btree_child_index(tree, node, key);
+        node = cbox_btree_children(tree, node)[indexes[depth++]];
+    }
+
+    size_t index = cbox_btree_lower_bound(tree, node, key, &found);
+    if (!found)
+        return -1;
+
+    if (value)
+        memcpy(value, cbox_btree_value(tree, node, index), tree->value_size);
+
+    size_t move = node->count - index - 1;
+    memmove(cbox_btree_key(tree, node, index), cbox_btree_key(tree, node, index + 1), move * tree->key_size);
+    memmove(cbox_btree_value(tree, node, index), cbox_btree_value(tree, node, index + 1), move * tree->value_size);
+    --node->count;
+    --tree->size;
+
+    if (node->count > 0 || depth == 0)
+        return 0;
+
+    // the leaf is empty, unlink it, and the inner nodes left without a child
+    if (node->prev)
+        node->prev->next = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    free(node);
+
+    while (depth-- > 0) {
+        cbox_btree_node_t *parent = path[depth], **children = cbox_btree_children(tree, parent);
+        size_t pos = indexes[depth];
+
+        if (parent->count == 0) {
+            free(parent);
+            continue;
+        }
+
+        // child pos goes with the key before it, the first child with the key after it
+        size_t key_pos = pos > 0 ? pos - 1 : 0;
+        memmove(cbox_btree_key(tree, parent, key_pos), cbox_btree_key(tree, parent, key_pos + 1),
+                (parent->count - key_pos - 1) * tree->key_size);
+        memmove(children + pos, children + pos + 1, (parent->count - pos) * sizeof(*children));
+        --parent->count;
+        break;
+    }
+
+    if (depth == (size_t)-1) {
+        // every node on the path was freed, the tree is empty
+        tree->root = NULL;
+        return 0;
+    }
+
+    while (!tree->root->leaf && tree->root->count == 0) {
+        cbox_btree_node_t *root = tree->root;
+        tree->root = cbox_btree_children(tree, root)[0];
+        free(root);
+    }
+
+    return 0;
+}
+
+void cbox_btree_seek(const cbox_btree_t *tree, const void *key, cbox_btree_iter_t *iter)
+{
+    const cbox_btree_node_t *node = tree->root;
+    int found = 0;
+
+    iter->node = NULL;
+    iter->index = 0;
+    if (node == NULL)
+        return;
+
+    while (!node->leaf)
+        node = cbox_btree_children(tree, node)[key ? cbox_btree_child_index(tree, node, key) : 0];
+
+    iter->node = (void *)node;
+    iter->index = key ? cbox_btree_lower_bound(tree, node, key, &found) : 0;
+}
+
+int cbox_btree_next(const cbox_btree_t *tree, cbox_btree_iter_t *iter, const void **key, void **value)
+{
+    cbox_btree_node_t *node = (cbox_btree_node_t *)iter->node;
+
+    while (node && iter->index >= node->count) {
+        node = node->next;
+        iter->index = 0;
+    }
+
+    iter->node = node;
+    if (node == NULL)
+        return 0;
+
+    if (key)
+        *key = cbox_btree_key(tree, node, iter->index);
+    if (value)
+        *value = cbox_btree_value(tree, node, iter->index);
+    ++iter->index;
+    return 1;
+}
+
+int cbox_btree_build(cbox_btree_t *tree, const void *keys, const void *values, size_t count)
+{
+    const unsigned char *k = (const unsigned char *)keys, *v = (const unsigned char *)values;
+    cbox_btree_node_t **level = NULL, **upper = NULL, *prev = NULL;
+    size_t *firsts = NULL, n = 0, i = 0, j = 0;
+
+    if (tree->size != 0)
+        return -1;
+
+    // removing every key may leave an empty root leaf
+    cbox_btree_clear(tree);
+
+    for (i = 1; i < count; ++i) {
+        if (cbox_btree_compare(tree, k + (i - 1) * tree->key_size, k + i * tree->key_size) >= 0)
+            return -1;
+    }
+
+    if (count == 0)
+        return 0;
+
+    // the nodes of the level being built, and the index of the first key under each of them
+    n = (count + tree->leaf_cap - 1) / tree->leaf_cap;
+    level = (cbox_btree_node_t **)malloc(n * sizeof(*level));
+    upper = (cbox_btree_node_t **)malloc(n * sizeof(*upper));
+    firsts = (size_t *)malloc(n * sizeof(*firsts));
+    if (level == NULL || upper == NULL || firsts == NULL) {
+        n = 0;
+        goto CLEANUP;
+    }
+
+    for (i = 0; i < n; ++i) {
+        cbox_btree_node_t *leaf = cbox_btree_node_new(tree, 1);
+        if (leaf == NULL) {
+            n = i;
+            goto CLEANUP;
+        }
+
+        firsts[i] = i * tree->leaf_cap;
+        leaf->count = CBOX_MIN(tree->leaf_cap, count - firsts[i]);
+        memcpy(cbox_btree_key(tree, leaf, 0), k + firsts[i] * tree->key_size, leaf->count * tree->key_size);
+        if (v)
+            memcpy(cbox_btree_value(tree, leaf, 0), v + firsts[i] * tree->value_size, leaf->count * tree->value_size);
+        else
+            memset(cbox_btree_value(tree, leaf, 0), 0, leaf->count * tree->value_size);
+
+        leaf->prev = prev;
+        if (prev)
+            prev->next = leaf;
+        prev = leaf;
+        level[i] = leaf;
+    }
+
+    while (n > 1) {
+        size_t fanout = tree->inner_cap + 1, m = (n + fanout - 1) / fanout;
+
+        for (i = 0; i < m; ++i) {
+            cbox_btree_node_t *node = cbox_btree_node_new(tree, 0);
+            if (node == NULL) {
+                while (i-- > 0)
+                    free(upper[i]);
+                goto CLEANUP;
+            }
+
+            size_t first = i * fanout, children = CBOX_MIN(fanout, n - first);
+            node->count = children - 1;
+            memcpy(cbox_btree_children(tree, node), level + first, children * sizeof(*level));
+            for (j = 1; j < children; ++j)
+                memcpy(cbox_btree_key(tree, node, j - 1), k + firsts[first + j] * tree->key_size, tree->key_size);
+
+            upper[i] = node;
+            firsts[i] = firsts[first];
+        }
+
+        cbox_btree_node_t **swap = level;
+        level = upper;
+        upper = swap;
+        n = m;
+    }
+
+    tree->root = level[0];
+    tree->size = count;
+    n = 0;
+
+CLEANUP:
+    for (i = 0; i < n; ++i)
+        cbox_btree_node_free(tree, level[i]);
+    CBOX_SAFETY_FREE(firsts);
+    CBOX_SAFETY_FREE(upper);
+    CBOX_SAFETY_FREE(level);
+    return tree->root ? 0 : -1;
+}
+
+size_t cbox_btree_size(const cbox_btree_t *tree)
+{
+    return tree->size;
+}
+
+void cbox_btree_clear(cbox_btree_t *tree)
+{
+    if (tree->root)
+        cbox_btree_node_free(tree, tree->root);
+    tree->root = NULL;
+    tree->size = 0;
+}
+
+int cbox_btree_compare_int(const void *a, const void *b, size_t key_size)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    (void)key_size;
+    return (x > y) - (x < y);
+}
+
+int cbox_btree_compare_i64(const void *a, const void *b, size_t key_size)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    (void)key_size;
+    return (x > y) - (x < y);
+}
+
+int cbox_btree_compare_u64(const void *a, const void *b, size_t key_size)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    (void)key_size;
+    return (x > y) - (x < y);
+}
+
+int cbox_btree_compare_str(const void *a, const void *b, size_t key_size)
+{
+    (void)key_size;
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
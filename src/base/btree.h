@@ -0,0 +1,111 @@
+#ifndef _CBOX_BTREE_H_
+#define _CBOX_BTREE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * in-memory B+ tree, an ordered map with keys and values of fixed size stored inline.
+ * a node is about 512 bytes, i.e., 8 cache lines, the keys of a node are contiguous
+ * so a lookup binary-searches them without touching the values, and the leaves are
+ * linked so a range scan walks memory sequentially instead of chasing tree pointers.
+ * appending at the end keeps the leaves full, a time-indexed store only appends.
+ * the nodes are only freed when they become empty, there is no merge of underfull nodes.
+ * the addresses of the values change when the tree changes. not thread-safe
+ */
+typedef struct cbox_btree_s cbox_btree_t;
+
+typedef int (*cbox_btree_compare_t)(const void *a, const void *b, size_t key_size);  //!< <0, 0, >0 like memcmp()
+
+/*
+ * position of a pair, got by cbox_btree_seek(), valid until the tree changes
+ */
+typedef struct
+{
+    void *node;
+    size_t index;
+} cbox_btree_iter_t;
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/*
+ *@brief create the tree
+ *@param key_size - bytes of a key
+ *@param value_size - bytes of a value, 0 for a set
+ *@param compare - NULL means memcmp() of key_size bytes, or one of the compare functions below
+ *@return the tree, NULL: failed
+ */
+cbox_btree_t *cbox_btree_create(size_t key_size, size_t value_size, cbox_btree_compare_t compare);
+void cbox_btree_destroy(cbox_btree_t *tree);
+
+/*
+ *@return the value of the key, NULL: not found
+ */
+void *cbox_btree_get(const cbox_btree_t *tree, const void *key);
+
+/*
+ *@brief insert the key, or replace its value
+ *@param value - value_size bytes, NULL to leave the value of a new key zeroed
+ *@return 0: succeed, -1: no memory
+ */
+int cbox_btree_put(cbox_btree_t *tree, const void *key, const void *value);
+
+/*
+ *@brief find the key, or insert it with a zeroed value, so the value is filled in place
+ *@param inserted - set to 1 if the key is new, may be NULL
+ *@return the value, NULL: no memory
+ */
+void *cbox_btree_emplace(cbox_btree_t *tree, const void *key, int *inserted);
+
+/*
+ *@param value - where to copy the value of the removed key, may be NULL
+ *@return 0: removed, -1: not found
+ */
+int cbox_btree_remove(cbox_btree_t *tree, const void *key, void *value);
+
+/*
+ *@brief position the iterator at the first key not less than key, e.g., a range scan:
+ *       cbox_btree_iter_t iter; const void *k; void *v;
+ *       cbox_btree_seek(tree, &from, &iter);
+ *       while (cbox_btree_next(tree, &iter, &k, &v) && *(uint64_t *)k < to) { ... }
+ *@param key - NULL means the smallest key
+ */
+void cbox_btree_seek(const cbox_btree_t *tree, const void *key, cbox_btree_iter_t *iter);
+
+/*
+ *@brief get the pair at the iterator and move it forward, in ascending order of the keys
+ *@param key, value - may be NULL
+ *@return 1: got a pair, 0: no more
+ */
+int cbox_btree_next(const cbox_btree_t *tree, cbox_btree_iter_t *iter, const void **key, void **value);
+
+/*
+ *@brief fill an empty tree from sorted input, much faster than inserting one by one
+ *@param keys - count keys in strictly ascending order
+ *@param values - count values, NULL to leave them zeroed
+ *@return 0: succeed, -1: the tree is not empty, the keys are not sorted, or no memory
+ */
+int cbox_btree_build(cbox_btree_t *tree, const void *keys, const void *values, size_t count);
+
+size_t cbox_btree_size(const cbox_btree_t *tree);
+void cbox_btree_clear(cbox_btree_t *tree);
+
+/*
+ *@brief compare functions of the common keys, they are inlined into the search of a node
+ */
+int cbox_btree_compare_int(const void *a, const void *b, size_t key_size);
+int cbox_btree_compare_i64(const void *a, const void *b, size_t key_size);
+int cbox_btree_compare_u64(const void *a, const void *b, size_t key_size);
+
+/*
+ *@brief keys that are NUL-terminated strings, stored as const char *, the tree keeps the pointers
+ */
+int cbox_btree_compare_str(const void *a, const void *b, size_t key_size);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif //_CBOX_BTREE_H_
@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "btree.h"
+
+static void check_same(const cbox_btree_t *tree, const std::map<uint64_t, uint64_t> &expect)
+{
+    cbox_btree_iter_t iter;
+    const void *key = NULL;
+    void *value = NULL;
+    auto it = expect.begin();
+
+    ASSERT_EQ(cbox_btree_size(tree), expect.size());
+    cbox_btree_seek(tree, NULL, &iter);
+    while (cbox_btree_next(tree, &iter, &key, &value)) {
+        ASSERT_NE(it, expect.end());
+        ASSERT_EQ(*(const uint64_t *)key, it->first);
+        ASSERT_EQ(*(uint64_t *)value, it->second);
+        ++it;
+    }
+    EXPECT_EQ(it, expect.end());
+}
+
+TEST(Btree, random)
+{
+    cbox_btree_t *tree = cbox_btree_create(sizeof(uint64_t), sizeof(uint64_t), cbox_btree_compare_u64);
+    std::map<uint64_t, uint64_t> expect;
+    std::mt19937_64 rng(1);
+
+    for (int i = 0; i < 200000; ++i) {
+        uint64_t key = rng() % 50000, value = rng();
+        if (rng() % 3 == 0) {
+            uint64_t removed = 0;
+            int ret = cbox_btree_remove(tree, &key, &removed);
+            auto it = expect.find(key);
+            ASSERT_EQ(ret, it == expect.end() ? -1 : 0);
+            if (it != expect.end()) {
+                EXPECT_EQ(removed, it->second);
+                expect.erase(it);
+            }
+        } else {
+            ASSERT_EQ(cbox_btree_put(tree, &key, &value), 0);
+            expect[key] = value;
+        }
+    }
+    check_same(tree, expect);
+
+    for (uint64_t key = 0; key < 50000; ++key) {
+        uint64_t *value = (uint64_t *)cbox_btree_get(tree, &key);
+        auto it = expect.find(key);
+        ASSERT_EQ(value == NULL, it == expect.end());
+        if (value) {
+            EXPECT_EQ(*value, it->second);
+        }
+    }
+
+    // remove everything, the nodes are freed as they get empty
+    for (auto &pair : expect)
+        ASSERT_EQ(cbox_btree_remove(tree, &pair.first, NULL), 0);
+    expect.clear();
+    check_same(tree, expect);
+
+    uint64_t key = 1, value = 2;
+    EXPECT_EQ(cbox_btree_put(tree, &key, &value), 0);
+    expect[key] = value;
+    check_same(tree, expect);
+    cbox_btree_destroy(tree);
+}
+
+TEST(Btree, append_range)
+{
+    cbox_btree_t *tree = cbox_btree_create(sizeof(uint64_t), sizeof(uint64_t), cbox_btree_compare_u64);
+    std::map<uint64_t, uint64_t> expect;
+
+    // time-indexed appends, then range scans
+    for (uint64_t t = 0; t < 100000; ++t) {
+        uint64_t key = t * 10, value = t;
+        ASSERT_EQ(cbox_btree_put(tree, &key, &value), 0);
+        expect[key] = value;
+    }
+    check_same(tree, expect);
+
+    for (uint64_t from = 5; from < 1000000; from += 99991) {
+        cbox_btree_iter_t iter;
+        const void *key = NULL;
+        uint64_t to = from + 5000, count = 0;
+
+        cbox_btree_seek(tree, &from, &iter);
+        auto it = expect.lower_bound(from);
+        while (cbox_btree_next(tree, &iter, &key, NULL) && *(const uint64_t *)key < to) {
+            ASSERT_EQ(*(const uint64_t *)key, it->first);
+            ++it;
+            ++count;
+        }
+        EXPECT_EQ(count, std::distance(expect.lower_bound(from), expect.lower_bound(to)));
+    }
+
+    uint64_t past = 1000000;
+    cbox_btree_iter_t iter;
+    cbox_btree_seek(tree, &past, &iter);
+    EXPECT_EQ(cbox_btree_next(tree, &iter, NULL, NULL), 0);
+    cbox_btree_destroy(tree);
+}
+
+TEST(Btree, build)
+{
+    cbox_btree_t *tree = cbox_btree_create(sizeof(int), sizeof(int), cbox_btree_compare_int);
+    std::vector<int> keys, values;
+
+    for (int i = -50000; i < 50000; ++i) {
+        keys.push_back(i * 3);
+        values.push_back(i);
+    }
+
+    std::swap(keys[0], keys[1]);
+    EXPECT_EQ(cbox_btree_build(tree, keys.data(), values.data(), keys.size()), -1);
+    std::swap(keys[0], keys[1]);
+    ASSERT_EQ(cbox_btree_build(tree, keys.data(), values.data(), keys.size()), 0);
+    EXPECT_EQ(cbox_btree_build(tree, keys.data(), values.data(), keys.size()), -1);
+    EXPECT_EQ(cbox_btree_size(tree), keys.size());
+
+    for (size_t i = 0; i < keys.size(); ++i)
+        ASSERT_EQ(*(int *)cbox_btree_get(tree, &keys[i]), values[i]);
+    int missing = 1;
+    EXPECT_EQ(cbox_btree_get(tree, &missing), nullptr);
+
+    // the built tree takes inserts in between and removes
+    int inserted = 0;
+    EXPECT_NE(cbox_btree_emplace(tree, &missing, &inserted), nullptr);
+    EXPECT_EQ(inserted, 1);
+    for (size_t i = 0; i < keys.size(); i += 2)
+        ASSERT_EQ(cbox_btree_remove(tree, &keys[i], NULL), 0);
+    EXPECT_EQ(cbox_btree_size(tree), keys.size() / 2 + 1);
+
+    cbox_btree_clear(tree);
+    EXPECT_EQ(cbox_btree_size(tree), 0u);
+    EXPECT_EQ(cbox_btree_build(tree, keys.data(), NULL, keys.size()), 0);
+    EXPECT_EQ(*(int *)cbox_btree_get(tree, &keys[7]), 0);
+    cbox_btree_destroy(tree);
+
+    // emptied by removes, not by clear, the tree takes a build again
+    tree = cbox_btree_create(sizeof(int), sizeof(int), cbox_btree_compare_int);
+    EXPECT_EQ(cbox_btree_put(tree, &keys[0], &values[0]), 0);
+    EXPECT_EQ(cbox_btree_remove(tree, &keys[0], NULL), 0);
+    EXPECT_EQ(cbox_btree_size(tree), 0u);
+    ASSERT_EQ(cbox_btree_build(tree, keys.data(), values.data(), keys.size()), 0);
+    EXPECT_EQ(*(int *)cbox_btree_get(tree, &keys[3]), values[3]);
+    cbox_btree_destroy(tree);
+}
+
+TEST(Btree, str_set)
+{
+    cbox_btree_t *set = cbox_btree_create(sizeof(const char *), 0, cbox_btree_compare_str);
+    std::vector<std::string> words = { "pear", "apple", "fig", "banana", "apple" };
+    std::vector<std::string> sorted;
+
+    for (auto &word : words) {
+        const char *key = word.c_str();
+        cbox_btree_put(set, &key, NULL);
+    }
+
+    cbox_btree_iter_t iter;
+    const void *key = NULL;
+    cbox_btree_seek(set, NULL, &iter);
+    while (cbox_btree_next(set, &iter, &key, NULL))
+        sorted.push_back(*(const char * const *)key);
+
+    EXPECT_EQ(sorted, std::vector<std::string>({ "apple", "banana", "fig", "pear" }));
+    cbox_btree_destroy(set);
+}
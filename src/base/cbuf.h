@@ -75,6 +75,11 @@
 
 /* ---- Include Files ---------------------------------------------------- */
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 /* ---- Constants and Types ---------------------------------------------- */
 
 /**
@@ -170,6 +175,269 @@ private:
 
 #endif  // __cplusplus
 
+/* ---- SPSC ring ---------------------------------------------------------- */
+
+/*
+ * The CBUF_* macros above rely on volatile indices only, which orders nothing
+ * on weakly ordered cpus. cbox_spsc_t is the thread-safe single-producer
+ * single-consumer ring: the indices are published with release stores and read
+ * with acquire loads, each side keeps its index and a cached copy of the other
+ * side's index on its own cache line, so the other line is only read when the
+ * cached copy says the ring is full (or empty).
+ *
+ * The indices run freely and are masked, the capacity is a power of 2.
+ * The storage is either given to cbox_spsc_init(), e.g., a static array, or
+ * allocated by cbox_spsc_create() when the size is known at runtime.
+ *
+ *   cbox_spsc_t *q = cbox_spsc_create(sizeof(sample_t), 4096);
+ *   producer: cbox_spsc_push_n(q, samples, n);
+ *   consumer: n = cbox_spsc_pop_n(q, samples, 64);
+ */
+
+#define CBOX_SPSC_CACHE_LINE (64)
+
+typedef struct
+{
+    /* producer */
+    size_t head __attribute__((aligned(CBOX_SPSC_CACHE_LINE)));    //!< next element to write, atomic
+    size_t tail_cache;                                              //!< last tail seen by the producer
+
+    /* consumer */
+    size_t tail __attribute__((aligned(CBOX_SPSC_CACHE_LINE)));    //!< next element to read, atomic
+    size_t head_cache;                                              //!< last head seen by the consumer
+
+    /* read only */
+    size_t mask __attribute__((aligned(CBOX_SPSC_CACHE_LINE)));
+    size_t elem_size;
+    unsigned char *data;
+    int allocated;
+} cbox_spsc_t;
+
+/*
+ *@brief initialize the ring on the storage of the caller
+ *@param q - the ring
+ *@param data - capacity * elem_size bytes
+ *@param elem_size - bytes of an element
+ *@param capacity - elements, must be power of 2
+ *@return 0: succeed, -1: capacity is not power of 2
+ */
+static inline int cbox_spsc_init(cbox_spsc_t *q, void *data, size_t elem_size, size_t capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 || elem_size == 0)
+        return -1;
+
+    memset(q, 0, sizeof(*q));
+    q->mask = capacity - 1;
+    q->elem_size = elem_size;
+    q->data = (unsigned char *)data;
+    return 0;
+}
+
+/*
+ *@brief allocate the ring and its storage
+ *@param capacity - elements, rounded up to power of 2
+ *@return the ring, NULL: failed
+ */
+static inline cbox_spsc_t *cbox_spsc_create(size_t elem_size, size_t capacity)
+{
+    void *mem = NULL;
+    size_t size = 1;
+
+    while (size < capacity)
+        size <<= 1;
+
+    if (elem_size == 0 || size * elem_size / elem_size != size ||
+        posix_memalign(&mem, CBOX_SPSC_CACHE_LINE, sizeof(cbox_spsc_t) + size * elem_size) != 0)
+        return NULL;
+
+    cbox_spsc_t *q = (cbox_spsc_t *)mem;
+    cbox_spsc_init(q, (unsigned char *)mem + sizeof(cbox_spsc_t), elem_size, size);
+    q->allocated = 1;
+    return q;
+}
+
+static inline void cbox_spsc_destroy(cbox_spsc_t *q)
+{
+    if (q && q->allocated)
+        free(q);
+}
+
+static inline size_t cbox_spsc_capacity(const cbox_spsc_t *q)
+{
+    return q->mask + 1;
+}
+
+/*
+ *@brief number of elements, exact only when called by the producer or the consumer
+ *       while the other side is idle
+ */
+static inline size_t cbox_spsc_len(const cbox_spsc_t *q)
+{
+    return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * copies n elements from/to the ring at index, in two pieces when it wraps
+ */
+static inline void cbox_spsc_copy_in(cbox_spsc_t *q, size_t index, const void *elems, size_t n)
+{
+    size_t offset = index & q->mask, first = q->mask + 1 - offset;
+
+    if (n <= first) {
+        memcpy(q->data + offset * q->elem_size, elems, n * q->elem_size);
+    } else {
+        memcpy(q->data + offset * q->elem_size, elems, first * q->elem_size);
+        memcpy(q->data, (const unsigned char *)elems + first * q->elem_size, (n - first) * q->elem_size);
+    }
+}
+
+static inline void cbox_spsc_copy_out(cbox_spsc_t *q, size_t index, void *elems, size_t n)
+{
+    size_t offset = index & q->mask, first = q->mask + 1 - offset;
+
+    if (n <= first) {
+        memcpy(elems, q->data + offset * q->elem_size, n * q->elem_size);
+    } else {
+        memcpy(elems, q->data + offset * q->elem_size, first * q->elem_size);
+        memcpy((unsigned char *)elems + first * q->elem_size, q->data, (n - first) * q->elem_size);
+    }
+}
+
+/*
+ * room for the producer, the tail of the consumer is only loaded when the cached one is not enough
+ */
+static inline size_t cbox_spsc_free(cbox_spsc_t *q, size_t head, size_t n)
+{
+    size_t room = q->mask + 1 - (head - q->tail_cache);
+
+    if (room < n) {
+        q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        room = q->mask + 1 - (head - q->tail_cache);
+    }
+
+    return room;
+}
+
+static inline size_t cbox_spsc_avail(cbox_spsc_t *q, size_t tail, size_t n)
+{
+    size_t count = q->head_cache - tail;
+
+    if (count < n) {
+        q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        count = q->head_cache - tail;
+    }
+
+    return count;
+}
+
+/*
+ *@brief push up to n elements, called by the producer only
+ *@return elements pushed, less than n when the ring is full
+ */
+static inline size_t cbox_spsc_push_n(cbox_spsc_t *q, const void *elems, size_t n)
+{
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    size_t room = cbox_spsc_free(q, head, n);
+
+    if (n > room)
+        n = room;
+
+    if (n) {
+        cbox_spsc_copy_in(q, head, elems, n);
+        __atomic_store_n(&q->head, head + n, __ATOMIC_RELEASE);
+    }
+
+    return n;
+}
+
+/*
+ *@brief pop up to n elements, called by the consumer only
+ *@return elements popped, less than n when the ring is empty
+ */
+static inline size_t cbox_spsc_pop_n(cbox_spsc_t *q, void *elems, size_t n)
+{
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    size_t count = cbox_spsc_avail(q, tail, n);
+
+    if (n > count)
+        n = count;
+
+    if (n) {
+        cbox_spsc_copy_out(q, tail, elems, n);
+        __atomic_store_n(&q->tail, tail + n, __ATOMIC_RELEASE);
+    }
+
+    return n;
+}
+
+/*
+ *@return 0: succeed, -1: full
+ */
+static inline int cbox_spsc_push(cbox_spsc_t *q, const void *elem)
+{
+    return cbox_spsc_push_n(q, elem, 1) == 1 ? 0 : -1;
+}
+
+/*
+ *@return 0: succeed, -1: empty
+ */
+static inline int cbox_spsc_pop(cbox_spsc_t *q, void *elem)
+{
+    return cbox_spsc_pop_n(q, elem, 1) == 1 ? 0 : -1;
+}
+
+/*
+ *@brief zero-copy push, get the contiguous room to write in place, then cbox_spsc_commit()
+ *@param n - in: elements wanted, out: elements that can be written, up to the end of the storage
+ *@return where to write, NULL: full
+ */
+static inline void *cbox_spsc_reserve(cbox_spsc_t *q, size_t *n)
+{
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    size_t offset = head & q->mask, room = cbox_spsc_free(q, head, *n);
+
+    if (room > q->mask + 1 - offset)
+        room = q->mask + 1 - offset;
+    if (*n > room)
+        *n = room;
+
+    return *n ? q->data + offset * q->elem_size : NULL;
+}
+
+/*
+ *@brief publish n elements written after cbox_spsc_reserve()
+ */
+static inline void cbox_spsc_commit(cbox_spsc_t *q, size_t n)
+{
+    __atomic_store_n(&q->head, __atomic_load_n(&q->head, __ATOMIC_RELAXED) + n, __ATOMIC_RELEASE);
+}
+
+/*
+ *@brief zero-copy pop, get the contiguous elements to read in place, then cbox_spsc_release()
+ *@param n - in: elements wanted, out: elements that can be read, up to the end of the storage
+ *@return where to read, NULL: empty
+ */
+static inline const void *cbox_spsc_peek(cbox_spsc_t *q, size_t *n)
+{
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    size_t offset = tail & q->mask, count = cbox_spsc_avail(q, tail, *n);
+
+    if (count > q->mask + 1 - offset)
+        count = q->mask + 1 - offset;
+    if (*n > count)
+        *n = count;
+
+    return *n ? q->data + offset * q->elem_size : NULL;
+}
+
+/*
+ *@brief give back n elements read after cbox_spsc_peek()
+ */
+static inline void cbox_spsc_release(cbox_spsc_t *q, size_t n)
+{
+    __atomic_store_n(&q->tail, __atomic_load_n(&q->tail, __ATOMIC_RELAXED) + n, __ATOMIC_RELEASE);
+}
+
 /* ---- Variable Externs ------------------------------------------------- */
 /* ---- Function Prototypes ---------------------------------------------- */
 
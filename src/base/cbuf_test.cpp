@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include "cbuf.h"
+
+TEST(Spsc, init)
+{
+    uint32_t storage[8];
+    cbox_spsc_t q;
+
+    EXPECT_EQ(cbox_spsc_init(&q, storage, sizeof(uint32_t), 6), -1);
+    EXPECT_EQ(cbox_spsc_init(&q, storage, sizeof(uint32_t), 8), 0);
+    EXPECT_EQ(cbox_spsc_capacity(&q), 8u);
+
+    cbox_spsc_t *r = cbox_spsc_create(sizeof(uint32_t), 100);
+    ASSERT_NE(r, nullptr);
+    EXPECT_EQ(cbox_spsc_capacity(r), 128u);
+    EXPECT_EQ((uintptr_t)r % CBOX_SPSC_CACHE_LINE, 0u);
+    cbox_spsc_destroy(r);
+}
+
+TEST(Spsc, bulk)
+{
+    uint32_t storage[8], in[12], out[12];
+    cbox_spsc_t q;
+
+    cbox_spsc_init(&q, storage, sizeof(uint32_t), 8);
+    for (uint32_t i = 0; i < 12; ++i) in[i] = i;
+
+    EXPECT_EQ(cbox_spsc_push_n(&q, in, 5), 5u);
+    EXPECT_EQ(cbox_spsc_pop_n(&q, out, 3), 3u);
+    EXPECT_EQ(out[2], 2u);
+
+    // wraps around the end of the storage
+    EXPECT_EQ(cbox_spsc_push_n(&q, in + 5, 7), 6u);
+    EXPECT_EQ(cbox_spsc_len(&q), 8u);
+    EXPECT_EQ(cbox_spsc_push(&q, in), -1);
+    EXPECT_EQ(cbox_spsc_pop_n(&q, out, 12), 8u);
+    for (uint32_t i = 0; i < 8; ++i) {
+        EXPECT_EQ(out[i], i + 3);
+    }
+    EXPECT_EQ(cbox_spsc_pop(&q, out), -1);
+}
+
+TEST(Spsc, reserve_commit)
+{
+    uint32_t storage[8];
+    cbox_spsc_t q;
+    size_t n = 0;
+
+    cbox_spsc_init(&q, storage, sizeof(uint32_t), 8);
+    uint32_t v = 0;
+    for (int i = 0; i < 6; ++i) cbox_spsc_push(&q, &v);
+    for (int i = 0; i < 6; ++i) cbox_spsc_pop(&q, &v);
+
+    // only the 2 slots up to the end of the storage are contiguous
+    n = 5;
+    uint32_t *w = (uint32_t *)cbox_spsc_reserve(&q, &n);
+    ASSERT_NE(w, nullptr);
+    EXPECT_EQ(n, 2u);
+    w[0] = 10;
+    w[1] = 11;
+    cbox_spsc_commit(&q, n);
+
+    n = 8;
+    const uint32_t *r = (const uint32_t *)cbox_spsc_peek(&q, &n);
+    ASSERT_NE(r, nullptr);
+    EXPECT_EQ(n, 2u);
+    EXPECT_EQ(r[0], 10u);
+    EXPECT_EQ(r[1], 11u);
+    cbox_spsc_release(&q, n);
+
+    n = 1;
+    EXPECT_EQ(cbox_spsc_peek(&q, &n), nullptr);
+    EXPECT_EQ(n, 0u);
+}
+
+TEST(Spsc, threads)
+{
+    const uint64_t count = 1000000;
+    cbox_spsc_t *q = cbox_spsc_create(sizeof(uint64_t), 1024);
+    ASSERT_NE(q, nullptr);
+
+    std::thread producer([q, count] {
+        uint64_t batch[16];
+        uint64_t next = 0;
+        while (next < count) {
+            size_t n = 0;
+            for (; n < 16 && next + n < count; ++n) batch[n] = next + n;
+            size_t pushed = 0;
+            while ((pushed += cbox_spsc_push_n(q, batch + pushed, n - pushed)) < n)
+                std::this_thread::yield();
+            next += n;
+        }
+    });
+
+    uint64_t expect = 0, value[32];
+    bool ordered = true;
+    while (expect < count) {
+        size_t n = cbox_spsc_pop_n(q, value, 32);
+        if (n == 0)
+            std::this_thread::yield();
+        for (size_t i = 0; i < n; ++i, ++expect)
+            if (value[i] != expect) ordered = false;
+    }
+
+    producer.join();
+    EXPECT_TRUE(ordered);
+    EXPECT_EQ(cbox_spsc_len(q), 0u);
+    cbox_spsc_destroy(q);
+}
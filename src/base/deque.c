@@ -0,0 +1,184 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "deque.h"
+#include "macros.h"
+
+#define CBOX_DEQUE_DEFAULT_CAPACITY (16)
+
+struct cbox_deque_s
+{
+    unsigned char *data;
+    size_t elem_size;
+    size_t mask;    //!< capacity - 1
+    size_t head;    //!< index of the front element
+    size_t size;
+};
+
+static inline unsigned char *cbox_deque_slot(const cbox_deque_t *deque, size_t index)
+{
+    return deque->data + ((deque->head + index) & deque->mask) * deque->elem_size;
+}
+
+cbox_deque_t *cbox_deque_create(size_t elem_size, size_t capacity)
+{
+    size_t size = CBOX_DEQUE_DEFAULT_CAPACITY;
+
+    if (elem_size == 0)
+        return NULL;
+
+    if (capacity) {
+        size = 1;
+        while (size < capacity)
+            size <<= 1;
+    }
+
+    cbox_deque_t *deque = (cbox_deque_t *)calloc(1, sizeof(cbox_deque_t));
+    if (deque == NULL)
+        return NULL;
+
+    if (size * elem_size / elem_size != size || (deque->data = (unsigned char *)malloc(size * elem_size)) == NULL) {
+        CBOX_SAFETY_FREE(deque);
+        return NULL;
+    }
+
+    deque->elem_size = elem_size;
+    deque->mask = size - 1;
+    return deque;
+}
+
+void cbox_deque_destroy(cbox_deque_t *deque)
+{
+    if (deque == NULL)
+        return;
+
+    CBOX_SAFETY_FREE(deque->data);
+    CBOX_SAFETY_FREE(deque);
+}
+
+/*
+ * moves the elements to the front of a bigger buffer, in two pieces when they wrap
+ */
+static int cbox_deque_resize(cbox_deque_t *deque, size_t capacity)
+{
+    size_t old = deque->mask + 1, first = old - deque->head;
+
+    if (capacity * deque->elem_size / deque->elem_size != capacity)
+        return -1;
+
+    unsigned char *data = (unsigned char *)malloc(capacity * deque->elem_size);
+    if (data == NULL)
+        return -1;
+
+    if (deque->size <= first) {
+        memcpy(data, deque->data + deque->head * deque->elem_size, deque->size * deque->elem_size);
+    } else {
+        memcpy(data, deque->data + deque->head * deque->elem_size, first * deque->elem_size);
+        memcpy(data + first * deque->elem_size, deque->data, (deque->size - first) * deque->elem_size);
+    }
+
+    free(deque->data);
+    deque->data = data;
+    deque->mask = capacity - 1;
+    deque->head = 0;
+    return 0;
+}
+
+int cbox_deque_reserve(cbox_deque_t *deque, size_t count)
+{
+    size_t capacity = deque->mask + 1;
+
+    if (count <= capacity)
+        return 0;
+
+    while (capacity < count) {
+        if (capacity << 1 == 0)
+            return -1;
+        capacity <<= 1;
+    }
+
+    return cbox_deque_resize(deque, capacity);
+}
+
+static inline int cbox_deque_grow(cbox_deque_t *deque)
+{
+    return deque->size <= deque->mask ? 0 : cbox_deque_reserve(deque, deque->size + 1);
+}
+
+int cbox_deque_push_back(cbox_deque_t *deque, const void *elem)
+{
+    if (cbox_deque_grow(deque) != 0)
+        return -1;
+
+    memcpy(cbox_deque_slot(deque, deque->size), elem, deque->elem_size);
+    deque->size++;
+    return 0;
+}
+
+int cbox_deque_push_front(cbox_deque_t *deque, const void *elem)
+{
+    if (cbox_deque_grow(deque) != 0)
+        return -1;
+
+    deque->head = (deque->head - 1) & deque->mask;
+    memcpy(cbox_deque_slot(deque, 0), elem, deque->elem_size);
+    deque->size++;
+    return 0;
+}
+
+int cbox_deque_pop_front(cbox_deque_t *deque, void *elem)
+{
+    if (deque->size == 0)
+        return -1;
+
+    if (elem)
+        memcpy(elem, cbox_deque_slot(deque, 0), deque->elem_size);
+
+    deque->head = (deque->head + 1) & deque->mask;
+    deque->size--;
+    return 0;
+}
+
+int cbox_deque_pop_back(cbox_deque_t *deque, void *elem)
+{
+    if (deque->size == 0)
+        return -1;
+
+    if (elem)
+        memcpy(elem, cbox_deque_slot(deque, deque->size - 1), deque->elem_size);
+
+    deque->size--;
+    return 0;
+}
+
+void *cbox_deque_front(cbox_deque_t *deque)
+{
+    return cbox_deque_at(deque, 0);
+}
+
+void *cbox_deque_back(cbox_deque_t *deque)
+{
+    return deque->size ? cbox_deque_at(deque, deque->size - 1) : NULL;
+}
+
+void *cbox_deque_at(cbox_deque_t *deque, size_t index)
+{
+    return index < deque->size ? cbox_deque_slot(deque, index) : NULL;
+}
+
+size_t cbox_deque_size(const cbox_deque_t *deque)
+{
+    return deque->size;
+}
+
+size_t cbox_deque_capacity(const cbox_deque_t *deque)
+{
+    return deque->mask + 1;
+}
+
+void cbox_deque_clear(cbox_deque_t *deque)
+{
+    deque->head = 0;
+    deque->size = 0;
+}
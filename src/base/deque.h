@@ -0,0 +1,61 @@
+#ifndef _CBOX_DEQUE_H_
+#define _CBOX_DEQUE_H_
+
+#include <stddef.h>
+
+/*
+ * double-ended queue of fixed size elements stored contiguously in a ring,
+ * push and pop at both ends and size are O(1), the ring doubles when it is full.
+ * not thread-safe
+ */
+typedef struct cbox_deque_s cbox_deque_t;
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/*
+ *@brief create the deque
+ *@param elem_size - bytes of an element
+ *@param capacity - initial elements, rounded up to power of 2, 0 means 16
+ *@return the deque, NULL: failed
+ */
+cbox_deque_t *cbox_deque_create(size_t elem_size, size_t capacity);
+void cbox_deque_destroy(cbox_deque_t *deque);
+
+/*
+ *@return 0: succeed, -1: no memory to grow
+ */
+int cbox_deque_push_back(cbox_deque_t *deque, const void *elem);
+int cbox_deque_push_front(cbox_deque_t *deque, const void *elem);
+
+/*
+ *@param elem - where to copy the element, NULL to discard it
+ *@return 0: succeed, -1: empty
+ */
+int cbox_deque_pop_front(cbox_deque_t *deque, void *elem);
+int cbox_deque_pop_back(cbox_deque_t *deque, void *elem);
+
+/*
+ *@brief the elements in place, valid until the next push
+ *@return the element, NULL: empty or out of range
+ */
+void *cbox_deque_front(cbox_deque_t *deque);
+void *cbox_deque_back(cbox_deque_t *deque);
+void *cbox_deque_at(cbox_deque_t *deque, size_t index);
+
+size_t cbox_deque_size(const cbox_deque_t *deque);
+size_t cbox_deque_capacity(const cbox_deque_t *deque);
+
+/*
+ *@brief make room for count elements, so the next pushes do not allocate
+ *@return 0: succeed, -1: no memory
+ */
+int cbox_deque_reserve(cbox_deque_t *deque, size_t count);
+void cbox_deque_clear(cbox_deque_t *deque);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif //_CBOX_DEQUE_H_
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include <deque>
+#include "deque.h"
+#include "dqueue.h"
+
+TEST(Deque, push_pop)
+{
+    cbox_deque_t *deque = cbox_deque_create(sizeof(int), 4);
+    ASSERT_NE(deque, nullptr);
+    std::deque<int> expect;
+    int value = 0;
+
+    // grows while the elements wrap around the end of the ring
+    for (int i = 0; i < 100; ++i) {
+        if (i % 3 == 0) {
+            EXPECT_EQ(cbox_deque_push_front(deque, &i), 0);
+            expect.push_front(i);
+        } else {
+            EXPECT_EQ(cbox_deque_push_back(deque, &i), 0);
+            expect.push_back(i);
+        }
+        if (i % 5 == 0) {
+            EXPECT_EQ(cbox_deque_pop_front(deque, &value), 0);
+            EXPECT_EQ(value, expect.front());
+            expect.pop_front();
+        }
+    }
+
+    ASSERT_EQ(cbox_deque_size(deque), expect.size());
+    EXPECT_EQ(cbox_deque_capacity(deque), 128u);
+    for (size_t i = 0; i < expect.size(); ++i) {
+        EXPECT_EQ(*(int *)cbox_deque_at(deque, i), expect[i]);
+    }
+    EXPECT_EQ(cbox_deque_at(deque, expect.size()), nullptr);
+    EXPECT_EQ(*(int *)cbox_deque_front(deque), expect.front());
+    EXPECT_EQ(*(int *)cbox_deque_back(deque), expect.back());
+
+    while (!expect.empty()) {
+        EXPECT_EQ(cbox_deque_pop_back(deque, &value), 0);
+        EXPECT_EQ(value, expect.back());
+        expect.pop_back();
+    }
+    EXPECT_EQ(cbox_deque_pop_back(deque, &value), -1);
+    EXPECT_EQ(cbox_deque_pop_front(deque, NULL), -1);
+    EXPECT_EQ(cbox_deque_front(deque), nullptr);
+    EXPECT_EQ(cbox_deque_back(deque), nullptr);
+
+    EXPECT_EQ(cbox_deque_reserve(deque, 1000), 0);
+    EXPECT_EQ(cbox_deque_capacity(deque), 1024u);
+    cbox_deque_destroy(deque);
+}
+
+struct dqueue_node
+{
+    int value;
+    struct list_head node;
+};
+
+TEST(Deque, counted_dqueue)
+{
+    cbox_dqueue_t q;
+    dqueue_node nodes[4];
+
+    CBOX_DQUEUE_INIT(&q);
+    EXPECT_TRUE(CBOX_DQUEUE_EMPTY(&q));
+
+    for (int i = 0; i < 4; ++i) {
+        nodes[i].value = i;
+        CBOX_DQUEUE_PUSH_BACK(&nodes[i].node, &q);
+    }
+    EXPECT_EQ(CBOX_DQUEUE_SIZE(&q), 4u);
+    EXPECT_EQ(DQUEUE_SIZE(&q.head), 4);
+
+    CBOX_DQUEUE_REMOVE(&nodes[2].node, &q);
+    EXPECT_EQ(CBOX_DQUEUE_SIZE(&q), 3u);
+
+    dqueue_node *front = CBOX_DQUEUE_POP_FRONT(&q, dqueue_node, node);
+    dqueue_node *back = CBOX_DQUEUE_POP_BACK(&q, dqueue_node, node);
+    EXPECT_EQ(front->value, 0);
+    EXPECT_EQ(back->value, 3);
+    EXPECT_EQ(CBOX_DQUEUE_SIZE(&q), 1u);
+    EXPECT_EQ(CBOX_DQUEUE_FRONT(&q, dqueue_node, node)->value, 1);
+
+    CBOX_DQUEUE_PUSH_FRONT(&nodes[0].node, &q);
+    EXPECT_EQ(CBOX_DQUEUE_BACK(&q, dqueue_node, node)->value, 1);
+    EXPECT_EQ(CBOX_DQUEUE_SIZE(&q), 2u);
+}
@@ -1,6 +1,7 @@
 #ifndef _CBOX_DQUEUE_H_
 #define _CBOX_DQUEUE_H_
 
+#include <stddef.h>
 #include "list.h"
 
 #define DQUEUE_CREATE(head) INIT_LIST_HEAD(head)
@@ -27,6 +28,9 @@
         (temp); \
         })
 
+/*
+ * walks the whole list, use cbox_dqueue_t below when the size is needed often
+ */
 #define DQUEUE_SIZE(head) ({ \
             struct list_head *pos; \
             int size = 0; \
@@ -37,4 +41,41 @@
 
 #define DQUEUE_EMPTY(head) list_empty(head)
 
+/*
+ * intrusive deque with an element counter, CBOX_DQUEUE_SIZE() is O(1).
+ * the nodes must only be linked and unlinked with the CBOX_DQUEUE_* macros,
+ * for a deque of values stored contiguously, see cbox_deque_t in deque.h
+ */
+typedef struct
+{
+    struct list_head head;
+    size_t size;
+} cbox_dqueue_t;
+
+#define CBOX_DQUEUE_INIT(q) do { INIT_LIST_HEAD(&(q)->head); (q)->size = 0; } while (0)
+
+#define CBOX_DQUEUE_PUSH_FRONT(new_node, q) do { list_add(new_node, &(q)->head); (q)->size++; } while (0)
+#define CBOX_DQUEUE_PUSH_BACK(new_node, q) do { list_add_tail(new_node, &(q)->head); (q)->size++; } while (0)
+
+/*
+ * unlinks a node from anywhere in the deque
+ */
+#define CBOX_DQUEUE_REMOVE(node, q) do { list_del_init(node); (q)->size--; } while (0)
+
+#define CBOX_DQUEUE_FRONT(q, type_of_struct, member_name) DQUEUE_FRONT(&(q)->head, type_of_struct, member_name)
+#define CBOX_DQUEUE_BACK(q, type_of_struct, member_name) DQUEUE_BACK(&(q)->head, type_of_struct, member_name)
+
+#define CBOX_DQUEUE_POP_FRONT(q, type_of_struct, member_name) ({ \
+        (q)->size--; \
+        DQUEUE_POP_FRONT(&(q)->head, type_of_struct, member_name); \
+        })
+
+#define CBOX_DQUEUE_POP_BACK(q, type_of_struct, member_name) ({ \
+        (q)->size--; \
+        DQUEUE_POP_BACK(&(q)->head, type_of_struct, member_name); \
+        })
+
+#define CBOX_DQUEUE_SIZE(q) ((q)->size)
+#define CBOX_DQUEUE_EMPTY(q) ((q)->size == 0)
+
 #endif /* _CBOX_DQUEUE_H_ */
@@ -0,0 +1,440 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "hashmap.h"
+#include "macros.h"
+
+#define CBOX_HASHMAP_GROUP (16)
+#define CBOX_HASHMAP_MIN_CAPACITY (16)
+
+#define CBOX_HASHMAP_EMPTY ((int8_t)-128)   //!< 0b10000000
+#define CBOX_HASHMAP_DELETED ((int8_t)-2)   //!< 0b11111110, the full ones are 0b0xxxxxxx
+
+struct cbox_hashmap_s
+{
+    int8_t *ctrl;           //!< capacity + CBOX_HASHMAP_GROUP bytes, the first group is mirrored at the end
+    unsigned char *slots;   //!< capacity * stride bytes
+    size_t mask;            //!< capacity - 1
+    size_t size;
+    size_t growth_left;     //!< empty slots that can be used before rehashing
+    size_t key_size;
+    size_t value_size;
+    size_t value_offset;    //!< the value follows the key, 8 bytes aligned
+    size_t stride;
+    cbox_hashmap_hash_t hash;
+    cbox_hashmap_equal_t equal;
+};
+
+#if defined(__SSE2__)
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+/*
+ * NEON has no movemask, weight the bytes of each half by their bit and add them up
+ */
+static inline uint32_t cbox_hashmap_movemask(uint8x16_t bytes)
+{
+    static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t bits = vandq_u8(bytes, vld1q_u8(weights));
+    return vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+}
+#else
+#define CBOX_HASHMAP_LSB (0x0101010101010101ULL)
+#define CBOX_HASHMAP_MSB (0x8080808080808080ULL)
+
+/*
+ * 8 control bytes as a word, byte i in bits 8i to 8i + 7 whatever the byte order
+ */
+static inline uint64_t cbox_hashmap_load64(const int8_t *group)
+{
+    uint64_t word;
+    memcpy(&word, group, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/*
+ * the top bits of the 8 bytes to bits 0 to 7, the products of the multiply never overlap
+ */
+static inline uint32_t cbox_hashmap_gather64(uint64_t msb)
+{
+    return (uint32_t)(((msb >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+static inline uint32_t cbox_hashmap_match64(const int8_t *group, int8_t value)
+{
+    uint64_t x = cbox_hashmap_load64(group) ^ (CBOX_HASHMAP_LSB * (uint8_t)value);
+    // exact, the top bit of a byte is set only if the byte is zero
+    uint64_t zero = ~(((x & ~CBOX_HASHMAP_MSB) + ~CBOX_HASHMAP_MSB) | x | ~CBOX_HASHMAP_MSB);
+    return cbox_hashmap_gather64(zero);
+}
+#endif
+
+/*
+ * bit i is set if control byte i of the group matches
+ */
+static inline uint32_t cbox_hashmap_match(const int8_t *group, int8_t value)
+{
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(value), ctrl));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    return cbox_hashmap_movemask(vceqq_s8(vld1q_s8(group), vdupq_n_s8(value)));
+#else
+    return cbox_hashmap_match64(group, value) | (cbox_hashmap_match64(group + 8, value) << 8);
+#endif
+}
+
+/*
+ * empty or deleted, the sign bit is set
+ */
+static inline uint32_t cbox_hashmap_match_free(const int8_t *group)
+{
+#if defined(__SSE2__)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    return cbox_hashmap_movemask(vcltzq_s8(vld1q_s8(group)));
+#else
+    return cbox_hashmap_gather64(cbox_hashmap_load64(group) & CBOX_HASHMAP_MSB) |
+           (cbox_hashmap_gather64(cbox_hashmap_load64(group + 8) & CBOX_HASHMAP_MSB) << 8);
+#endif
+}
+
+static inline unsigned char *cbox_hashmap_slot(const cbox_hashmap_t *map, size_t index)
+{
+    return map->slots + index * map->stride;
+}
+
+static inline void cbox_hashmap_set_ctrl(cbox_hashmap_t *map, size_t index, int8_t value)
+{
+    map->ctrl[index] = value;
+    if (index < CBOX_HASHMAP_GROUP)
+        map->ctrl[map->mask + 1 + index] = value;
+}
+
+static inline size_t cbox_hashmap_growth(size_t capacity)
+{
+    return capacity - capacity / 8;
+}
+
+static inline int cbox_hashmap_key_equal(const cbox_hashmap_t *map, const void *a, const void *b)
+{
+    uint32_t a32, b32;
+    uint64_t a64, b64;
+
+    if (map->equal)
+        return map->equal(a, b, map->key_size);
+
+    // int and pointer keys compare as one word instead of calling memcmp()
+    switch (map->key_size) {
+    case sizeof(uint32_t):
+        memcpy(&a32, a, sizeof(a32));
+        memcpy(&b32, b, sizeof(b32));
+        return a32 == b32;
+    case sizeof(uint64_t):
+        memcpy(&a64, a, sizeof(a64));
+        memcpy(&b64, b, sizeof(b64));
+        return a64 == b64;
+    default:
+        return memcmp(a, b, map->key_size) == 0;
+    }
+}
+
+static inline uint64_t cbox_hashmap_hash_key(const cbox_hashmap_t *map, const void *key)
+{
+    return map->hash ? map->hash(key, map->key_size) : cbox_hashmap_hash_bytes(key, map->key_size);
+}
+
+/*
+ *@return index of the slot of the key, -1: not found
+ */
+static ptrdiff_t cbox_hashmap_find(const cbox_hashmap_t *map, const void *key, uint64_t hash)
+{
+    size_t pos = (size_t)(hash >> 7) & map->mask, step = 0;
+    int8_t h2 = (int8_t)(hash & 0x7f);
+
+    for (;;) {
+        const int8_t *group = map->ctrl + pos;
+        uint32_t match = cbox_hashmap_match(group, h2);
+
+        while (match) {
+            size_t index = (pos + __builtin_ctz(match)) & map->mask;
+            if (cbox_hashmap_key_equal(map, cbox_hashmap_slot(map, index), key))
+                return (ptrdiff_t)index;
+            match &= match - 1;
+        }
+
+        // the key would have been put in the empty slot
+        if (cbox_hashmap_match(group, CBOX_HASHMAP_EMPTY))
+            return -1;
+
+        // triangular probing visits every group of a power of 2 capacity
+        step += CBOX_HASHMAP_GROUP;
+        pos = (pos + step) & map->mask;
+    }
+}
+
+/*
+ *@return index of the first empty or deleted slot on the probe sequence of the hash
+ */
+static size_t cbox_hashmap_find_free(const cbox_hashmap_t *map, uint64_t hash)
+{
+    size_t pos = (size_t)(hash >> 7) & map->mask, step = 0;
+
+    for (;;) {
+        uint32_t match = cbox_hashmap_match_free(map->ctrl + pos);
+        if (match)
+            return (pos + __builtin_ctz(match)) & map->mask;
+
+        step += CBOX_HASHMAP_GROUP;
+        pos = (pos + step) & map->mask;
+    }
+}
+
+static int cbox_hashmap_alloc(cbox_hashmap_t *map, size_t capacity)
+{
+    int8_t *ctrl = NULL;
+    unsigned char *slots = NULL;
+
+    if (capacity * map->stride / map->stride != capacity ||
+        (ctrl = (int8_t *)malloc(capacity + CBOX_HASHMAP_GROUP)) == NULL ||
+        (slots = (unsigned char *)malloc(capacity * map->stride)) == NULL) {
+        CBOX_SAFETY_FREE(ctrl);
+        return -1;
+    }
+
+    memset(ctrl, CBOX_HASHMAP_EMPTY, capacity + CBOX_HASHMAP_GROUP);
+    map->ctrl = ctrl;
+    map->slots = slots;
+    map->mask = capacity - 1;
+    map->growth_left = cbox_hashmap_growth(capacity) - map->size;
+    return 0;
+}
+
+/*
+ * moves the keys into new arrays of the capacity, which drops the deleted slots too
+ */
+static int cbox_hashmap_rehash(cbox_hashmap_t *map, size_t capacity)
+{
+    int8_t *old_ctrl = map->ctrl;
+    unsigned char *old_slots = map->slots;
+    size_t old_capacity = map->mask + 1, i = 0;
+
+    if (cbox_hashmap_alloc(map, capacity) != 0) {
+        map->ctrl = old_ctrl;
+        map->slots = old_slots;
+        return -1;
+    }
+
+    for (i = 0; i < old_capacity; ++i) {
+        if (old_ctrl[i] < 0)
+            continue;
+
+        unsigned char *slot = old_slots + i * map->stride;
+        uint64_t hash = cbox_hashmap_hash_key(map, slot);
+        size_t index = cbox_hashmap_find_free(map, hash);
+
+        cbox_hashmap_set_ctrl(map, index, (int8_t)(hash & 0x7f));
+        memcpy(cbox_hashmap_slot(map, index), slot, map->stride);
+    }
+
+    free(old_ctrl);
+    free(old_slots);
+    return 0;
+}
+
+cbox_hashmap_t *cbox_hashmap_create(size_t key_size, size_t value_size, cbox_hashmap_hash_t hash, cbox_hashmap_equal_t equal)
+{
+    if (key_size == 0)
+        return NULL;
+
+    cbox_hashmap_t *map = (cbox_hashmap_t *)calloc(1, sizeof(cbox_hashmap_t));
+    if (map == NULL)
+        return NULL;
+
+    map->key_size = key_size;
+    map->value_size = value_size;
+    map->value_offset = (key_size + 7) & ~(size_t)7;
+    map->stride = map->value_offset + ((value_size + 7) & ~(size_t)7);
+    map->hash = hash;
+    map->equal = equal;
+
+    if (cbox_hashmap_alloc(map, CBOX_HASHMAP_MIN_CAPACITY) != 0) {
+        CBOX_SAFETY_FREE(map);
+        return NULL;
+    }
+
+    return map;
+}
+
+void cbox_hashmap_destroy(cbox_hashmap_t *map)
+{
+    if (map == NULL)
+        return;
+
+    CBOX_SAFETY_FREE(map->ctrl);
+    CBOX_SAFETY_FREE(map->slots);
+    CBOX_SAFETY_FREE(map);
+}
+
+void *cbox_hashmap_get(const cbox_hashmap_t *map, const void *key)
+{
+    ptrdiff_t index = cbox_hashmap_find(map, key, cbox_hashmap_hash_key(map, key));
+    return index < 0 ? NULL : cbox_hashmap_slot(map, index) + map->value_offset;
+}
+
+void *cbox_hashmap_emplace(cbox_hashmap_t *map, const void *key, int *inserted)
+{
+    uint64_t hash = cbox_hashmap_hash_key(map, key);
+    ptrdiff_t found = cbox_hashmap_find(map, key, hash);
+
+    if (inserted)
+        *inserted = found < 0;
+    if (found >= 0)
+        return cbox_hashmap_slot(map, found) + map->value_offset;
+
+    size_t index = cbox_hashmap_find_free(map, hash);
+    if (map->growth_left == 0 && map->ctrl[index] == CBOX_HASHMAP_EMPTY) {
+        // mostly deleted slots: clean them up in place, otherwise grow
+        size_t capacity = map->mask + 1;
+        if (map->size >= cbox_hashmap_growth(capacity) / 2)
+            capacity *= 2;
+
+        if (cbox_hashmap_rehash(map, capacity) != 0)
+            return NULL;
+        index = cbox_hashmap_find_free(map, hash);
+    }
+
+    if (map->ctrl[index] == CBOX_HASHMAP_EMPTY)
+        map->growth_left--;
+    map->size++;
+
+    cbox_hashmap_set_ctrl(map, index, (int8_t)(hash & 0x7f));
+    unsigned char *slot = cbox_hashmap_slot(map, index);
+    memcpy(slot, key, map->key_size);
+    memset(slot + map->value_offset, 0, map->stride - map->value_offset);
+    return slot + map->value_offset;
+}
+
+int cbox_hashmap_put(cbox_hashmap_t *map, const void *key, const void *value)
+{
+    void *slot = cbox_hashmap_emplace(map, key, NULL);
+    if (slot == NULL)
+        return -1;
+
+    if (value)
+        memcpy(slot, value, map->value_size);
+    return 0;
+}
+
+int cbox_hashmap_remove(cbox_hashmap_t *map, const void *key, void *value)
+{
+    ptrdiff_t index = cbox_hashmap_find(map, key, cbox_hashmap_hash_key(map, key));
+    if (index < 0)
+        return -1;
+
+    if (value)
+        memcpy(value, cbox_hashmap_slot(map, index) + map->value_offset, map->value_size);
+
+    // the slot can be empty again if no probe sequence ever went past a full group around it
+    size_t before = ((size_t)index - CBOX_HASHMAP_GROUP) & map->mask;
+    uint32_t empty_after = cbox_hashmap_match(map->ctrl + index, CBOX_HASHMAP_EMPTY);
+    uint32_t empty_before = cbox_hashmap_match(map->ctrl + before, CBOX_HASHMAP_EMPTY);
+    int never_full = empty_before && empty_after &&
+                     __builtin_ctz(empty_after) + (__builtin_clz(empty_before) - 16) < CBOX_HASHMAP_GROUP;
+
+    cbox_hashmap_set_ctrl(map, index, never_full ? CBOX_HASHMAP_EMPTY : CBOX_HASHMAP_DELETED);
+    if (never_full)
+        map->growth_left++;
+    map->size--;
+    return 0;
+}
+
+int cbox_hashmap_next(const cbox_hashmap_t *map, size_t *iter, const void **key, void **value)
+{
+    for (; *iter <= map->mask; ++*iter) {
+        if (map->ctrl[*iter] < 0)
+            continue;
+
+        unsigned char *slot = cbox_hashmap_slot(map, (*iter)++);
+        if (key) *key = slot;
+        if (value) *value = slot + map->value_offset;
+        return 1;
+    }
+
+    return 0;
+}
+
+size_t cbox_hashmap_size(const cbox_hashmap_t *map)
+{
+    return map->size;
+}
+
+int cbox_hashmap_reserve(cbox_hashmap_t *map, size_t count)
+{
+    size_t capacity = map->mask + 1;
+
+    if (count <= map->size + map->growth_left)
+        return 0;
+
+    while (cbox_hashmap_growth(capacity) < count) {
+        if (capacity << 1 == 0)
+            return -1;
+        capacity <<= 1;
+    }
+
+    return cbox_hashmap_rehash(map, capacity);
+}
+
+void cbox_hashmap_clear(cbox_hashmap_t *map)
+{
+    memset(map->ctrl, CBOX_HASHMAP_EMPTY, map->mask + 1 + CBOX_HASHMAP_GROUP);
+    map->size = 0;
+    map->growth_left = cbox_hashmap_growth(map->mask + 1);
+}
+
+static inline uint64_t cbox_hashmap_mix(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t r = (a ^ (a >> 32)) * b;
+    return r ^ (r >> 29);
+#endif
+}
+
+uint64_t cbox_hashmap_hash_bytes(const void *key, size_t key_size)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ key_size, tail = 0;
+
+    for (; key_size >= 8; key_size -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = cbox_hashmap_mix(h ^ word, 0xbf58476d1ce4e5b9ULL);
+    }
+
+    memcpy(&tail, p, key_size);
+    return cbox_hashmap_mix(h ^ tail, 0x94d049bb133111ebULL);
+}
+
+uint64_t cbox_hashmap_hash_str(const void *key, size_t key_size)
+{
+    const char *str = *(const char * const *)key;
+    (void)key_size;
+    return cbox_hashmap_hash_bytes(str, strlen(str));
+}
+
+int cbox_hashmap_equal_str(const void *a, const void *b, size_t key_size)
+{
+    (void)key_size;
+    return strcmp(*(const char * const *)a, *(const char * const *)b) == 0;
+}
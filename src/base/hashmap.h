@@ -0,0 +1,130 @@
+#ifndef _CBOX_HASHMAP_H_
+#define _CBOX_HASHMAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * open addressing hash map with the keys and values stored inline (swiss table).
+ * every slot has a control byte, empty, deleted or 7 bits of the hash,
+ * a lookup compares the control bytes of 16 slots at once (SSE2, NEON, or 8 at a time in a word) and only
+ * touches the slots whose byte matches, so most misses read no slot at all.
+ * the addresses of the values change when the map grows or rehashes.
+ * not thread-safe
+ */
+typedef struct cbox_hashmap_s cbox_hashmap_t;
+
+typedef uint64_t (*cbox_hashmap_hash_t)(const void *key, size_t key_size);
+typedef int (*cbox_hashmap_equal_t)(const void *a, const void *b, size_t key_size);  //!< 1: equal
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/*
+ *@brief create the map
+ *@param key_size - bytes of a key, e.g., sizeof(uint32_t), or sizeof(char *) with the str functions
+ *@param value_size - bytes of a value, 0 for a set
+ *@param hash - NULL means cbox_hashmap_hash_bytes()
+ *@param equal - NULL means memcmp() of key_size bytes
+ *@return the map, NULL: failed
+ */
+cbox_hashmap_t *cbox_hashmap_create(size_t key_size, size_t value_size, cbox_hashmap_hash_t hash, cbox_hashmap_equal_t equal);
+void cbox_hashmap_destroy(cbox_hashmap_t *map);
+
+/*
+ *@return the value of the key, NULL: not found
+ */
+void *cbox_hashmap_get(const cbox_hashmap_t *map, const void *key);
+
+/*
+ *@brief insert the key, or replace its value
+ *@param value - value_size bytes, NULL to leave the value of a new key zeroed
+ *@return 0: succeed, -1: no memory
+ */
+int cbox_hashmap_put(cbox_hashmap_t *map, const void *key, const void *value);
+
+/*
+ *@brief find the key, or insert it with a zeroed value, so the value is filled in place
+ *@param inserted - set to 1 if the key is new, may be NULL
+ *@return the value, NULL: no memory
+ */
+void *cbox_hashmap_emplace(cbox_hashmap_t *map, const void *key, int *inserted);
+
+/*
+ *@param value - where to copy the value of the removed key, may be NULL
+ *@return 0: removed, -1: not found
+ */
+int cbox_hashmap_remove(cbox_hashmap_t *map, const void *key, void *value);
+
+/*
+ *@brief visit the pairs, the map must not change in between, e.g.,
+ *       size_t iter = 0; const void *key; void *value;
+ *       while (cbox_hashmap_next(map, &iter, &key, &value)) { ... }
+ *@return 1: got a pair, 0: no more
+ */
+int cbox_hashmap_next(const cbox_hashmap_t *map, size_t *iter, const void **key, void **value);
+
+size_t cbox_hashmap_size(const cbox_hashmap_t *map);
+
+/*
+ *@brief make room for count keys, so inserting them does not rehash
+ *@return 0: succeed, -1: no memory
+ */
+int cbox_hashmap_reserve(cbox_hashmap_t *map, size_t count);
+void cbox_hashmap_clear(cbox_hashmap_t *map);
+
+/*
+ *@brief the default hash, a multiply-mix of 8 bytes at a time
+ */
+uint64_t cbox_hashmap_hash_bytes(const void *key, size_t key_size);
+
+/*
+ *@brief hash and equal of keys that are NUL-terminated strings, stored as const char *,
+ *       the map keeps the pointers, not the strings
+ */
+uint64_t cbox_hashmap_hash_str(const void *key, size_t key_size);
+int cbox_hashmap_equal_str(const void *a, const void *b, size_t key_size);
+
+/*
+ * maps from an int or a pointer to a pointer, e.g., fd to its handler, created by
+ * cbox_hashmap_create(sizeof(int), sizeof(void *), NULL, NULL), or sizeof(void *) as the key size.
+ * the get functions return NULL if the key is not found
+ */
+static inline int cbox_hashmap_put_int(cbox_hashmap_t *map, int key, void *value)
+{
+    return cbox_hashmap_put(map, &key, &value);
+}
+
+static inline void *cbox_hashmap_get_int(const cbox_hashmap_t *map, int key)
+{
+    void **value = (void **)cbox_hashmap_get(map, &key);
+    return value ? *value : NULL;
+}
+
+static inline int cbox_hashmap_remove_int(cbox_hashmap_t *map, int key)
+{
+    return cbox_hashmap_remove(map, &key, NULL);
+}
+
+static inline int cbox_hashmap_put_ptr(cbox_hashmap_t *map, const void *key, void *value)
+{
+    return cbox_hashmap_put(map, &key, &value);
+}
+
+static inline void *cbox_hashmap_get_ptr(const cbox_hashmap_t *map, const void *key)
+{
+    void **value = (void **)cbox_hashmap_get(map, &key);
+    return value ? *value : NULL;
+}
+
+static inline int cbox_hashmap_remove_ptr(cbox_hashmap_t *map, const void *key)
+{
+    return cbox_hashmap_remove(map, &key, NULL);
+}
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif //_CBOX_HASHMAP_H_
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include "hashmap.h"
+
+TEST(Hashmap, put_get_remove)
+{
+    cbox_hashmap_t *map = cbox_hashmap_create(sizeof(uint32_t), sizeof(uint64_t), NULL, NULL);
+    ASSERT_NE(map, nullptr);
+    std::unordered_map<uint32_t, uint64_t> expect;
+
+    for (uint32_t i = 0; i < 100000; ++i) {
+        uint32_t key = i * 2654435761u;
+        uint64_t value = (uint64_t)i << 20;
+        EXPECT_EQ(cbox_hashmap_put(map, &key, &value), 0);
+        expect[key] = value;
+    }
+    EXPECT_EQ(cbox_hashmap_size(map), expect.size());
+
+    // remove and insert again, so the deleted slots are reused and cleaned up
+    for (int round = 0; round < 3; ++round) {
+        for (uint32_t i = round; i < 100000; i += 2) {
+            uint32_t key = i * 2654435761u;
+            uint64_t value = 0;
+            EXPECT_EQ(cbox_hashmap_remove(map, &key, &value), 0);
+            EXPECT_EQ(value, expect[key]);
+            expect.erase(key);
+        }
+        for (uint32_t i = round; i < 100000; i += 2) {
+            uint32_t key = i * 2654435761u;
+            uint64_t value = i + round;
+            EXPECT_EQ(cbox_hashmap_put(map, &key, &value), 0);
+            expect[key] = value;
+        }
+    }
+
+    ASSERT_EQ(cbox_hashmap_size(map), expect.size());
+    for (auto &pair : expect) {
+        uint64_t *value = (uint64_t *)cbox_hashmap_get(map, &pair.first);
+        ASSERT_NE(value, nullptr);
+        EXPECT_EQ(*value, pair.second);
+    }
+
+    uint32_t missing = 1;
+    EXPECT_EQ(cbox_hashmap_get(map, &missing), nullptr);
+    EXPECT_EQ(cbox_hashmap_remove(map, &missing, NULL), -1);
+
+    size_t iter = 0, count = 0;
+    const void *key = NULL;
+    void *value = NULL;
+    while (cbox_hashmap_next(map, &iter, &key, &value)) {
+        auto it = expect.find(*(const uint32_t *)key);
+        ASSERT_NE(it, expect.end());
+        EXPECT_EQ(*(uint64_t *)value, it->second);
+        ++count;
+    }
+    EXPECT_EQ(count, expect.size());
+
+    cbox_hashmap_clear(map);
+    EXPECT_EQ(cbox_hashmap_size(map), 0u);
+    EXPECT_EQ(cbox_hashmap_get(map, &expect.begin()->first), nullptr);
+    cbox_hashmap_destroy(map);
+}
+
+TEST(Hashmap, emplace_str)
+{
+    cbox_hashmap_t *map = cbox_hashmap_create(sizeof(const char *), sizeof(int), cbox_hashmap_hash_str, cbox_hashmap_equal_str);
+    std::vector<std::string> words = { "alpha", "beta", "gamma", "beta", "alpha", "beta" };
+    int inserted = 0;
+
+    for (auto &word : words) {
+        const char *key = word.c_str();
+        int *count = (int *)cbox_hashmap_emplace(map, &key, &inserted);
+        ASSERT_NE(count, nullptr);
+        ++*count;
+    }
+
+    EXPECT_EQ(cbox_hashmap_size(map), 3u);
+    const char *beta = "beta";
+    EXPECT_EQ(*(int *)cbox_hashmap_get(map, &beta), 3);
+    cbox_hashmap_emplace(map, &beta, &inserted);
+    EXPECT_EQ(inserted, 0);
+    cbox_hashmap_destroy(map);
+}
+
+TEST(Hashmap, int_ptr)
+{
+    cbox_hashmap_t *fds = cbox_hashmap_create(sizeof(int), sizeof(void *), NULL, NULL);
+    cbox_hashmap_t *ptrs = cbox_hashmap_create(sizeof(void *), sizeof(void *), NULL, NULL);
+    static int handlers[64];
+
+    for (int fd = 0; fd < 64; ++fd) {
+        EXPECT_EQ(cbox_hashmap_put_int(fds, fd, &handlers[fd]), 0);
+        EXPECT_EQ(cbox_hashmap_put_ptr(ptrs, &handlers[fd], &handlers[63 - fd]), 0);
+    }
+
+    EXPECT_EQ(cbox_hashmap_get_int(fds, 5), &handlers[5]);
+    EXPECT_EQ(cbox_hashmap_get_int(fds, 64), nullptr);
+    EXPECT_EQ(cbox_hashmap_get_ptr(ptrs, &handlers[0]), &handlers[63]);
+    EXPECT_EQ(cbox_hashmap_get_ptr(ptrs, nullptr), nullptr);
+
+    EXPECT_EQ(cbox_hashmap_remove_int(fds, 5), 0);
+    EXPECT_EQ(cbox_hashmap_remove_int(fds, 5), -1);
+    EXPECT_EQ(cbox_hashmap_get_int(fds, 5), nullptr);
+    EXPECT_EQ(cbox_hashmap_remove_ptr(ptrs, &handlers[0]), 0);
+    EXPECT_EQ(cbox_hashmap_size(ptrs), 63u);
+
+    cbox_hashmap_destroy(ptrs);
+    cbox_hashmap_destroy(fds);
+}
+
+TEST(Hashmap, reserve_set)
+{
+    cbox_hashmap_t *set = cbox_hashmap_create(sizeof(uint64_t), 0, NULL, NULL);
+
+    EXPECT_EQ(cbox_hashmap_reserve(set, 1000), 0);
+    for (uint64_t i = 0; i < 1000; ++i) cbox_hashmap_put(set, &i, NULL);
+    EXPECT_EQ(cbox_hashmap_size(set), 1000u);
+
+    uint64_t key = 999;
+    EXPECT_NE(cbox_hashmap_get(set, &key), nullptr);
+    key = 1000;
+    EXPECT_EQ(cbox_hashmap_get(set, &key), nullptr);
+    cbox_hashmap_destroy(set);
+}
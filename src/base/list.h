@@ -163,12 +163,12 @@ static inline void list_splice_init(struct list_head *list,
 }
 
 // extend by cpp_main
-static inline void list_replace(struct list_head *old, struct list_head *new)
+static inline void list_replace(struct list_head *old, struct list_head *newnode)
 {
-    new->next = old->next;
-    new->next->prev = new;
-    new->prev = old->prev;
-    new->prev->next = new;
+    newnode->next = old->next;
+    newnode->next->prev = newnode;
+    newnode->prev = old->prev;
+    newnode->prev->next = newnode;
 }
 
 static inline void list_swap(struct list_head *list1, struct list_head *list2)
@@ -1,16 +1,21 @@
+
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <syslog.h>
 #include <syscall.h>
+#include <errno.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include "log.h"
 #include "macros.h"
+#include "utils.h"
 
 #define DEFAULT_CBOX_LOG_NAME "cbox_log"
 
@@ -21,8 +26,109 @@
 #define COLOR_WHITE(s)     "\033[47m\033[30m" s "\033[0m"
 #define COLOR_PURPLE(s)    "\033[45m\033[37m" s "\033[0m"
 
+#define CBOX_LOG_INLINE_SIZE (448)      //!< body size kept in the async slot, longer ones are allocated
+#define CBOX_LOG_HEADER_SIZE (160)      //!< enough for time, category, name and tid
+#define CBOX_LOG_BATCH (64)             //!< records written by one writev
+#define CBOX_LOG_DEFAULT_CAPACITY (8192)
+
+#define CBOX_LOG_BODY_SIZE (512)       //!< initial size of the thread buffer
+#define CBOX_LOG_MODULE_MAX (16)
+
 static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
 
+static __thread char *t_body = NULL;    //!< body of the message being logged by the thread
+static __thread size_t t_body_size = 0;
+static __thread int t_result = 0;       //!< set by cbox_log_set_result() for the next message
+static __thread long t_tid = 0;
+static pthread_key_t g_body_key;
+static pthread_once_t g_body_once = PTHREAD_ONCE_INIT;
+
+typedef enum {
+    CBOX_LOG_STYLE_RAW = 0,     //!< body only
+    CBOX_LOG_STYLE_BASIC,       //!< category, name and tid
+    CBOX_LOG_STYLE_FULL         //!< time, category, name and tid
+} cbox_log_style_t;
+
+/*
+ * a formatted message on the way to the sinks
+ */
+typedef struct
+{
+    int level;
+    int style;
+    struct timeval tv;
+    long tid;
+    const char *body;   //!< prefix, message, suffix and result
+    size_t len;
+} cbox_log_entry_t;
+
+typedef struct
+{
+    size_t seq;         //!< atomic, see cbox_log_async_push()
+    int level;
+    int style;
+    struct timeval tv;
+    long tid;
+    size_t len;
+    char *heap;         //!< body longer than the inline buffer
+    char body[CBOX_LOG_INLINE_SIZE];
+} cbox_log_slot_t;
+
+/*
+ * bounded MPSC queue with a sequence number per slot, the producers claim slots with a CAS
+ * on head, only the writer thread moves tail
+ */
+typedef struct
+{
+    cbox_log_slot_t *slots;
+    size_t mask;
+    size_t head __attribute__((aligned(64)));   //!< atomic, next slot to claim
+    size_t tail __attribute__((aligned(64)));   //!< owned by the writer thread
+    size_t written;                             //!< atomic, records finished, for cbox_log_flush()
+    uint64_t dropped;                           //!< atomic, total dropped
+    uint64_t unreported;                        //!< atomic, dropped but not reported yet
+    int overflow;
+    int stop;
+    int sleeping;                               //!< atomic, writer is waiting for records
+    int blocked;                                //!< atomic, producers waiting for room or flush
+    int users;                                  //!< atomic, producers outside g_lock
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    char *buffer;                               //!< lines of a batch
+} cbox_log_async_t;
+
+typedef struct cbox_log_binary cbox_log_binary_t;
+
+extern cbox_log_binary_t *cbox_log_binary_open(const char *path, const char *name);
+extern void cbox_log_binary_close(cbox_log_binary_t *binary);
+extern int cbox_log_binary_flush(cbox_log_binary_t *binary);
+extern int cbox_log_binary_write(cbox_log_binary_t *binary, int level, int style, const struct timeval *tv, long tid,
+                                 int result, const char *prefix, const char *suffix, const char *fmt, va_list ap);
+extern void cbox_log_binary_cleanup(void);
+
+typedef struct cbox_log_file cbox_log_file_t;
+
+extern cbox_log_file_t *cbox_log_file_open(const char *path, const cbox_log_file_option_t *option);
+extern void cbox_log_file_ref(cbox_log_file_t *file);
+extern void cbox_log_file_unref(cbox_log_file_t *file);
+extern void cbox_log_file_write(cbox_log_file_t *file, int level, const struct iovec *iov, int count);
+extern void cbox_log_file_flush(cbox_log_file_t *file);
+
+typedef struct cbox_log_recorder cbox_log_recorder_t;
+
+extern cbox_log_recorder_t *cbox_log_recorder_open(const char *path, size_t size, const char *name);
+extern void cbox_log_recorder_close(cbox_log_recorder_t *recorder);
+extern void cbox_log_recorder_sync(cbox_log_recorder_t *recorder);
+extern void cbox_log_recorder_write(cbox_log_recorder_t *recorder, int level, int style, const struct timeval *tv,
+                                    long tid, const char *body, size_t len);
+
+typedef struct
+{
+    char name[32];      //!< LOG_MODULE_ID
+    int level;
+} cbox_log_module_t;
+
 struct cbox_log_s
 {
     cbox_log_function_t cb;
@@ -30,8 +136,6 @@ struct cbox_log_s
 
     int level;
 
-    int result;
-
     int syslog;
 
     char *name;
@@ -42,12 +146,33 @@ struct cbox_log_s
     int color;  //!< default is 1
 
     void *user;
+
+    cbox_log_async_t *async;
+    cbox_log_binary_t *binary;
+    cbox_log_file_t *file;
+    cbox_log_recorder_t *recorder;  //!< atomic, see cbox_log_record()
+    int record_level;               //!< atomic, -1: no recorder
+    int recorder_users;             //!< atomic
+    int coarse;         //!< timestamps from CLOCK_REALTIME_COARSE
+    int kv_format;      //!< cbox_log_kv_format_t
+    uint64_t dropped;   //!< dropped by the stopped writers
+
+    cbox_log_module_t modules[CBOX_LOG_MODULE_MAX];
+    int module_count;
 };
 
 cbox_log_t *cbox_log_instance = NULL;
+unsigned int cbox_log_generation = 1;   //!< bumped under g_lock when a level changes
+
+static inline void cbox_log_levels_changed(void)
+{
+    __atomic_add_fetch(&cbox_log_generation, 1, __ATOMIC_RELEASE);
+}
 
-static int cbox_vasprintf(char **strp, const char* fmt, va_list args);
-static int cbox_asprintf(char **strp, const char *fmt, ...);
+static void cbox_log_emit(cbox_log_t *log, const cbox_log_entry_t *entry);
+static void cbox_log_output(cbox_log_t *log, cbox_log_entry_t *entry);
+static void cbox_log_async_stop(cbox_log_t *log);
+static void cbox_log_file_sync(cbox_log_t *log);
 
 cbox_log_t *cbox_log_init(cbox_level_t level, const char *name)
 {
@@ -62,6 +187,8 @@ cbox_log_t *cbox_log_init(cbox_level_t level, const char *name)
         cbox_log_instance->prefix[0] = cbox_log_instance->suffix[0] = '\0';
         cbox_log_instance->color = 1;
         cbox_log_instance->copy = 0;
+        cbox_log_instance->record_level = -1;
+        cbox_log_levels_changed();
     }
 
     pthread_mutex_unlock(&g_lock);
@@ -70,17 +197,26 @@ cbox_log_t *cbox_log_init(cbox_level_t level, const char *name)
 
 void cbox_log_destroy()
 {
+    if (cbox_log_instance != NULL)
+        cbox_log_async_stop(cbox_log_instance);
+
     pthread_mutex_lock(&g_lock);
 
     if (cbox_log_instance != NULL) {
+        CBOX_SAFETY_FUNC(cbox_log_binary_close, cbox_log_instance->binary);
+        CBOX_SAFETY_FUNC(cbox_log_file_unref, cbox_log_instance->file);
+        CBOX_SAFETY_FUNC(cbox_log_recorder_close, cbox_log_instance->recorder);
         CBOX_SAFETY_FREE(cbox_log_instance->name);
         if (cbox_log_instance->syslog)
             closelog();
 
         CBOX_SAFETY_FREE(cbox_log_instance);
+        cbox_log_levels_changed();
     }
 
     pthread_mutex_unlock(&g_lock);
+
+    cbox_log_binary_cleanup();
 }
 
 void cbox_log_redirect(cbox_log_t *log, cbox_log_function_t cb, void *obj, int copy)
@@ -104,6 +240,95 @@ void cbox_log_set_level(cbox_log_t *log, cbox_level_t level)
 {
     pthread_mutex_lock(&g_lock);
     log->level = level;
+    cbox_log_levels_changed();
+    pthread_mutex_unlock(&g_lock);
+}
+
+int cbox_log_set_module_level(cbox_log_t *log, const char *module, int level)
+{
+    int i = 0, ret = 0;
+
+    if (module == NULL || strlen(module) >= sizeof(log->modules[0].name))
+        return -1;
+
+    pthread_mutex_lock(&g_lock);
+
+    for (i = 0; i < log->module_count; ++i)
+        if (strcmp(log->modules[i].name, module) == 0)
+            break;
+
+    if (level < 0) {
+        if (i < log->module_count)
+            log->modules[i] = log->modules[--log->module_count];
+    } else if (i < log->module_count) {
+        log->modules[i].level = level;
+    } else if (log->module_count < CBOX_LOG_MODULE_MAX) {
+        strcpy(log->modules[i].name, module);
+        log->modules[i].level = level;
+        log->module_count++;
+    } else {
+        ret = -1;
+    }
+
+    cbox_log_levels_changed();
+    pthread_mutex_unlock(&g_lock);
+    return ret;
+}
+
+#define CBOX_LOG_LIMIT_COUNT_BITS (20)
+#define CBOX_LOG_LIMIT_COUNT_MASK ((1ULL << CBOX_LOG_LIMIT_COUNT_BITS) - 1)
+
+int cbox_log_ratelimit(cbox_log_limit_t *limit, uint32_t interval_ms, uint32_t burst, uint32_t *suppressed)
+{
+    struct timespec ts;
+    uint64_t old = __atomic_load_n(&limit->state, __ATOMIC_RELAXED), state = 0;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    if (burst > CBOX_LOG_LIMIT_COUNT_MASK)
+        burst = CBOX_LOG_LIMIT_COUNT_MASK;
+
+    do {
+        uint64_t start = old >> CBOX_LOG_LIMIT_COUNT_BITS, count = old & CBOX_LOG_LIMIT_COUNT_MASK;
+
+        if (now - start >= interval_ms) {
+            state = now << CBOX_LOG_LIMIT_COUNT_BITS | 1;
+        } else if (count < burst) {
+            state = old + 1;
+        } else {
+            __atomic_add_fetch(&limit->suppressed, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&limit->state, &old, state, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // the first message of a window reports the ones dropped in the previous windows
+    *suppressed = (state & CBOX_LOG_LIMIT_COUNT_MASK) == 1 ? __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED) : 0;
+    return 1;
+}
+
+void cbox_log_site_update(cbox_log_t *log, cbox_log_site_t *site)
+{
+    int level = -1, enabled = -1, i = 0;
+
+    pthread_mutex_lock(&g_lock);
+
+    unsigned int generation = __atomic_load_n(&cbox_log_generation, __ATOMIC_RELAXED);
+    if (log) {
+        level = log->level;
+        for (i = 0; site->module && i < log->module_count; ++i) {
+            if (strcmp(log->modules[i].name, site->module) == 0) {
+                level = log->modules[i].level;
+                break;
+            }
+        }
+        enabled = level > log->record_level ? level : log->record_level;
+    }
+
+    __atomic_store_n(&site->level, level, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->enabled, enabled, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->generation, generation, __ATOMIC_RELEASE);
+
     pthread_mutex_unlock(&g_lock);
 }
 
@@ -131,7 +356,7 @@ void cbox_log_set_syslog(cbox_log_t *log, int syslog)
     log->syslog = syslog;
 
     if (log->syslog)
-        openlog(log->name ? log->name : DEFAULT_CBOX_LOG_NAME, LOG_CONS | LOG_PID | LOG_NDELAY, LOG_DAEMON);    
+        openlog(log->name ? log->name : DEFAULT_CBOX_LOG_NAME, LOG_CONS | LOG_PID | LOG_NDELAY, LOG_DAEMON);
     else
         closelog();
 
@@ -140,9 +365,8 @@ void cbox_log_set_syslog(cbox_log_t *log, int syslog)
 
 void cbox_log_set_result(cbox_log_t *log, int result)
 {
-    pthread_mutex_lock(&g_lock);
-    log->result = result;
-    pthread_mutex_unlock(&g_lock);
+    (void) log;
+    t_result = result;
 }
 
 void cbox_log_set_format(cbox_log_t *log, int prefix, const char *fmt, ...)
@@ -150,197 +374,1208 @@ void cbox_log_set_format(cbox_log_t *log, int prefix, const char *fmt, ...)
     pthread_mutex_lock(&g_lock);
     va_list ap;
     va_start(ap, fmt);
-    vsprintf(prefix ? log->prefix : log->suffix, fmt, ap);
+    vsnprintf(prefix ? log->prefix : log->suffix, sizeof(log->prefix), fmt, ap);
     va_end(ap);
     pthread_mutex_unlock(&g_lock);
 }
 
-void cbox_log_raw(cbox_log_t *log, int level, const char *fmt, ...)
+static const char *cbox_log_site_filename(cbox_log_site_t *site)
 {
-    char *msg = NULL;
-    if (level < log->level)
+    const char *filename = __atomic_load_n(&site->filename, __ATOMIC_RELAXED);
+    if (filename == NULL) {
+        filename = strrchr(site->file, '/') ? strrchr(site->file, '/') + 1 : site->file;
+        __atomic_store_n(&site->filename, filename, __ATOMIC_RELAXED);
+    }
+
+    return filename;
+}
+
+/*
+ * the child of fork() has a new tid
+ */
+static void cbox_log_tid_reset(void)
+{
+    t_tid = 0;
+}
+
+static void cbox_log_tid_atfork(void)
+{
+    pthread_atfork(NULL, NULL, cbox_log_tid_reset);
+}
+
+static inline long cbox_log_tid(void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    if (t_tid == 0) {
+        pthread_once(&once, cbox_log_tid_atfork);
+        t_tid = syscall(SYS_gettid);
+    }
+
+    return t_tid;
+}
+
+static inline void cbox_log_now(cbox_log_t *log, struct timeval *tv)
+{
+    struct timespec ts;
+
+    if (__atomic_load_n(&log->coarse, __ATOMIC_RELAXED) && clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0) {
+        tv->tv_sec = ts.tv_sec;
+        tv->tv_usec = ts.tv_nsec / 1000;
         return;
+    }
 
-    pthread_mutex_lock(&g_lock);
+    gettimeofday(tv, NULL);
+}
+
+static void cbox_log_body_key_create(void)
+{
+    pthread_key_create(&g_body_key, free);
+}
 
+static int cbox_log_body_vprintf(int n, const char *fmt, va_list ap)
+{
+    size_t offset = (size_t)n < t_body_size ? (size_t)n : t_body_size;
+    int len = vsnprintf(t_body + offset, t_body_size - offset, fmt, ap);
+    return len < 0 ? n : n + len;
+}
+
+static int cbox_log_body_printf(int n, const char *fmt, ...)
+{
     va_list ap;
     va_start(ap, fmt);
-    cbox_vasprintf(&msg, fmt, ap);
+    n = cbox_log_body_vprintf(n, fmt, ap);
     va_end(ap);
+    return n;
+}
+
+/*
+ * formats the prefix, message, suffix and result into the thread buffer,
+ * the prefix and suffix come from the site if there is one
+ *@return length of the body, -1: failed
+ */
+static int cbox_log_format_body(cbox_log_site_t *site, const char *prefix, const char *suffix,
+                                int result, const char *fmt, va_list ap)
+{
+    for (;;) {
+        int n = 0;
+        va_list args;
 
-    if (log->cb) {
-        (*log->cb)(level, msg, log->user);
+        if (t_body == NULL) {
+            if ((t_body = (char *)malloc(CBOX_LOG_BODY_SIZE)) == NULL)
+                return -1;
+            t_body_size = CBOX_LOG_BODY_SIZE;
 
-        if (!log->copy) goto CLEANUP;
-    }
+            // frees the buffer when the thread exits
+            pthread_once(&g_body_once, cbox_log_body_key_create);
+            pthread_setspecific(g_body_key, t_body);
+        }
 
-    if (!log->syslog) fprintf(stdout, "%s\n", msg);
-    else syslog(LOG_USER | LOG_INFO, "%s", msg);
+        if (site) n = cbox_log_body_printf(n, "%s: ", site->func);
+        else if (prefix) n = cbox_log_body_printf(n, "%s", prefix);
 
-CLEANUP:
-    CBOX_SAFETY_FREE(msg);
-    pthread_mutex_unlock(&g_lock);
+        va_copy(args, ap);
+        n = cbox_log_body_vprintf(n, fmt, args);
+        va_end(args);
+
+        if (site) n = cbox_log_body_printf(n, " (%s:%d)", cbox_log_site_filename(site), site->line);
+        else if (suffix) n = cbox_log_body_printf(n, "%s", suffix);
+
+        if (result != 0) n = cbox_log_body_printf(n, " [errno:%d]", result);
+
+        if ((size_t)n < t_body_size)
+            return n;
+
+        size_t size = t_body_size;
+        while (size <= (size_t)n) size *= 2;
+
+        char *body = (char *)realloc(t_body, size);
+        if (body == NULL)
+            return -1;
+
+        t_body = body;
+        t_body_size = size;
+        pthread_setspecific(g_body_key, t_body);
+    }
 }
 
-void cbox_log_full(cbox_log_t *log, int level, const char *fmt, ...)
+static inline int cbox_log_recorded(cbox_log_t *log, int level)
+{
+    return level <= __atomic_load_n(&log->record_level, __ATOMIC_RELAXED);
+}
+
+/*
+ * writes the entry to the flight recorder without g_lock
+ */
+static void cbox_log_record(cbox_log_t *log, const cbox_log_entry_t *entry)
 {
-    if (level > log->level) return;
+    __atomic_add_fetch(&log->recorder_users, 1, __ATOMIC_SEQ_CST);
 
-    pthread_mutex_lock(&g_lock);
+    cbox_log_recorder_t *recorder = __atomic_load_n(&log->recorder, __ATOMIC_SEQ_CST);
+    if (recorder)
+        cbox_log_recorder_write(recorder, entry->level, entry->style, &entry->tv, entry->tid, entry->body, entry->len);
 
-    char *msg = NULL;
+    __atomic_sub_fetch(&log->recorder_users, 1, __ATOMIC_RELEASE);
+}
+
+void cbox_log_raw(cbox_log_t *log, int level, const char *fmt, ...)
+{
+    int to_sinks = level >= log->level;
+    if (!to_sinks && !cbox_log_recorded(log, level))
+        return;
 
     va_list ap;
     va_start(ap, fmt);
-    cbox_vasprintf(&msg, fmt, ap);
+    int len = cbox_log_format_body(NULL, NULL, NULL, 0, fmt, ap);
     va_end(ap);
 
-    char result[32] = { 0 };
-    if (log->result != 0) sprintf(result, " [errno:%d]", log->result);
+    if (len < 0)
+        return;
+
+    cbox_log_entry_t entry = { level, CBOX_LOG_STYLE_RAW, { 0, 0 }, 0, t_body, (size_t)len };
 
-    struct timeval tv;
-    struct tm tm;
-    gettimeofday(&tv, NULL);
-    localtime_r(&tv.tv_sec, &tm);
-    char fmt_str[32];
-    strftime(fmt_str, sizeof(fmt_str), "%Y-%m-%d %H:%M:%S", &tm);
+    if (cbox_log_recorded(log, level))
+        cbox_log_record(log, &entry);
+
+    if (!to_sinks)
+        return;
+
+    pthread_mutex_lock(&g_lock);
+    cbox_log_output(log, &entry);
+}
+
+/*
+ *@return 0: written to the binary file, -1: not in binary mode or failed
+ */
+static int cbox_log_styled_binary(cbox_log_t *log, int level, int style, cbox_log_site_t *site,
+                                  const char *prefix, const char *suffix, int result, const char *fmt, va_list ap)
+{
+    char site_prefix[128], site_suffix[128];
+    struct timeval tv = { 0, 0 };
+    int ret = -1;
 
-    if (log->cb) {
-        char *log_str;
-        cbox_asprintf(&log_str, "[%s:%03ld] %s %s [%ld]: %s%s%s%s", fmt_str, tv.tv_usec / 1000, cbox_log_get_category(log, level, 0), log->name ? log->name : DEFAULT_CBOX_LOG_NAME, syscall(SYS_gettid), log->prefix, msg, log->suffix, result);
-        (*log->cb)(level, log_str, log->user);
-        CBOX_SAFETY_FREE(log_str);
+    if (__atomic_load_n(&log->binary, __ATOMIC_RELAXED) == NULL)
+        return -1;
 
-        if (!log->copy) goto CLEANUP;
+    if (style == CBOX_LOG_STYLE_FULL)
+        cbox_log_now(log, &tv);
+
+    if (site) {
+        snprintf(site_prefix, sizeof(site_prefix), "%s: ", site->func);
+        snprintf(site_suffix, sizeof(site_suffix), " (%s:%d)", cbox_log_site_filename(site), site->line);
+        prefix = site_prefix;
+        suffix = site_suffix;
     }
 
-    if (!log->syslog)
-        fprintf(stdout, "[%s:%03ld] %s %s [%ld]: %s%s%s%s\n", fmt_str, tv.tv_usec / 1000, cbox_log_get_category(log, level, log->color), log->name ? log->name : DEFAULT_CBOX_LOG_NAME, syscall(SYS_gettid), log->prefix, msg, log->suffix, result);
-    else
-        syslog(LOG_USER | LOG_INFO, "%s%s%s%s", log->prefix, msg, log->suffix, result);
+    pthread_mutex_lock(&g_lock);
+    if (log->binary)
+        ret = cbox_log_binary_write(log->binary, level, style, &tv, cbox_log_tid(), result,
+                                    prefix ? prefix : "", suffix ? suffix : "", fmt, ap);
+    pthread_mutex_unlock(&g_lock);
+
+    return ret;
+}
+
+/*
+ * g_lock is only taken to hand the formatted body to the sinks
+ */
+static void cbox_log_styled(cbox_log_t *log, int level, int style, cbox_log_site_t *site,
+                            const char *prefix, const char *suffix, const char *fmt, va_list ap)
+{
+    int result = t_result;
+    int threshold = site ? __atomic_load_n(&site->level, __ATOMIC_RELAXED) : log->level;
+    int to_sinks = level <= threshold, recorded = cbox_log_recorded(log, level);
+    t_result = 0;
+
+    if (to_sinks && cbox_log_styled_binary(log, level, style, site, prefix, suffix, result, fmt, ap) == 0) {
+        if (!recorded)
+            return;
+        to_sinks = 0;
+    }
+
+    int len = cbox_log_format_body(site, prefix, suffix, result, fmt, ap);
+    if (len < 0)
+        return;
+
+    cbox_log_entry_t entry = { level, style, { 0, 0 }, cbox_log_tid(), t_body, (size_t)len };
+    if (style == CBOX_LOG_STYLE_FULL || recorded)
+        cbox_log_now(log, &entry.tv);
 
-CLEANUP:
-    CBOX_SAFETY_FREE(msg);
+    if (recorded)
+        cbox_log_record(log, &entry);
 
-    log->result = 0;
+    if (!to_sinks)
+        return;
+
+    pthread_mutex_lock(&g_lock);
+    cbox_log_output(log, &entry);
+}
+
+void cbox_log_full(cbox_log_t *log, int level, const char *fmt, ...)
+{
+    char prefix[sizeof(log->prefix)], suffix[sizeof(log->suffix)];
+
+    if (level > log->level && !cbox_log_recorded(log, level)) return;
+
+    pthread_mutex_lock(&g_lock);
+    memcpy(prefix, log->prefix, sizeof(prefix));
+    memcpy(suffix, log->suffix, sizeof(suffix));
     pthread_mutex_unlock(&g_lock);
+
+    va_list ap;
+    va_start(ap, fmt);
+    cbox_log_styled(log, level, CBOX_LOG_STYLE_FULL, NULL, prefix, suffix, fmt, ap);
+    va_end(ap);
+}
+
+void cbox_log_full_at(cbox_log_t *log, int level, cbox_log_site_t *site, const char *fmt, ...)
+{
+    if (site ? !cbox_log_enabled(log, site, level) : level > log->level && !cbox_log_recorded(log, level)) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    cbox_log_styled(log, level, CBOX_LOG_STYLE_FULL, site, NULL, NULL, fmt, ap);
+    va_end(ap);
 }
 
 void cbox_log_basic(cbox_log_t *log, int level, const char *fmt, ...)
 {
-    if (level > log->level) return;
-    char *msg = NULL;
+    char prefix[sizeof(log->prefix)], suffix[sizeof(log->suffix)];
+
+    if (level > log->level && !cbox_log_recorded(log, level)) return;
 
     pthread_mutex_lock(&g_lock);
+    memcpy(prefix, log->prefix, sizeof(prefix));
+    memcpy(suffix, log->suffix, sizeof(suffix));
+    pthread_mutex_unlock(&g_lock);
+
     va_list ap;
     va_start(ap, fmt);
-    cbox_vasprintf(&msg, fmt, ap);
+    cbox_log_styled(log, level, CBOX_LOG_STYLE_BASIC, NULL, prefix, suffix, fmt, ap);
     va_end(ap);
+}
+
+void cbox_log_dump(cbox_log_t *log, const void *buf, uint16_t len)
+{
+    if (CBOX_LOG_LEVEL_DEBUG > log->level && !cbox_log_recorded(log, CBOX_LOG_LEVEL_DEBUG)) return;
+
+    pthread_mutex_lock(&g_lock);
+    char prefix[64];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "%s [%ld]", log->name ? log->name : DEFAULT_CBOX_LOG_NAME, cbox_log_tid());
+    pthread_mutex_unlock(&g_lock);
+
+    const size_t length = 16;
+    const size_t padding = 18 + CBOX_MIN((size_t)prefix_len, sizeof(prefix) - 1) + 1;
+
+    // padding, 3 characters per byte, 2 tabs and the printable characters
+    char line[18 + sizeof(prefix) + 16 * 3 + 2 + 16];
+    const uint8_t *bin = (const uint8_t *)buf;
+    size_t i = 0, index = 0;
 
-    char result[32] = { 0 };
-    if (log->result != 0) sprintf(result, " [errno:%d]", log->result);
+    memset(line, 0x20, padding);
 
-    if (log->cb) {
-        char *log_str;
-        cbox_asprintf(&log_str, "%s %s [%ld] %s%s%s%s", cbox_log_get_category(log, level, 0), log->name ? log->name : DEFAULT_CBOX_LOG_NAME, syscall(SYS_gettid), log->prefix, msg, log->suffix, result);
-        (*log->cb)(level, log_str, log->user);
-        CBOX_SAFETY_FREE(log_str);
+    while (index < len) {
+        size_t line_len = len - index > length ? length : len - index;
+        char *p = line + padding;
+
+        p += cbox_utils_hex_encode(p, length * 3, bin + index, line_len, ' ', 0);
+        memset(p, 0x20, (length - line_len) * 3);
+        p += (length - line_len) * 3;
+        *p++ = '\t';
+        *p++ = '\t';
+        for (i = 0; i < line_len; i++, p++)
+            *p = (bin[index + i] < 0x20 || bin[index + i] > 0x7E) ? 0x2E : (char)bin[index + i];
+        index += line_len;
 
-        if (!log->copy) goto CLEANUP;
+        cbox_log_raw(log, CBOX_LOG_LEVEL_DEBUG, "%.*s", (int)(p - line), line);
     }
+}
 
-    if (!log->syslog)
-        fprintf(stdout, "%s %s [%ld] %s%s%s%s\n", cbox_log_get_category(log, level, log->color), log->name ? log->name : DEFAULT_CBOX_LOG_NAME, syscall(SYS_gettid), log->prefix, msg, log->suffix, result);
-    else
-        syslog(LOG_USER | LOG_INFO, "%s%s%s%s", log->prefix, msg, log->suffix, result);
+void cbox_log_dump_with_tag(cbox_log_t *log, const char *tag, const void *buf, uint16_t len)
+{
+    cbox_log_full(log, CBOX_LOG_LEVEL_DEBUG, "%s: %d(bytes)", tag, len);
+    cbox_log_dump(log, buf, len);
+}
+
+/*
+ * sink settings copied under g_lock, so the writer thread does not hold it while writing
+ */
+typedef struct
+{
+    cbox_log_function_t cb;
+    void *user;
+    int copy;
+    int syslog;
+    int color;
+    cbox_log_file_t *file;
+    char name[64];
+} cbox_log_sinks_t;
+
+static void cbox_log_get_sinks(cbox_log_t *log, cbox_log_sinks_t *sinks)
+{
+    sinks->cb = log->cb;
+    sinks->user = log->user;
+    sinks->copy = log->copy;
+    sinks->syslog = log->syslog;
+    sinks->color = log->color;
+    sinks->file = log->file;
+    snprintf(sinks->name, sizeof(sinks->name), "%s", log->name ? log->name : DEFAULT_CBOX_LOG_NAME);
+}
 
-CLEANUP:
-    if (msg) free(msg);
+static inline char *cbox_log_put(char *p, char *end, const char *str, size_t len)
+{
+    if (len > (size_t)(end - p)) len = end - p;
+    memcpy(p, str, len);
+    return p + len;
+}
 
-    log->result = 0;
-    pthread_mutex_unlock(&g_lock);
+static inline char *cbox_log_put_long(char *p, char *end, long value)
+{
+    char digits[24];
+    int n = 0;
+    unsigned long u = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    if (value < 0) digits[n++] = '-';
+    while (n > 0 && p < end) *p++ = digits[--n];
+    return p;
+}
+
+/*
+ * "YYYY-mm-dd HH:MM:SS" of the thread's last second, localtime_r() takes the TZ lock
+ */
+static const char *cbox_log_time_str(time_t sec)
+{
+    static __thread time_t cached_sec = -1;
+    static __thread char cached_str[32];
+
+    if (sec != cached_sec) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(cached_str, sizeof(cached_str), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_sec = sec;
+    }
+
+    return cached_str;
 }
 
-static void bin_to_hex(char *hex, const uint8_t *bin, size_t bin_len, int space, int upper)
+static size_t cbox_log_format_header(const cbox_log_sinks_t *sinks, const cbox_log_entry_t *entry, int color, char *buf, size_t size)
 {
-    size_t i = 0, j = 0;
-    for (i = 0, j = 0; i < bin_len; i++) {
-        sprintf(hex + i * 2 + j, upper ? "%02X" : "%02x", bin[i]);
+    char *p = buf, *end = buf + size - 1;
+    const char *category = cbox_log_get_category(NULL, entry->level, color);
+
+    if (entry->style == CBOX_LOG_STYLE_FULL) {
+        const char *time_str = cbox_log_time_str(entry->tv.tv_sec);
+        long ms = (long)entry->tv.tv_usec / 1000;
+        char ms_str[] = { ':', '0' + ms / 100, '0' + ms / 10 % 10, '0' + ms % 10, ']', ' ' };
 
-        if (!space)  continue;
+        p = cbox_log_put(p, end, "[", 1);
+        p = cbox_log_put(p, end, time_str, strlen(time_str));
+        p = cbox_log_put(p, end, ms_str, sizeof(ms_str));
+    }
 
-        strcat((char *)hex, " ");
-        j++;
+    if (entry->style != CBOX_LOG_STYLE_RAW) {
+        p = cbox_log_put(p, end, category, strlen(category));
+        p = cbox_log_put(p, end, " ", 1);
+        p = cbox_log_put(p, end, sinks->name, strlen(sinks->name));
+        p = cbox_log_put(p, end, " [", 2);
+        p = cbox_log_put_long(p, end, entry->tid);
+        p = entry->style == CBOX_LOG_STYLE_FULL ? cbox_log_put(p, end, "]: ", 3) : cbox_log_put(p, end, "] ", 2);
     }
+
+    *p = '\0';
+    return p - buf;
 }
 
-void cbox_log_dump(cbox_log_t *log, const void *buf, uint16_t len)
+/*
+ *@return 1: the entry goes to stdout or syslog too
+ */
+static int cbox_log_emit_callback(const cbox_log_sinks_t *sinks, const cbox_log_entry_t *entry)
+{
+    char header[CBOX_LOG_HEADER_SIZE], stack[CBOX_LOG_HEADER_SIZE + CBOX_LOG_INLINE_SIZE];
+    char *line = stack;
+
+    if (sinks->cb == NULL)
+        return 1;
+
+    size_t header_len = cbox_log_format_header(sinks, entry, 0, header, sizeof(header));
+    if (header_len + entry->len + 1 > sizeof(stack)) {
+        line = (char *)malloc(header_len + entry->len + 1);
+        if (line == NULL)
+            return sinks->copy;
+    }
+
+    memcpy(line, header, header_len);
+    memcpy(line + header_len, entry->body, entry->len);
+    line[header_len + entry->len] = '\0';
+
+    (*sinks->cb)(entry->level, line, sinks->user);
+
+    if (line != stack)
+        CBOX_SAFETY_FREE(line);
+
+    return sinks->copy;
+}
+
+/*
+ * must be called with g_lock locked
+ */
+static void cbox_log_emit(cbox_log_t *log, const cbox_log_entry_t *entry)
 {
-    if (CBOX_LOG_LEVEL_DEBUG > log->level) return;
+    char header[CBOX_LOG_HEADER_SIZE];
+    cbox_log_sinks_t sinks;
 
+    cbox_log_get_sinks(log, &sinks);
+    if (!cbox_log_emit_callback(&sinks, entry))
+        return;
+
+    if (sinks.syslog) {
+        syslog(LOG_USER | LOG_INFO, "%.*s", (int)entry->len, entry->body);
+    } else if (sinks.file) {
+        struct iovec iov[3] = { { header, 0 }, { (void *)entry->body, entry->len }, { (void *)"\n", 1 } };
+        iov[0].iov_len = cbox_log_format_header(&sinks, entry, 0, header, sizeof(header));
+        cbox_log_file_write(sinks.file, entry->level, iov, 3);
+    } else {
+        cbox_log_format_header(&sinks, entry, sinks.color, header, sizeof(header));
+        fprintf(stdout, "%s%.*s\n", header, (int)entry->len, entry->body);
+    }
+}
+
+static void cbox_log_abstime(struct timespec *ts, long ms)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec ++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void cbox_log_async_wait(cbox_log_async_t *async, long ms)
+{
+    struct timespec ts;
+    cbox_log_abstime(&ts, ms);
+    pthread_mutex_lock(&async->mutex);
+    pthread_cond_timedwait(&async->cond, &async->mutex, &ts);
+    pthread_mutex_unlock(&async->mutex);
+}
+
+/*
+ *@return 0: queued, -1: dropped
+ */
+static int cbox_log_async_push(cbox_log_async_t *async, const cbox_log_entry_t *entry)
+{
+    cbox_log_slot_t *slot = NULL;
+    size_t pos = __atomic_load_n(&async->head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = &async->slots[pos & async->mask];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&async->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            if (async->overflow != CBOX_LOG_OVERFLOW_BLOCK || __atomic_load_n(&async->stop, __ATOMIC_RELAXED)) {
+                __atomic_add_fetch(&async->dropped, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&async->unreported, 1, __ATOMIC_RELAXED);
+                return -1;
+            }
+
+            __atomic_add_fetch(&async->blocked, 1, __ATOMIC_SEQ_CST);
+            cbox_log_async_wait(async, 10);
+            __atomic_sub_fetch(&async->blocked, 1, __ATOMIC_SEQ_CST);
+            pos = __atomic_load_n(&async->head, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&async->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->level = entry->level;
+    slot->style = entry->style;
+    slot->tv = entry->tv;
+    slot->tid = entry->tid;
+    slot->len = entry->len;
+    slot->heap = NULL;
+    if (entry->len <= sizeof(slot->body)) {
+        memcpy(slot->body, entry->body, entry->len);
+    } else if ((slot->heap = (char *)malloc(entry->len)) != NULL) {
+        memcpy(slot->heap, entry->body, entry->len);
+    } else {
+        slot->len = sizeof(slot->body);
+        memcpy(slot->body, entry->body, slot->len);
+    }
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    // pairs with the fence in the writer before it sleeps
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&async->sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&async->mutex);
+        pthread_cond_broadcast(&async->cond);
+        pthread_mutex_unlock(&async->mutex);
+    }
+
+    return 0;
+}
+
+static inline int cbox_log_async_ready(cbox_log_async_t *async, size_t pos)
+{
+    cbox_log_slot_t *slot = &async->slots[pos & async->mask];
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == pos + 1;
+}
+
+static void cbox_log_async_write_stdout(struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(STDOUT_FILENO, iov, count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov ++;
+            count --;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+static void *cbox_log_async_thread_func(void *arg)
+{
+    cbox_log_t *log = (cbox_log_t *)arg;
+    cbox_log_async_t *async = log->async;
+    struct iovec iov[CBOX_LOG_BATCH * 3 + 3];
+    cbox_log_entry_t entries[CBOX_LOG_BATCH + 1];
+    cbox_log_sinks_t sinks;
+    char report[64];
+    int i = 0, count = 0, iov_count = 0;
+
+    for (;;) {
+        count = 0;
+        while (count < CBOX_LOG_BATCH && cbox_log_async_ready(async, async->tail + count))
+            count ++;
+
+        uint64_t unreported = 0;
+        if (async->overflow == CBOX_LOG_OVERFLOW_COUNT)
+            unreported = __atomic_exchange_n(&async->unreported, 0, __ATOMIC_RELAXED);
+
+        if (count == 0 && unreported == 0) {
+            if (__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE))
+                break;
+
+            __atomic_store_n(&async->sleeping, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (!cbox_log_async_ready(async, async->tail) && !__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE))
+                cbox_log_async_wait(async, 100);
+            __atomic_store_n(&async->sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        pthread_mutex_lock(&g_lock);
+        cbox_log_get_sinks(log, &sinks);
+        if (sinks.file) cbox_log_file_ref(sinks.file);
+        pthread_mutex_unlock(&g_lock);
+
+        int n = 0;
+        if (unreported) {
+            cbox_log_entry_t *entry = &entries[n ++];
+            entry->level = CBOX_LOG_LEVEL_WARNING;
+            entry->style = CBOX_LOG_STYLE_FULL;
+            cbox_log_now(log, &entry->tv);
+            entry->tid = cbox_log_tid();
+            entry->len = snprintf(report, sizeof(report), "%llu log messages dropped", (unsigned long long)unreported);
+            entry->body = report;
+        }
+
+        for (i = 0; i < count; ++i) {
+            cbox_log_slot_t *slot = &async->slots[(async->tail + i) & async->mask];
+            cbox_log_entry_t *entry = &entries[n ++];
+            entry->level = slot->level;
+            entry->style = slot->style;
+            entry->tv = slot->tv;
+            entry->tid = slot->tid;
+            entry->body = slot->heap ? slot->heap : slot->body;
+            entry->len = slot->len;
+        }
+
+        iov_count = 0;
+        int level = CBOX_LOG_LEVEL_DEBUG;
+        for (i = 0; i < n; ++i) {
+            if (!cbox_log_emit_callback(&sinks, &entries[i]))
+                continue;
+
+            if (sinks.syslog) {
+                syslog(LOG_USER | LOG_INFO, "%.*s", (int)entries[i].len, entries[i].body);
+                continue;
+            }
+
+            char *header = async->buffer + i * CBOX_LOG_HEADER_SIZE;
+            iov[iov_count].iov_base = header;
+            iov[iov_count ++].iov_len = cbox_log_format_header(&sinks, &entries[i], sinks.file ? 0 : sinks.color,
+                                                               header, CBOX_LOG_HEADER_SIZE);
+            if (entries[i].level < level) level = entries[i].level;
+            iov[iov_count].iov_base = (void *)entries[i].body;
+            iov[iov_count ++].iov_len = entries[i].len;
+            iov[iov_count].iov_base = (void *)"\n";
+            iov[iov_count ++].iov_len = 1;
+        }
+
+        if (sinks.file) {
+            if (iov_count > 0) cbox_log_file_write(sinks.file, level, iov, iov_count);
+            cbox_log_file_unref(sinks.file);
+        } else {
+            cbox_log_async_write_stdout(iov, iov_count);
+        }
+
+        for (i = 0; i < count; ++i) {
+            cbox_log_slot_t *slot = &async->slots[async->tail & async->mask];
+            CBOX_SAFETY_FREE(slot->heap);
+            __atomic_store_n(&slot->seq, async->tail + async->mask + 1, __ATOMIC_RELEASE);
+            async->tail ++;
+        }
+
+        __atomic_add_fetch(&async->written, count, __ATOMIC_RELEASE);
+        if (__atomic_load_n(&async->blocked, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&async->mutex);
+            pthread_cond_broadcast(&async->cond);
+            pthread_mutex_unlock(&async->mutex);
+        }
+    }
+
+    return NULL;
+}
+
+static void cbox_log_async_free(cbox_log_async_t *async)
+{
+    size_t i = 0;
+
+    if (async == NULL)
+        return;
+
+    if (async->slots) {
+        for (i = 0; i <= async->mask; ++i)
+            CBOX_SAFETY_FREE(async->slots[i].heap);
+    }
+
+    pthread_cond_destroy(&async->cond);
+    pthread_mutex_destroy(&async->mutex);
+    CBOX_SAFETY_FREE(async->buffer);
+    CBOX_SAFETY_FREE(async->slots);
+    CBOX_SAFETY_FREE(async);
+}
+
+static int cbox_log_async_start(cbox_log_t *log, size_t capacity, cbox_log_overflow_t overflow)
+{
+    size_t i = 0, size = 2;
+
+    cbox_log_async_t *async = (cbox_log_async_t *)calloc(1, sizeof(cbox_log_async_t));
+    if (async == NULL)
+        return -1;
+
+    while (size < capacity)
+        size <<= 1;
+
+    pthread_mutex_init(&async->mutex, NULL);
+    pthread_cond_init(&async->cond, NULL);
+    async->mask = size - 1;
+    async->overflow = overflow;
+    async->slots = (cbox_log_slot_t *)calloc(size, sizeof(cbox_log_slot_t));
+    async->buffer = (char *)malloc((CBOX_LOG_BATCH + 1) * CBOX_LOG_HEADER_SIZE);
+    if (async->slots == NULL || async->buffer == NULL) {
+        cbox_log_async_free(async);
+        return -1;
+    }
+
+    for (i = 0; i < size; ++i)
+        async->slots[i].seq = i;
+
+    fflush(stdout);
+    log->async = async;
+    if (pthread_create(&async->thread, NULL, cbox_log_async_thread_func, log) != 0) {
+        log->async = NULL;
+        cbox_log_async_free(async);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * drains the queued records and stops the writer thread
+ */
+static void cbox_log_async_stop(cbox_log_t *log)
+{
     pthread_mutex_lock(&g_lock);
-    char prefix[64];
-    sprintf(prefix, "%s [%ld]", log->name ? log->name : DEFAULT_CBOX_LOG_NAME, syscall(SYS_gettid));
-    const size_t padding = 18 + strlen(prefix) + 1;
+    cbox_log_async_t *async = log->async;
+    log->async = NULL;
+    pthread_mutex_unlock(&g_lock);
 
-    char hex[128] = { 0 }, str[32] = { 0 };
+    if (async == NULL)
+        return;
 
-    memset(hex, 0x20, sizeof(hex));
+    while (__atomic_load_n(&async->users, __ATOMIC_ACQUIRE))
+        sched_yield();
 
-    size_t i = 0, index = 0;
-    const size_t length = 16;
+    __atomic_store_n(&async->stop, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&async->mutex);
+    pthread_cond_broadcast(&async->cond);
+    pthread_mutex_unlock(&async->mutex);
 
-    while (index < len) {
-        size_t line_len = len - index > length ? length : len - index;
-        bin_to_hex(hex + padding, (uint8_t *)buf + index, line_len, 1, 0);
-        if (line_len < length) for (i = 0; i < length - line_len; i++) strcat(hex, "   ");
-        memcpy(str, (uint8_t *)buf + index, line_len);
-        for (i = 0; i < length; i++) if ((uint8_t)str[i] < 0x20 || (uint8_t)str[i] > 0x7E) str[i] = 0x2E;
-        str[line_len] = '\0';
-        index += line_len;
+    pthread_join(async->thread, NULL);
+
+    pthread_mutex_lock(&g_lock);
+    log->dropped += async->dropped;
+    pthread_mutex_unlock(&g_lock);
+
+    cbox_log_async_free(async);
+}
 
-        cbox_log_raw(log, CBOX_LOG_LEVEL_DEBUG, "%s\t\t%s", hex, str);
+/*
+ * must be called with g_lock locked, returns with it unlocked
+ */
+static void cbox_log_output(cbox_log_t *log, cbox_log_entry_t *entry)
+{
+    cbox_log_async_t *async = log->async;
+
+    if (async == NULL) {
+        cbox_log_emit(log, entry);
+        pthread_mutex_unlock(&g_lock);
+        return;
     }
 
+    // keeps async alive after g_lock is released, see cbox_log_async_stop()
+    __atomic_add_fetch(&async->users, 1, __ATOMIC_ACQUIRE);
     pthread_mutex_unlock(&g_lock);
+    cbox_log_async_push(async, entry);
+    __atomic_sub_fetch(&async->users, 1, __ATOMIC_RELEASE);
 }
 
-void cbox_log_dump_with_tag(cbox_log_t *log, const char *tag, const void *buf, uint16_t len)
+int cbox_log_set_async(cbox_log_t *log, int async, size_t capacity, cbox_log_overflow_t overflow)
 {
-    cbox_log_full(log, CBOX_LOG_LEVEL_DEBUG, "%s: %d(bytes)", tag, len);
-    cbox_log_dump(log, buf, len);
+    int ret = 0;
+
+    if (log == NULL || overflow > CBOX_LOG_OVERFLOW_COUNT)
+        return -1;
+
+    cbox_log_async_stop(log);
+    if (!async)
+        return 0;
+
+    pthread_mutex_lock(&g_lock);
+    if (log->async == NULL)
+        ret = cbox_log_async_start(log, capacity ? capacity : CBOX_LOG_DEFAULT_CAPACITY, overflow);
+    pthread_mutex_unlock(&g_lock);
+
+    return ret;
+}
+
+void cbox_log_set_coarse_clock(cbox_log_t *log, int coarse)
+{
+    __atomic_store_n(&log->coarse, coarse, __ATOMIC_RELAXED);
 }
 
-int cbox_vasprintf(char **strp, const char* fmt, va_list args)
+int cbox_log_set_file(cbox_log_t *log, const char *path, const cbox_log_file_option_t *option)
 {
-    int r = -1;
-    va_list args_copy;
-    va_copy(args_copy, args);
+    cbox_log_file_t *file = NULL;
 
-    int len = vsnprintf(NULL, 0, fmt, args);
+    if (path && (file = cbox_log_file_open(path, option)) == NULL)
+        return -1;
 
-    *strp = malloc(len + 1);
-    if(!*strp) {
-        return -1; 
+    pthread_mutex_lock(&g_lock);
+    cbox_log_file_t *old = log->file;
+    log->file = file;
+    pthread_mutex_unlock(&g_lock);
+
+    cbox_log_file_unref(old);
+    return 0;
+}
+
+/*
+ * waits for the file sink to write its buffers
+ */
+static void cbox_log_file_sync(cbox_log_t *log)
+{
+    pthread_mutex_lock(&g_lock);
+    cbox_log_file_t *file = log->file;
+    if (file) cbox_log_file_ref(file);
+    pthread_mutex_unlock(&g_lock);
+
+    if (file) {
+        cbox_log_file_flush(file);
+        cbox_log_file_unref(file);
     }
+}
 
-    r = vsnprintf(*strp, len + 1, fmt, args_copy);
+/*
+ * growing string of the structured messages, failed is set instead of checking every put
+ */
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t size;
+    int failed;
+} cbox_log_str_t;
+
+/*
+ * fields serialized once in both formats
+ */
+struct cbox_log_kv_ctx_s
+{
+    cbox_log_str_t json;    //!< ,"key":value...
+    cbox_log_str_t logfmt;  //!<  key=value...
+};
+
+static void cbox_log_str_put(cbox_log_str_t *str, const char *s, size_t len)
+{
+    if (str->failed)
+        return;
+
+    if (str->len + len >= str->size) {
+        size_t size = str->size ? str->size : CBOX_LOG_BODY_SIZE;
+        while (size <= str->len + len) size *= 2;
+
+        char *data = (char *)realloc(str->data, size);
+        if (data == NULL) {
+            str->failed = 1;
+            return;
+        }
+
+        str->data = data;
+        str->size = size;
+    }
+
+    memcpy(str->data + str->len, s, len);
+    str->len += len;
+    str->data[str->len] = '\0';
+}
+
+static void cbox_log_str_escape(cbox_log_str_t *str, const char *s)
+{
+    static const char digits[] = "0123456789abcdef";
+    const char *run = s;
+
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        char esc[6] = { '\\', (char)c };
+        size_t len = 2;
+
+        if (c == '"' || c == '\\') ;
+        else if (c == '\n') esc[1] = 'n';
+        else if (c == '\r') esc[1] = 'r';
+        else if (c == '\t') esc[1] = 't';
+        else if (c < 0x20) {
+            esc[1] = 'u'; esc[2] = '0'; esc[3] = '0'; esc[4] = digits[c >> 4]; esc[5] = digits[c & 0xf];
+            len = 6;
+        } else continue;
+
+        cbox_log_str_put(str, run, s - run);
+        cbox_log_str_put(str, esc, len);
+        run = s + 1;
+    }
+
+    cbox_log_str_put(str, run, s - run);
+}
 
-    va_end(args_copy);
+static void cbox_log_kv_put_str(cbox_log_str_t *str, int format, const char *value)
+{
+    // logfmt only quotes the values that need it
+    if (format == CBOX_LOG_KV_LOGFMT && *value) {
+        const char *p = value;
+        while ((unsigned char)*p > 0x20 && *p != '=' && *p != '"' && *p != '\\') ++p;
+        if (*p == '\0') {
+            cbox_log_str_put(str, value, p - value);
+            return;
+        }
+    }
 
-    return r;  
+    cbox_log_str_put(str, "\"", 1);
+    cbox_log_str_escape(str, value);
+    cbox_log_str_put(str, "\"", 1);
 }
 
+static void cbox_log_kv_put_key(cbox_log_str_t *str, int format, const char *key)
+{
+    if (format == CBOX_LOG_KV_JSON) {
+        cbox_log_str_put(str, ",\"", 2);
+        cbox_log_str_escape(str, key);
+        cbox_log_str_put(str, "\":", 2);
+    } else {
+        cbox_log_str_put(str, " ", 1);
+        cbox_log_str_put(str, key, strlen(key));
+        cbox_log_str_put(str, "=", 1);
+    }
+}
 
-static int cbox_asprintf(char **strp, const char *fmt, ...)
+/*
+ * appends the key, type, value triples until a NULL key
+ *@param key - the first key, the rest are in ap
+ *@return 0: succeed, -1: unknown type, the rest are ignored
+ */
+static int cbox_log_kv_put_args(cbox_log_str_t *str, int format, const char *key, va_list ap)
 {
-    va_list args;
-    va_start(args, fmt);
+    char num[32];
+    int len = 0;
+
+    for (; key != NULL; key = va_arg(ap, const char *)) {
+        int type = va_arg(ap, int);
+
+        switch (type) {
+            case CBOX_LOG_KV_STR:
+                {
+                    const char *value = va_arg(ap, const char *);
+                    cbox_log_kv_put_key(str, format, key);
+                    cbox_log_kv_put_str(str, format, value ? value : "");
+                }
+                continue;
+            case CBOX_LOG_KV_INT: len = snprintf(num, sizeof(num), "%d", va_arg(ap, int)); break;
+            case CBOX_LOG_KV_I64: len = snprintf(num, sizeof(num), "%lld", (long long)va_arg(ap, int64_t)); break;
+            case CBOX_LOG_KV_U64: len = snprintf(num, sizeof(num), "%llu", (unsigned long long)va_arg(ap, uint64_t)); break;
+            case CBOX_LOG_KV_BOOL: len = snprintf(num, sizeof(num), "%s", va_arg(ap, int) ? "true" : "false"); break;
+            case CBOX_LOG_KV_DOUBLE:
+                {
+                    double value = va_arg(ap, double);
+                    // json has no inf and nan
+                    if (format == CBOX_LOG_KV_JSON && (value != value || value - value != 0))
+                        len = snprintf(num, sizeof(num), "null");
+                    else
+                        len = snprintf(num, sizeof(num), "%.15g", value);
+                }
+                break;
+            default:
+                return -1;
+        }
+
+        cbox_log_kv_put_key(str, format, key);
+        cbox_log_str_put(str, num, len);
+    }
 
-    int r = cbox_vasprintf(strp, fmt, args);
+    return 0;
+}
 
+cbox_log_kv_ctx_t *cbox_log_kv_ctx_create(const char *key, ...)
+{
+    cbox_log_kv_ctx_t *ctx = (cbox_log_kv_ctx_t *)calloc(1, sizeof(cbox_log_kv_ctx_t));
+    if (ctx == NULL)
+        return NULL;
+
+    va_list ap, args;
+    va_start(ap, key);
+    va_copy(args, ap);
+    int ret = cbox_log_kv_put_args(&ctx->json, CBOX_LOG_KV_JSON, key, args);
     va_end(args);
+    ret |= cbox_log_kv_put_args(&ctx->logfmt, CBOX_LOG_KV_LOGFMT, key, ap);
+    va_end(ap);
+
+    if (ret != 0 || ctx->json.failed || ctx->logfmt.failed) {
+        cbox_log_kv_ctx_destroy(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+void cbox_log_kv_ctx_destroy(cbox_log_kv_ctx_t *ctx)
+{
+    if (ctx == NULL)
+        return;
+
+    CBOX_SAFETY_FREE(ctx->json.data);
+    CBOX_SAFETY_FREE(ctx->logfmt.data);
+    CBOX_SAFETY_FREE(ctx);
+}
+
+void cbox_log_set_kv_format(cbox_log_t *log, cbox_log_kv_format_t format)
+{
+    pthread_mutex_lock(&g_lock);
+    log->kv_format = format;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void cbox_log_kv(cbox_log_t *log, int level, const cbox_log_kv_ctx_t *ctx, const char *msg, ...)
+{
+    static const char *levels[] = { "emerg", "alert", "crit", "error", "warning", "notice", "info", "debug" };
+    int to_sinks = level <= log->level, recorded = cbox_log_recorded(log, level);
+    char name[64], ts[24];
+    int format = 0;
+
+    if ((!to_sinks && !recorded) || level < CBOX_LOG_LEVEL_EMERG || level > CBOX_LOG_LEVEL_DEBUG)
+        return;
+
+    cbox_log_entry_t entry = { level, CBOX_LOG_STYLE_RAW, { 0, 0 }, cbox_log_tid(), NULL, 0 };
+    cbox_log_now(log, &entry.tv);
+
+    pthread_mutex_lock(&g_lock);
+    snprintf(name, sizeof(name), "%s", log->name ? log->name : DEFAULT_CBOX_LOG_NAME);
+    format = log->kv_format;
+    pthread_mutex_unlock(&g_lock);
+
+    // ISO 8601 local time with miliseconds
+    memcpy(ts, cbox_log_time_str(entry.tv.tv_sec), 19);
+    ts[10] = 'T';
+    long ms = (long)entry.tv.tv_usec / 1000;
+    ts[19] = '.';
+    ts[20] = '0' + ms / 100;
+    ts[21] = '0' + ms / 10 % 10;
+    ts[22] = '0' + ms % 10;
+    ts[23] = '\0';
+
+    cbox_log_str_t str = { t_body, 0, t_body_size, 0 };
+    const char *names[][5] = { { "ts=", " level=", " logger=", " tid=", " msg=" },
+                               { "{\"ts\":", ",\"level\":\"", "\",\"logger\":", ",\"tid\":", ",\"msg\":" } };
+    const char **keys = names[format == CBOX_LOG_KV_JSON];
+    char tid[24];
+    int tid_len = snprintf(tid, sizeof(tid), "%ld", entry.tid);
+
+    cbox_log_str_put(&str, keys[0], strlen(keys[0]));
+    cbox_log_kv_put_str(&str, format, ts);
+    cbox_log_str_put(&str, keys[1], strlen(keys[1]));
+    cbox_log_str_put(&str, levels[level], strlen(levels[level]));
+    cbox_log_str_put(&str, keys[2], strlen(keys[2]));
+    cbox_log_kv_put_str(&str, format, name);
+    cbox_log_str_put(&str, keys[3], strlen(keys[3]));
+    cbox_log_str_put(&str, tid, tid_len);
+    cbox_log_str_put(&str, keys[4], strlen(keys[4]));
+    cbox_log_kv_put_str(&str, format, msg ? msg : "");
+
+    if (ctx) {
+        const cbox_log_str_t *fields = format == CBOX_LOG_KV_JSON ? &ctx->json : &ctx->logfmt;
+        if (fields->len) cbox_log_str_put(&str, fields->data, fields->len);
+    }
 
-    return r;
+    va_list ap;
+    va_start(ap, msg);
+    cbox_log_kv_put_args(&str, format, va_arg(ap, const char *), ap);
+    va_end(ap);
+
+    if (format == CBOX_LOG_KV_JSON)
+        cbox_log_str_put(&str, "}", 1);
+
+    // the string grows in the thread buffer
+    if (str.data != t_body) {
+        if (t_body == NULL) pthread_once(&g_body_once, cbox_log_body_key_create);
+        t_body = str.data;
+        t_body_size = str.size;
+        pthread_setspecific(g_body_key, t_body);
+    }
+
+    if (str.failed)
+        return;
+
+    entry.body = str.data;
+    entry.len = str.len;
+
+    if (recorded)
+        cbox_log_record(log, &entry);
+
+    if (!to_sinks)
+        return;
+
+    pthread_mutex_lock(&g_lock);
+    cbox_log_output(log, &entry);
+}
+
+int cbox_log_set_recorder(cbox_log_t *log, const char *path, size_t size, cbox_level_t level)
+{
+    cbox_log_recorder_t *recorder = NULL;
+
+    if (path) {
+        pthread_mutex_lock(&g_lock);
+        char *name = strdup(log->name ? log->name : DEFAULT_CBOX_LOG_NAME);
+        pthread_mutex_unlock(&g_lock);
+
+        recorder = name ? cbox_log_recorder_open(path, size, name) : NULL;
+        CBOX_SAFETY_FREE(name);
+        if (recorder == NULL)
+            return -1;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    __atomic_store_n(&log->record_level, -1, __ATOMIC_RELAXED);
+    cbox_log_recorder_t *old = __atomic_exchange_n(&log->recorder, recorder, __ATOMIC_SEQ_CST);
+    if (recorder)
+        __atomic_store_n(&log->record_level, (int)level, __ATOMIC_RELAXED);
+    cbox_log_levels_changed();
+    pthread_mutex_unlock(&g_lock);
+
+    while (__atomic_load_n(&log->recorder_users, __ATOMIC_SEQ_CST))
+        sched_yield();
+
+    cbox_log_recorder_close(old);
+    return 0;
 }
 
+int cbox_log_set_binary(cbox_log_t *log, const char *path)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&g_lock);
+    CBOX_SAFETY_FUNC(cbox_log_binary_close, log->binary);
+    if (path && (log->binary = cbox_log_binary_open(path, log->name ? log->name : DEFAULT_CBOX_LOG_NAME)) == NULL)
+        ret = -1;
+    pthread_mutex_unlock(&g_lock);
+
+    return ret;
+}
+
+void cbox_log_flush(cbox_log_t *log)
+{
+    pthread_mutex_lock(&g_lock);
+    if (log->binary)
+        cbox_log_binary_flush(log->binary);
+
+    // set_recorder holds g_lock to swap it
+    if (log->recorder)
+        cbox_log_recorder_sync(log->recorder);
+
+    cbox_log_async_t *async = log->async;
+    if (async == NULL) {
+        fflush(stdout);
+        pthread_mutex_unlock(&g_lock);
+        cbox_log_file_sync(log);
+        return;
+    }
+    __atomic_add_fetch(&async->users, 1, __ATOMIC_ACQUIRE);
+    pthread_mutex_unlock(&g_lock);
+
+    size_t target = __atomic_load_n(&async->head, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&async->blocked, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&async->written, __ATOMIC_ACQUIRE) < target) {
+        pthread_mutex_lock(&async->mutex);
+        pthread_cond_broadcast(&async->cond);
+        pthread_mutex_unlock(&async->mutex);
+        cbox_log_async_wait(async, 10);
+    }
+    __atomic_sub_fetch(&async->blocked, 1, __ATOMIC_SEQ_CST);
+
+    __atomic_sub_fetch(&async->users, 1, __ATOMIC_RELEASE);
+
+    cbox_log_file_sync(log);
+}
+
+uint64_t cbox_log_dropped(cbox_log_t *log)
+{
+    uint64_t dropped = 0;
+
+    pthread_mutex_lock(&g_lock);
+    dropped = log->dropped;
+    if (log->async)
+        dropped += __atomic_load_n(&log->async->dropped, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_lock);
+
+    return dropped;
+}
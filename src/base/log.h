@@ -2,6 +2,7 @@
 #define _CBOX_LOG_H__
 
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 
 #define __FILENAME__        strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__
@@ -17,9 +18,101 @@ typedef enum {
     CBOX_LOG_LEVEL_DEBUG
 } cbox_level_t;
 
+/*
+ * what the async logger does when its queue is full
+ */
+typedef enum {
+    CBOX_LOG_OVERFLOW_BLOCK = 0,    //!< wait for the writer thread
+    CBOX_LOG_OVERFLOW_DROP,         //!< drop the message
+    CBOX_LOG_OVERFLOW_COUNT         //!< drop the message and log how many were dropped later
+} cbox_log_overflow_t;
+
+typedef struct
+{
+    size_t buffer_size;         //!< bytes of each of the two buffers, default: 1MB
+    uint32_t flush_interval;    //!< miliseconds, default: 1000
+    int flush_level;            //!< write at once the messages at this level or more severe, default: CBOX_LOG_LEVEL_ERROR
+    size_t max_size;            //!< rotate when the file reaches the bytes, 0: never (default)
+    uint32_t rotate_interval;   //!< rotate every these seconds, 0: never (default)
+    uint32_t max_files;         //!< rotated files to keep, 0: all (default)
+    int compress;               //!< gzip the rotated files, default: 0
+} cbox_log_file_option_t;
+
+#define CBOX_LOG_FILE_OPTION_INITIALIZER { 1024 * 1024, 1000, CBOX_LOG_LEVEL_ERROR, 0, 0, 0, 0 }
+
+/*
+ * value types of cbox_log_kv(), use the CBOX_KV_* macros to pass the matching values
+ */
+typedef enum {
+    CBOX_LOG_KV_STR = 1,    //!< const char *
+    CBOX_LOG_KV_INT,        //!< int
+    CBOX_LOG_KV_I64,        //!< int64_t
+    CBOX_LOG_KV_U64,        //!< uint64_t
+    CBOX_LOG_KV_DOUBLE,     //!< double
+    CBOX_LOG_KV_BOOL        //!< int
+} cbox_log_kv_type_t;
+
+typedef enum {
+    CBOX_LOG_KV_LOGFMT = 0, //!< ts=... level=info logger=name tid=1 msg="..." key=value
+    CBOX_LOG_KV_JSON        //!< {"ts":"...","level":"info","logger":"name","tid":1,"msg":"...","key":value}
+} cbox_log_kv_format_t;
+
+#define CBOX_KV_STR(k, v)       (const char *)(k), (int)CBOX_LOG_KV_STR, (const char *)(v)
+#define CBOX_KV_INT(k, v)       (const char *)(k), (int)CBOX_LOG_KV_INT, (int)(v)
+#define CBOX_KV_I64(k, v)       (const char *)(k), (int)CBOX_LOG_KV_I64, (int64_t)(v)
+#define CBOX_KV_U64(k, v)       (const char *)(k), (int)CBOX_LOG_KV_U64, (uint64_t)(v)
+#define CBOX_KV_DOUBLE(k, v)    (const char *)(k), (int)CBOX_LOG_KV_DOUBLE, (double)(v)
+#define CBOX_KV_BOOL(k, v)      (const char *)(k), (int)CBOX_LOG_KV_BOOL, (int)(!!(v))
+#define CBOX_KV_END             (const char *)NULL
+
+typedef struct cbox_log_kv_ctx_s cbox_log_kv_ctx_t;
+
 typedef void (*cbox_log_function_t)(int, const char *, void *);
 typedef struct cbox_log_s cbox_log_t;
 
+/*
+ * where a message is logged, one static object per LOG* macro.
+ * the levels are cached in it, and refreshed when cbox_log_generation changes
+ */
+typedef struct
+{
+    const char *func;
+    const char *file;
+    int line;
+    const char *filename;       //!< base name of file, filled on first use
+    const char *module;         //!< LOG_MODULE_ID of the file, NULL if not defined
+    unsigned int generation;    //!< cbox_log_generation of the cached levels
+    int level;                  //!< written to the sinks at this level or more severe
+    int enabled;                //!< written to any sink or the recorder at this level or more severe
+} cbox_log_site_t;
+
+#ifdef LOG_MODULE_ID
+#define CBOX_LOG_MODULE LOG_MODULE_ID
+#else
+#define CBOX_LOG_MODULE NULL
+#endif
+
+#define CBOX_LOG_SITE_INITIALIZER { __FUNCTION__, __FILE__, __LINE__, NULL, CBOX_LOG_MODULE, 0, -1, -1 }
+
+/*
+ * state of a LOG*_RATELIMIT site
+ */
+typedef struct
+{
+    uint64_t state;         //!< atomic, start of the window in miliseconds << 20 | messages in it
+    uint32_t suppressed;    //!< atomic, messages dropped since the last one written
+} cbox_log_limit_t;
+
+#define CBOX_LOG_LIMIT_INITIALIZER { 0, 0 }
+
+/*
+ * the LOG* macros less severe than it are compiled out, their arguments are not evaluated,
+ * e.g., -DCBOX_LOG_COMPILE_LEVEL=CBOX_LOG_LEVEL_INFO removes LOGD
+ */
+#ifndef CBOX_LOG_COMPILE_LEVEL
+#define CBOX_LOG_COMPILE_LEVEL CBOX_LOG_LEVEL_DEBUG
+#endif
+
 extern cbox_log_t *cbox_log_instance;
 
 #if defined (__cplusplus)
@@ -32,19 +125,160 @@ void cbox_log_redirect(cbox_log_t *log, cbox_log_function_t cb, void *obj, int c
 
 void cbox_log_set_name(cbox_log_t *log, const char *name);
 void cbox_log_set_level(cbox_log_t *log, cbox_level_t level);
+
+/*
+ *@brief set the level of the LOG* macros in the files built with -DLOG_MODULE_ID=module,
+ *       instead of the log level, e.g., "cbox.event"
+ *@param level - negative value to use the log level again
+ *@return 0: succeed, -1: too many modules or the name is too long
+ */
+int cbox_log_set_module_level(cbox_log_t *log, const char *module, int level);
 void cbox_log_set_color(cbox_log_t *log, int color /*bool*/);
 
+/*
+ *@brief take the timestamps from CLOCK_REALTIME_COARSE, it is several times cheaper than
+ *       gettimeofday(), but only as precise as the kernel tick (1-4ms)
+ *@param coarse - 1: enable, 0: disable (default)
+ */
+void cbox_log_set_coarse_clock(cbox_log_t *log, int coarse /*bool*/);
+
 const char *cbox_log_get_category(cbox_log_t *log, int level, int color);
 void cbox_log_set_syslog(cbox_log_t *log, int syslog);
+
+/*
+ *@brief append " [errno:result]" to the next message of the calling thread
+ */
 void cbox_log_set_result(cbox_log_t *log, int result);
 void cbox_log_set_format(cbox_log_t *log, int prefix, const char *fmt, ...);
 
 void cbox_log_raw(cbox_log_t *log, int level, const char *fmt, ...);
 void cbox_log_basic(cbox_log_t *log, int level, const char *fmt, ...);
 void cbox_log_full(cbox_log_t *log, int level, const char *fmt, ...);
+
+/*
+ *@brief same as cbox_log_full, but the prefix is "func: " and the suffix is " (file:line)" of the site,
+ *       instead of the shared ones set by cbox_log_set_format(). the message is formatted
+ *       in a thread local buffer and the lock is only taken to write it
+ *@param site - where it is logged, NULL means no prefix and suffix
+ */
+void cbox_log_full_at(cbox_log_t *log, int level, cbox_log_site_t *site, const char *fmt, ...);
 void cbox_log_dump(cbox_log_t *log, const void *buf, uint16_t len);
+
+/*
+ *@brief lock-free token bucket of a site, at most burst messages pass every interval_ms
+ *@param limit - the state of the site
+ *@param suppressed - set to the messages dropped before, when the first message of a window passes
+ *@return 1: write the message, 0: drop it
+ */
+int cbox_log_ratelimit(cbox_log_limit_t *limit, uint32_t interval_ms, uint32_t burst, uint32_t *suppressed);
+
+extern unsigned int cbox_log_generation;
+void cbox_log_site_update(cbox_log_t *log, cbox_log_site_t *site);
+
+/*
+ *@brief check the cached level of the site, it is inlined before the arguments of LOG* are evaluated
+ */
+static inline int cbox_log_enabled(cbox_log_t *log, cbox_log_site_t *site, int level)
+{
+    if (__builtin_expect(__atomic_load_n(&site->generation, __ATOMIC_ACQUIRE) !=
+                         __atomic_load_n(&cbox_log_generation, __ATOMIC_RELAXED), 0))
+        cbox_log_site_update(log, site);
+
+    return level <= __atomic_load_n(&site->enabled, __ATOMIC_RELAXED);
+}
 void cbox_log_dump_with_tag(cbox_log_t *log, const char *tag, const void *buf, uint16_t len);
 
+/*
+ *@brief format of the messages of cbox_log_kv()
+ */
+void cbox_log_set_kv_format(cbox_log_t *log, cbox_log_kv_format_t format);
+
+/*
+ *@brief serialize the fields shared by many messages once, e.g., client id and session
+ *       cbox_log_kv_ctx_create(CBOX_KV_STR("client_id", id), CBOX_KV_INT("session", 7), CBOX_KV_END);
+ *@return the context, NULL: failed or unknown type
+ */
+cbox_log_kv_ctx_t *cbox_log_kv_ctx_create(const char *key, ...);
+void cbox_log_kv_ctx_destroy(cbox_log_kv_ctx_t *ctx);
+
+/*
+ *@brief log a structured message in the format set by cbox_log_set_kv_format(), it goes
+ *       to the sinks as a raw line, the fields of ctx and the key, type, value triples follow msg
+ *       cbox_log_kv(log, CBOX_LOG_LEVEL_INFO, ctx, "connected", CBOX_KV_INT("rc", rc), CBOX_KV_END);
+ *@param ctx - the shared fields, NULL means none
+ *@param msg - the message, it is escaped but not formatted
+ */
+void cbox_log_kv(cbox_log_t *log, int level, const cbox_log_kv_ctx_t *ctx, const char *msg, ...);
+
+/*
+ *@brief write the messages in a background thread, the callers only format them and
+ *       push them into a lock-free queue, the writer writes them in batches with writev.
+ *       the redirect callback and syslog are called in the writer thread too
+ *@param log - the log object
+ *@param async - 1: enable, 0: disable, the queued messages are written before it returns
+ *@param capacity - max queued messages, rounded up to power of 2, 0 means 8192
+ *@param overflow - what to do when the queue is full
+ *@return 0: succeed, -1: failed
+ */
+int cbox_log_set_async(cbox_log_t *log, int async, size_t capacity, cbox_log_overflow_t overflow);
+
+/*
+ *@brief write the messages to a file instead of stdout, the redirect callback and syslog
+ *       go before it as they do before stdout.
+ *       the messages are copied into a big buffer, and written by a flusher thread
+ *       when the interval passes, the buffer is full, or a message at flush_level comes.
+ *       the flusher thread rotates the file to "<path>.YYYYmmdd-HHMMSS-NNN" too
+ *@param log - the log object
+ *@param path - the file, opened with O_APPEND, NULL to go back to stdout
+ *@param option - NULL means CBOX_LOG_FILE_OPTION_INITIALIZER
+ *@return 0: succeed, -1: failed, the sink is not changed
+ */
+int cbox_log_set_file(cbox_log_t *log, const char *path, const cbox_log_file_option_t *option);
+
+/*
+ *@brief keep the last messages in a memory mapped file as a ring, besides the other sinks.
+ *       a message costs an atomic add and a memcpy, no lock and no syscall, and the file
+ *       survives a crash of the process, decode it with cbox_log_decode().
+ *       the records of the previous run are kept if the file has the same size
+ *@param log - the log object
+ *@param path - the file, NULL to disable
+ *@param size - bytes of the ring, rounded up to power of 2, at least 64KB
+ *@param level - record the messages at this level or more severe, even if the log level filters them out
+ *@return 0: succeed, -1: failed
+ */
+int cbox_log_set_recorder(cbox_log_t *log, const char *path, size_t size, cbox_level_t level);
+
+/*
+ *@brief write the messages of cbox_log_full() and cbox_log_basic() (all LOG* macros)
+ *       to a binary file instead of the other sinks. the arguments are copied as they are,
+ *       and formatted later by cbox_log_decode(), the format string is parsed once.
+ *       the format strings must live as long as the process, as the literals do.
+ *       the records are buffered until the buffer is full, cbox_log_flush() or an error level message
+ *@param log - the log object
+ *@param path - the binary file, it is truncated, NULL to disable
+ *@return 0: succeed, -1: failed, binary logging is disabled
+ */
+int cbox_log_set_binary(cbox_log_t *log, const char *path);
+
+/*
+ *@brief format the binary file written by cbox_log_set_binary() or cbox_log_set_recorder()
+ *@param path - the binary file
+ *@param cb - called with every line, without color
+ *@param user - the user data
+ *@return 0: succeed, -1: failed, e.g., not a binary log file
+ */
+int cbox_log_decode(const char *path, cbox_log_function_t cb, void *user);
+
+/*
+ *@brief wait until the messages logged before are written
+ */
+void cbox_log_flush(cbox_log_t *log);
+
+/*
+ *@brief get number of messages dropped by the async queue
+ */
+uint64_t cbox_log_dropped(cbox_log_t *log);
+
 #if defined (__cplusplus)
 }
 #endif
@@ -53,14 +287,45 @@ void cbox_log_dump_with_tag(cbox_log_t *log, const char *tag, const void *buf, u
 #define CBOX_LOG_DESTROY()                      do { cbox_log_destroy(); } while(0)
 #define CBOX_LOG_REDIRECT(cb, obj, copy)        do { cbox_log_redirect(cbox_log_instance, cb, obj, copy); } while(0)
 #define CBOX_LOG_SET_LEVEL(level)               do { cbox_log_set_level(cbox_log_instance, level); } while(0)
+#define CBOX_LOG_SET_MODULE_LEVEL(m, level)     do { cbox_log_set_module_level(cbox_log_instance, m, level); } while(0)
 #define CBOX_LOG_SET_NAME(n)                    do { cbox_log_set_name(cbox_log_instance, n); } while(0)
 #define CBOX_LOG_SET_COLOR(c)                   do { cbox_log_set_color(cbox_log_instance, c); } while(0)
+#define CBOX_LOG_SET_COARSE_CLOCK(c)            do { cbox_log_set_coarse_clock(cbox_log_instance, c); } while(0)
 #define CBOX_LOG_SET_REULT(result)              do { cbox_log_set_result(cbox_log_instance, result); } while(0)
 #define CBOX_LOG_SET_SYSLOG(syslog)             do { cbox_log_set_syslog(cbox_log_instance, syslog); } while(0)
+#define CBOX_LOG_SET_ASYNC(a, c, o)             do { cbox_log_set_async(cbox_log_instance, a, c, o); } while(0)
+#define CBOX_LOG_SET_BINARY(path)               do { cbox_log_set_binary(cbox_log_instance, path); } while(0)
+#define CBOX_LOG_SET_FILE(path, option)         do { cbox_log_set_file(cbox_log_instance, path, option); } while(0)
+#define CBOX_LOG_SET_RECORDER(path, size, l)    do { cbox_log_set_recorder(cbox_log_instance, path, size, l); } while(0)
+#define CBOX_LOG_SET_KV_FORMAT(f)               do { cbox_log_set_kv_format(cbox_log_instance, f); } while(0)
+#define CBOX_LOG_FLUSH()                        do { cbox_log_flush(cbox_log_instance); } while(0)
 #define CBOX_LOG_GET_CATEGORY(level, color)     cbox_log_get_category(cbox_log_instance, level, color)
 
-#define LOGM(fmt, ...)                  do { cbox_log_set_format(cbox_log_instance, 1, ""); cbox_log_set_format(cbox_log_instance, 0, ""); cbox_log_full(cbox_log_instance, CBOX_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__); } while(0)
-#define LOGF(level, fmt, ...)           do { cbox_log_set_format(cbox_log_instance, 1, "%s: ", __FUNCTION__); cbox_log_set_format(cbox_log_instance, 0, " (%s:%d)", __FILENAME__, __LINE__); cbox_log_full(cbox_log_instance, level, fmt, ##__VA_ARGS__); } while(0)
+#define LOGM(fmt, ...)                  do { if (CBOX_LOG_LEVEL_INFO <= CBOX_LOG_COMPILE_LEVEL) cbox_log_full_at(cbox_log_instance, CBOX_LOG_LEVEL_INFO, NULL, fmt, ##__VA_ARGS__); } while(0)
+#define LOGF(level, fmt, ...)           do { static cbox_log_site_t _cbox_log_site = CBOX_LOG_SITE_INITIALIZER; \
+                                             if ((level) <= CBOX_LOG_COMPILE_LEVEL && __builtin_expect(cbox_log_enabled(cbox_log_instance, &_cbox_log_site, level), 0)) \
+                                                 cbox_log_full_at(cbox_log_instance, level, &_cbox_log_site, fmt, ##__VA_ARGS__); } while(0)
+
+/*
+ * at most burst messages every interval_ms, then "suppressed N messages" before the next one
+ */
+#define LOGF_RATELIMIT(level, interval_ms, burst, fmt, ...) \
+    do { static cbox_log_site_t _cbox_log_site = CBOX_LOG_SITE_INITIALIZER; static cbox_log_limit_t _cbox_log_limit = CBOX_LOG_LIMIT_INITIALIZER; \
+         uint32_t _cbox_log_suppressed = 0; \
+         if ((level) <= CBOX_LOG_COMPILE_LEVEL && __builtin_expect(cbox_log_enabled(cbox_log_instance, &_cbox_log_site, level), 0) && \
+             cbox_log_ratelimit(&_cbox_log_limit, interval_ms, burst, &_cbox_log_suppressed)) { \
+             if (_cbox_log_suppressed) \
+                 cbox_log_full_at(cbox_log_instance, level, &_cbox_log_site, "suppressed %u messages", _cbox_log_suppressed); \
+             cbox_log_full_at(cbox_log_instance, level, &_cbox_log_site, fmt, ##__VA_ARGS__); } } while(0)
+
+/*
+ * one in n messages, the others are dropped before their arguments are evaluated
+ */
+#define LOGF_SAMPLE(level, n, fmt, ...) \
+    do { static cbox_log_site_t _cbox_log_site = CBOX_LOG_SITE_INITIALIZER; static uint32_t _cbox_log_sampled = 0; \
+         if ((level) <= CBOX_LOG_COMPILE_LEVEL && __builtin_expect(cbox_log_enabled(cbox_log_instance, &_cbox_log_site, level), 0) && \
+             __atomic_fetch_add(&_cbox_log_sampled, 1, __ATOMIC_RELAXED) % (uint32_t)(n) == 0) \
+             cbox_log_full_at(cbox_log_instance, level, &_cbox_log_site, fmt, ##__VA_ARGS__); } while(0)
 
 #define LOGD(fmt, ...)                  LOGF(CBOX_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
 #define LOGI(fmt, ...)                  LOGF(CBOX_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
@@ -68,6 +333,20 @@ void cbox_log_dump_with_tag(cbox_log_t *log, const char *tag, const void *buf, u
 #define LOGW(fmt, ...)                  LOGF(CBOX_LOG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
 #define LOGE(fmt, ...)                  LOGF(CBOX_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
 
+#define LOGD_RATELIMIT(i, b, fmt, ...)  LOGF_RATELIMIT(CBOX_LOG_LEVEL_DEBUG, i, b, fmt, ##__VA_ARGS__)
+#define LOGI_RATELIMIT(i, b, fmt, ...)  LOGF_RATELIMIT(CBOX_LOG_LEVEL_INFO, i, b, fmt, ##__VA_ARGS__)
+#define LOGN_RATELIMIT(i, b, fmt, ...)  LOGF_RATELIMIT(CBOX_LOG_LEVEL_NOTICE, i, b, fmt, ##__VA_ARGS__)
+#define LOGW_RATELIMIT(i, b, fmt, ...)  LOGF_RATELIMIT(CBOX_LOG_LEVEL_WARNING, i, b, fmt, ##__VA_ARGS__)
+#define LOGE_RATELIMIT(i, b, fmt, ...)  LOGF_RATELIMIT(CBOX_LOG_LEVEL_ERROR, i, b, fmt, ##__VA_ARGS__)
+
+#define LOGD_SAMPLE(n, fmt, ...)        LOGF_SAMPLE(CBOX_LOG_LEVEL_DEBUG, n, fmt, ##__VA_ARGS__)
+#define LOGI_SAMPLE(n, fmt, ...)        LOGF_SAMPLE(CBOX_LOG_LEVEL_INFO, n, fmt, ##__VA_ARGS__)
+#define LOGN_SAMPLE(n, fmt, ...)        LOGF_SAMPLE(CBOX_LOG_LEVEL_NOTICE, n, fmt, ##__VA_ARGS__)
+#define LOGW_SAMPLE(n, fmt, ...)        LOGF_SAMPLE(CBOX_LOG_LEVEL_WARNING, n, fmt, ##__VA_ARGS__)
+#define LOGE_SAMPLE(n, fmt, ...)        LOGF_SAMPLE(CBOX_LOG_LEVEL_ERROR, n, fmt, ##__VA_ARGS__)
+
+#define LOGKV(level, ctx, msg, ...)     do { if ((level) <= CBOX_LOG_COMPILE_LEVEL) cbox_log_kv(cbox_log_instance, level, ctx, msg, ##__VA_ARGS__, CBOX_KV_END); } while(0)
+
 #define LOGM_WITH_RETURN(ret, fmt, ...)         do { LOGM(fmt, ##__VA_ARGS__); return ret; } while(0)
 
 #define LOGD_WITH_RETURN(ret, fmt, ...)         do { LOGD(fmt, ##__VA_ARGS__); return ret; } while(0)
@@ -84,7 +363,7 @@ void cbox_log_dump_with_tag(cbox_log_t *log, const char *tag, const void *buf, u
 
 #define LOG_HEX_DUMP(x, y)                      do { cbox_log_dump(cbox_log_instance, x, y); } while(0)
 
-#define LOG_HEX_DUMP_WITH_TAG(x, y, z)          do { cbox_log_set_format(cbox_log_instance, 1, "%s: ", __FUNCTION__); cbox_log_set_format(cbox_log_instance, 0, " (%s:%d)", __FILENAME__, __LINE__); cbox_log_dump_with_tag(cbox_log_instance, x, y, z); } while(0)
+#define LOG_HEX_DUMP_WITH_TAG(x, y, z)          do { LOGF(CBOX_LOG_LEVEL_DEBUG, "%s: %d(bytes)", x, z); cbox_log_dump(cbox_log_instance, y, z); } while(0)
 #define LOG_EXP_CHECK(exp, ok, fmt, ...)        do { typeof(exp) ret; ret = (exp); if (ret != ok) { cbox_log_set_result(cbox_log_instance, ret); LOGW(fmt, ##__VA_ARGS__); } } while(0)
 #define LOG_EXP_VERIFY(exp, ok)                 do { typeof(exp) ret; ret = (exp); if (ret != ok) { LOGW("%s failure [errno:%d]", #exp, ret); } } while(0)
 
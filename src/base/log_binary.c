@@ -0,0 +1,907 @@
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "macros.h"
+
+/*
+ * file layout, all integers are in host byte order:
+ *   header: "CBOXBLOG" u32 version, u16 name length, name
+ *   format: 'F' u32 id, u8 eager, u32 length, format string
+ *   record: 'D' u32 length, u8 level, u8 style, u32 format id, i32 result, i64 sec, i32 usec, i64 tid,
+ *           prefix, suffix, arguments
+ * strings are u32 length and bytes, integers are i64, doubles are f64 and pointers are u64.
+ * a format is written once per file before its first record
+ */
+#define CBOX_LOG_BINARY_MAGIC "CBOXBLOG"
+#define CBOX_LOG_BINARY_VERSION (1)
+#define CBOX_LOG_BINARY_BUFFER_SIZE (64 * 1024)
+#define CBOX_LOG_BINARY_CACHE_SIZE (256)   //!< per thread format cache, power of 2
+#define CBOX_LOG_BINARY_MAX_ARGS (64)
+
+#define CBOX_LOG_BINARY_PRECISION_NONE (-1)
+#define CBOX_LOG_BINARY_PRECISION_STAR (-2)    //!< the int argument before the value
+
+#define CBOX_LOG_BINARY_RECORD_FORMAT 'F'
+#define CBOX_LOG_BINARY_RECORD_DATA 'D'
+
+#define CBOX_LOG_BINARY_STYLE_FULL (2)     //!< CBOX_LOG_STYLE_FULL of log.c, with timestamp
+
+typedef enum {
+    CBOX_LOG_ARG_NONE = 0,      //!< "%%"
+    CBOX_LOG_ARG_INT,
+    CBOX_LOG_ARG_LONG,
+    CBOX_LOG_ARG_LLONG,
+    CBOX_LOG_ARG_INTMAX,
+    CBOX_LOG_ARG_SIZE,
+    CBOX_LOG_ARG_PTRDIFF,
+    CBOX_LOG_ARG_DOUBLE,
+    CBOX_LOG_ARG_LDOUBLE,
+    CBOX_LOG_ARG_STRING,
+    CBOX_LOG_ARG_POINTER,
+    CBOX_LOG_ARG_INVALID        //!< e.g., "%n", "%m", "%ls" or positional arguments
+} cbox_log_arg_t;
+
+typedef struct
+{
+    const char *start;  //!< the '%'
+    const char *end;    //!< after the conversion character
+    int stars;          //!< '*' width and precision, passed as int before the value
+    int precision;      //!< CBOX_LOG_BINARY_PRECISION_NONE, _STAR or the digits after '.'
+    int kind;
+} cbox_log_spec_t;
+
+typedef struct
+{
+    uint8_t kind;
+    int precision;      //!< of a string, which may not be NUL-terminated within it
+} cbox_log_format_arg_t;
+
+/*
+ * parsed once per format string, shared by every thread and never changed
+ */
+typedef struct
+{
+    const char *fmt;
+    uint32_t id;
+    int eager;          //!< formatted by the caller and stored as one string
+    int count;
+    cbox_log_format_arg_t args[];
+} cbox_log_format_t;
+
+typedef struct
+{
+    const char *fmt;
+    cbox_log_format_t *format;
+    unsigned int generation;
+} cbox_log_format_cache_t;
+
+typedef struct cbox_log_binary
+{
+    int fd;
+    char *buffer;
+    size_t used;
+    uint8_t *defined;   //!< formats written to this file, by id
+    size_t defined_size;
+} cbox_log_binary_t;
+
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t size;
+} cbox_log_string_t;
+
+static pthread_mutex_t g_format_lock = PTHREAD_MUTEX_INITIALIZER;
+static cbox_log_format_t **g_formats = NULL;      //!< by id
+static uint32_t g_format_num = 0;
+static uint32_t g_format_size = 0;
+static uint32_t *g_format_slots = NULL;           //!< pointer hash to id + 1
+static uint32_t g_format_slot_mask = 0;
+static unsigned int g_format_generation = 1;
+
+static __thread cbox_log_format_cache_t t_format_cache[CBOX_LOG_BINARY_CACHE_SIZE];
+static __thread cbox_log_string_t t_record;
+static pthread_key_t g_record_key;
+static pthread_once_t g_record_once = PTHREAD_ONCE_INIT;
+
+static void cbox_log_record_key_create(void)
+{
+    pthread_key_create(&g_record_key, free);
+}
+
+static const char *cbox_log_next_spec(const char *p, cbox_log_spec_t *spec)
+{
+    while (*p && *p != '%') p++;
+    if (*p == '\0')
+        return NULL;
+
+    const char *q = p + 1;
+    int length = 0;
+
+    spec->start = p;
+    spec->stars = 0;
+    spec->precision = CBOX_LOG_BINARY_PRECISION_NONE;
+    spec->kind = CBOX_LOG_ARG_INVALID;
+
+    while (*q == '-' || *q == '+' || *q == ' ' || *q == '#' || *q == '0' || *q == '\'') q++;
+
+    if (*q == '*') {
+        spec->stars ++;
+        q++;
+    } else {
+        while (*q >= '0' && *q <= '9') q++;
+    }
+
+    if (*q == '.') {
+        q++;
+        if (*q == '*') {
+            spec->stars ++;
+            spec->precision = CBOX_LOG_BINARY_PRECISION_STAR;
+            q++;
+        } else {
+            spec->precision = 0;
+            while (*q >= '0' && *q <= '9') {
+                if (spec->precision < INT32_MAX / 10)
+                    spec->precision = spec->precision * 10 + (*q - '0');
+                q++;
+            }
+        }
+    }
+
+    if (q[0] == 'h' && q[1] == 'h') { length = 'H'; q += 2; }
+    else if (q[0] == 'l' && q[1] == 'l') { length = 'q'; q += 2; }
+    else if (*q == 'h' || *q == 'l' || *q == 'j' || *q == 'z' || *q == 't' || *q == 'L' || *q == 'q') length = *q++;
+
+    switch (*q) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            switch (length) {
+                case 'l': spec->kind = CBOX_LOG_ARG_LONG; break;
+                case 'q': case 'L': spec->kind = CBOX_LOG_ARG_LLONG; break;
+                case 'j': spec->kind = CBOX_LOG_ARG_INTMAX; break;
+                case 'z': spec->kind = CBOX_LOG_ARG_SIZE; break;
+                case 't': spec->kind = CBOX_LOG_ARG_PTRDIFF; break;
+                default: spec->kind = CBOX_LOG_ARG_INT; break;
+            }
+            break;
+        case 'c':
+            if (length == 0) spec->kind = CBOX_LOG_ARG_INT;
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            spec->kind = length == 'L' ? CBOX_LOG_ARG_LDOUBLE : CBOX_LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            if (length == 0) spec->kind = CBOX_LOG_ARG_STRING;
+            break;
+        case 'p':
+            spec->kind = CBOX_LOG_ARG_POINTER;
+            break;
+        case '%':
+            if (q == p + 1) spec->kind = CBOX_LOG_ARG_NONE;
+            break;
+        default:
+            break;
+    }
+
+    spec->end = *q ? q + 1 : q;
+    return p;
+}
+
+static cbox_log_format_t *cbox_log_format_parse(const char *fmt)
+{
+    cbox_log_format_arg_t args[CBOX_LOG_BINARY_MAX_ARGS];
+    cbox_log_spec_t spec;
+    const char *p = fmt;
+    int i = 0, count = 0, eager = 0;
+
+    while (!eager && (p = cbox_log_next_spec(p, &spec)) != NULL) {
+        p = spec.end;
+        if (spec.kind == CBOX_LOG_ARG_NONE)
+            continue;
+
+        if (spec.kind == CBOX_LOG_ARG_INVALID || count + spec.stars + 1 > CBOX_LOG_BINARY_MAX_ARGS) {
+            eager = 1;
+            break;
+        }
+
+        for (i = 0; i < spec.stars; ++i) {
+            args[count].kind = CBOX_LOG_ARG_INT;
+            args[count++].precision = CBOX_LOG_BINARY_PRECISION_NONE;
+        }
+        args[count].kind = spec.kind;
+        args[count++].precision = spec.precision;
+    }
+
+    if (eager) {
+        count = 1;
+        args[0].kind = CBOX_LOG_ARG_STRING;
+        args[0].precision = CBOX_LOG_BINARY_PRECISION_NONE;
+    }
+
+    cbox_log_format_t *format = (cbox_log_format_t *)malloc(sizeof(cbox_log_format_t) + count * sizeof(args[0]));
+    if (format == NULL)
+        return NULL;
+
+    format->fmt = fmt;
+    format->eager = eager;
+    format->count = count;
+    memcpy(format->args, args, count * sizeof(args[0]));
+
+    return format;
+}
+
+static inline uint32_t cbox_log_format_hash(const char *fmt)
+{
+    uint64_t h = (uint64_t)(uintptr_t)fmt * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h >> 32);
+}
+
+static int cbox_log_format_rehash(uint32_t size)
+{
+    uint32_t i = 0, mask = size - 1;
+    uint32_t *slots = (uint32_t *)calloc(size, sizeof(uint32_t));
+    if (slots == NULL)
+        return -1;
+
+    for (i = 0; i < g_format_num; ++i) {
+        uint32_t pos = cbox_log_format_hash(g_formats[i]->fmt) & mask;
+        while (slots[pos]) pos = (pos + 1) & mask;
+        slots[pos] = i + 1;
+    }
+
+    CBOX_SAFETY_FREE(g_format_slots);
+    g_format_slots = slots;
+    g_format_slot_mask = mask;
+    return 0;
+}
+
+/*
+ * must be called with g_format_lock locked
+ */
+static cbox_log_format_t *cbox_log_format_register(const char *fmt)
+{
+    if (g_format_slots) {
+        uint32_t pos = cbox_log_format_hash(fmt) & g_format_slot_mask;
+        while (g_format_slots[pos]) {
+            cbox_log_format_t *format = g_formats[g_format_slots[pos] - 1];
+            if (format->fmt == fmt)
+                return format;
+            pos = (pos + 1) & g_format_slot_mask;
+        }
+    }
+
+    if (g_format_num == g_format_size) {
+        uint32_t size = g_format_size ? g_format_size * 2 : 64;
+        cbox_log_format_t **formats = (cbox_log_format_t **)realloc(g_formats, size * sizeof(cbox_log_format_t *));
+        if (formats == NULL)
+            return NULL;
+        g_formats = formats;
+        g_format_size = size;
+    }
+
+    if ((g_format_num + 1) * 2 > g_format_slot_mask + 1 && cbox_log_format_rehash(g_format_size * 2) != 0)
+        return NULL;
+
+    cbox_log_format_t *format = cbox_log_format_parse(fmt);
+    if (format == NULL)
+        return NULL;
+
+    format->id = g_format_num;
+    g_formats[g_format_num++] = format;
+
+    uint32_t pos = cbox_log_format_hash(fmt) & g_format_slot_mask;
+    while (g_format_slots[pos]) pos = (pos + 1) & g_format_slot_mask;
+    g_format_slots[pos] = format->id + 1;
+
+    return format;
+}
+
+static cbox_log_format_t *cbox_log_format_lookup(const char *fmt)
+{
+    cbox_log_format_cache_t *cache = &t_format_cache[cbox_log_format_hash(fmt) & (CBOX_LOG_BINARY_CACHE_SIZE - 1)];
+    unsigned int generation = __atomic_load_n(&g_format_generation, __ATOMIC_ACQUIRE);
+
+    if (cache->fmt == fmt && cache->generation == generation)
+        return cache->format;
+
+    pthread_mutex_lock(&g_format_lock);
+    cbox_log_format_t *format = cbox_log_format_register(fmt);
+    generation = g_format_generation;
+    pthread_mutex_unlock(&g_format_lock);
+
+    if (format) {
+        cache->fmt = fmt;
+        cache->format = format;
+        cache->generation = generation;
+    }
+
+    return format;
+}
+
+/*
+ * frees the formats, the thread caches are invalidated by the generation
+ */
+void cbox_log_binary_cleanup(void)
+{
+    uint32_t i = 0;
+
+    pthread_mutex_lock(&g_format_lock);
+    for (i = 0; i < g_format_num; ++i)
+        CBOX_SAFETY_FREE(g_formats[i]);
+    CBOX_SAFETY_FREE(g_formats);
+    CBOX_SAFETY_FREE(g_format_slots);
+    g_format_num = g_format_size = g_format_slot_mask = 0;
+    __atomic_add_fetch(&g_format_generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_format_lock);
+}
+
+static int cbox_log_string_reserve(cbox_log_string_t *str, size_t len)
+{
+    if (str->len + len <= str->size)
+        return 0;
+
+    size_t size = str->size ? str->size : 256;
+    while (size < str->len + len) size *= 2;
+
+    char *data = (char *)realloc(str->data, size);
+    if (data == NULL)
+        return -1;
+
+    str->data = data;
+    str->size = size;
+    return 0;
+}
+
+static inline void cbox_log_string_put(cbox_log_string_t *str, const void *data, size_t len)
+{
+    memcpy(str->data + str->len, data, len);
+    str->len += len;
+}
+
+static int cbox_log_string_append(cbox_log_string_t *str, const void *data, size_t len)
+{
+    if (cbox_log_string_reserve(str, len) != 0)
+        return -1;
+
+    cbox_log_string_put(str, data, len);
+    return 0;
+}
+
+/*
+ * precision: at most so many bytes are read like printf("%.*s"), negative means NUL-terminated
+ */
+static int cbox_log_string_add_text(cbox_log_string_t *str, const char *text, int precision)
+{
+    if (text == NULL) text = "(null)";
+    uint32_t len = precision < 0 ? strlen(text) : strnlen(text, precision);
+
+    if (cbox_log_string_reserve(str, sizeof(len) + len) != 0)
+        return -1;
+
+    cbox_log_string_put(str, &len, sizeof(len));
+    cbox_log_string_put(str, text, len);
+    return 0;
+}
+
+static int cbox_log_binary_write_out(cbox_log_binary_t *binary, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(binary->fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int cbox_log_binary_flush(cbox_log_binary_t *binary)
+{
+    int ret = cbox_log_binary_write_out(binary, binary->buffer, binary->used);
+    binary->used = 0;
+    return ret;
+}
+
+static int cbox_log_binary_append(cbox_log_binary_t *binary, const void *data, size_t len)
+{
+    if (binary->used + len > CBOX_LOG_BINARY_BUFFER_SIZE && cbox_log_binary_flush(binary) != 0)
+        return -1;
+
+    if (len > CBOX_LOG_BINARY_BUFFER_SIZE)
+        return cbox_log_binary_write_out(binary, (const char *)data, len);
+
+    memcpy(binary->buffer + binary->used, data, len);
+    binary->used += len;
+    return 0;
+}
+
+static int cbox_log_binary_define(cbox_log_binary_t *binary, const cbox_log_format_t *format)
+{
+    if (format->id < binary->defined_size && binary->defined[format->id])
+        return 0;
+
+    if (format->id >= binary->defined_size) {
+        size_t size = binary->defined_size ? binary->defined_size : 64;
+        while (size <= format->id) size *= 2;
+
+        uint8_t *defined = (uint8_t *)realloc(binary->defined, size);
+        if (defined == NULL)
+            return -1;
+
+        memset(defined + binary->defined_size, 0, size - binary->defined_size);
+        binary->defined = defined;
+        binary->defined_size = size;
+    }
+
+    uint8_t type = CBOX_LOG_BINARY_RECORD_FORMAT, eager = format->eager;
+    uint32_t len = strlen(format->fmt);
+    char head[sizeof(type) + sizeof(format->id) + sizeof(eager) + sizeof(len)], *p = head;
+
+    memcpy(p, &type, sizeof(type)); p += sizeof(type);
+    memcpy(p, &format->id, sizeof(format->id)); p += sizeof(format->id);
+    memcpy(p, &eager, sizeof(eager)); p += sizeof(eager);
+    memcpy(p, &len, sizeof(len));
+
+    if (cbox_log_binary_append(binary, head, sizeof(head)) != 0 || cbox_log_binary_append(binary, format->fmt, len) != 0)
+        return -1;
+
+    binary->defined[format->id] = 1;
+    return 0;
+}
+
+cbox_log_binary_t *cbox_log_binary_open(const char *path, const char *name)
+{
+    cbox_log_binary_t *binary = (cbox_log_binary_t *)calloc(1, sizeof(cbox_log_binary_t));
+    if (binary == NULL)
+        return NULL;
+
+    binary->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    binary->buffer = (char *)malloc(CBOX_LOG_BINARY_BUFFER_SIZE);
+    if (binary->fd < 0 || binary->buffer == NULL)
+        goto CLEANUP;
+
+    uint32_t version = CBOX_LOG_BINARY_VERSION;
+    uint16_t len = strlen(name);
+
+    if (cbox_log_binary_append(binary, CBOX_LOG_BINARY_MAGIC, strlen(CBOX_LOG_BINARY_MAGIC)) != 0 ||
+        cbox_log_binary_append(binary, &version, sizeof(version)) != 0 ||
+        cbox_log_binary_append(binary, &len, sizeof(len)) != 0 ||
+        cbox_log_binary_append(binary, name, len) != 0 ||
+        cbox_log_binary_flush(binary) != 0)
+        goto CLEANUP;
+
+    return binary;
+
+CLEANUP:
+    if (binary->fd >= 0) close(binary->fd);
+    CBOX_SAFETY_FREE(binary->buffer);
+    CBOX_SAFETY_FREE(binary);
+    return NULL;
+}
+
+void cbox_log_binary_close(cbox_log_binary_t *binary)
+{
+    if (binary == NULL)
+        return;
+
+    cbox_log_binary_flush(binary);
+    close(binary->fd);
+    CBOX_SAFETY_FREE(binary->defined);
+    CBOX_SAFETY_FREE(binary->buffer);
+    CBOX_SAFETY_FREE(binary);
+}
+
+/*
+ *@brief encode the message without formatting it, the format string must stay valid
+ *       as long as the process, which is true for the literals of the LOG* macros
+ *@return 0: succeed, -1: failed
+ */
+int cbox_log_binary_write(cbox_log_binary_t *binary, int level, int style, const struct timeval *tv, long tid,
+                          int result, const char *prefix, const char *suffix, const char *fmt, va_list ap)
+{
+    cbox_log_string_t *record = &t_record;
+    char *data = record->data;
+    int i = 0;
+
+    cbox_log_format_t *format = cbox_log_format_lookup(fmt);
+    if (format == NULL)
+        return -1;
+
+    uint8_t type = CBOX_LOG_BINARY_RECORD_DATA, level8 = level, style8 = style;
+    uint32_t len = 0;
+    int32_t result32 = result, usec = tv->tv_usec;
+    int64_t sec = tv->tv_sec, tid64 = tid;
+
+    record->len = 0;
+    if (cbox_log_string_reserve(record, 64) != 0)
+        return -1;
+
+    cbox_log_string_put(record, &type, sizeof(type));
+    cbox_log_string_put(record, &len, sizeof(len));
+    cbox_log_string_put(record, &level8, sizeof(level8));
+    cbox_log_string_put(record, &style8, sizeof(style8));
+    cbox_log_string_put(record, &format->id, sizeof(format->id));
+    cbox_log_string_put(record, &result32, sizeof(result32));
+    cbox_log_string_put(record, &sec, sizeof(sec));
+    cbox_log_string_put(record, &usec, sizeof(usec));
+    cbox_log_string_put(record, &tid64, sizeof(tid64));
+
+    if (cbox_log_string_add_text(record, prefix, -1) != 0 || cbox_log_string_add_text(record, suffix, -1) != 0)
+        return -1;
+
+    va_list args;
+    va_copy(args, ap);
+
+    if (format->eager) {
+        char stack[256], *msg = stack;
+        int n = vsnprintf(stack, sizeof(stack), fmt, args);
+        if (n >= (int)sizeof(stack) && (msg = (char *)malloc(n + 1)) != NULL) {
+            va_end(args);
+            va_copy(args, ap);
+            vsnprintf(msg, n + 1, fmt, args);
+        }
+        int ret = n < 0 || msg == NULL ? -1 : cbox_log_string_add_text(record, msg, -1);
+        if (msg != stack) CBOX_SAFETY_FREE(msg);
+        va_end(args);
+        if (ret != 0)
+            return -1;
+    } else {
+        int64_t last = 0;
+
+        for (i = 0; i < format->count; ++i) {
+            int64_t v = 0;
+            int precision = format->args[i].precision;
+            double d = 0;
+            long double ld = 0;
+
+            if (cbox_log_string_reserve(record, sizeof(ld)) != 0)
+                break;
+
+            switch (format->args[i].kind) {
+                case CBOX_LOG_ARG_INT: v = va_arg(args, int); break;
+                case CBOX_LOG_ARG_LONG: v = va_arg(args, long); break;
+                case CBOX_LOG_ARG_LLONG: v = va_arg(args, long long); break;
+                case CBOX_LOG_ARG_INTMAX: v = va_arg(args, intmax_t); break;
+                case CBOX_LOG_ARG_SIZE: v = va_arg(args, size_t); break;
+                case CBOX_LOG_ARG_PTRDIFF: v = va_arg(args, ptrdiff_t); break;
+                case CBOX_LOG_ARG_POINTER: v = (int64_t)(uintptr_t)va_arg(args, void *); break;
+                case CBOX_LOG_ARG_DOUBLE:
+                    d = va_arg(args, double);
+                    cbox_log_string_put(record, &d, sizeof(d));
+                    continue;
+                case CBOX_LOG_ARG_LDOUBLE:
+                    ld = va_arg(args, long double);
+                    cbox_log_string_put(record, &ld, sizeof(ld));
+                    continue;
+                case CBOX_LOG_ARG_STRING:
+                    if (precision == CBOX_LOG_BINARY_PRECISION_STAR)
+                        precision = last < 0 ? CBOX_LOG_BINARY_PRECISION_NONE : (int)last;
+                    if (cbox_log_string_add_text(record, va_arg(args, const char *), precision) != 0)
+                        goto CLEANUP;
+                    continue;
+                default:
+                    break;
+            }
+
+            cbox_log_string_put(record, &v, sizeof(v));
+            last = v;
+        }
+        va_end(args);
+
+        if (i < format->count)
+            return -1;
+    }
+
+    // frees the record buffer when the thread exits
+    if (record->data != data) {
+        pthread_once(&g_record_once, cbox_log_record_key_create);
+        pthread_setspecific(g_record_key, record->data);
+    }
+
+    len = record->len - sizeof(type) - sizeof(len);
+    memcpy(record->data + sizeof(type), &len, sizeof(len));
+
+    if (cbox_log_binary_define(binary, format) != 0 || cbox_log_binary_append(binary, record->data, record->len) != 0)
+        return -1;
+
+    if (level <= CBOX_LOG_LEVEL_ERROR)
+        return cbox_log_binary_flush(binary);
+
+    return 0;
+
+CLEANUP:
+    va_end(args);
+    return -1;
+}
+
+/*
+ * bounds checked reader of a record
+ */
+typedef struct
+{
+    const char *data;
+    size_t len;
+    int error;
+} cbox_log_reader_t;
+
+static void cbox_log_read(cbox_log_reader_t *reader, void *out, size_t len)
+{
+    if (reader->error || reader->len < len) {
+        reader->error = 1;
+        memset(out, 0, len);
+        return;
+    }
+
+    memcpy(out, reader->data, len);
+    reader->data += len;
+    reader->len -= len;
+}
+
+static const char *cbox_log_read_text(cbox_log_reader_t *reader, uint32_t *len)
+{
+    cbox_log_read(reader, len, sizeof(*len));
+    if (reader->error || reader->len < *len) {
+        reader->error = 1;
+        *len = 0;
+        return "";
+    }
+
+    const char *text = reader->data;
+    reader->data += *len;
+    reader->len -= *len;
+    return text;
+}
+
+static int cbox_log_string_printf(cbox_log_string_t *str, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(str->data + str->len, str->size - str->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return -1;
+
+    if ((size_t)n >= str->size - str->len) {
+        if (cbox_log_string_reserve(str, n + 1) != 0)
+            return -1;
+
+        va_start(ap, fmt);
+        vsnprintf(str->data + str->len, str->size - str->len, fmt, ap);
+        va_end(ap);
+    }
+
+    str->len += n;
+    return 0;
+}
+
+/*
+ * formats one conversion, spec is a copy of it and stars are its width and precision
+ */
+#define CBOX_LOG_PRINT_SPEC(str, spec, stars, s, v) \
+    ((stars) == 0 ? cbox_log_string_printf(str, spec, v) : \
+     (stars) == 1 ? cbox_log_string_printf(str, spec, (int)s[0], v) : \
+                    cbox_log_string_printf(str, spec, (int)s[0], (int)s[1], v))
+
+static void cbox_log_decode_message(cbox_log_string_t *line, const char *fmt, cbox_log_reader_t *reader)
+{
+    cbox_log_spec_t spec;
+    const char *p = fmt, *start = NULL;
+    char conv[64];
+    int64_t s[2] = { 0, 0 };
+    int i = 0;
+
+    while ((start = cbox_log_next_spec(p, &spec)) != NULL) {
+        cbox_log_string_append(line, p, start - p);
+        p = spec.end;
+
+        if (spec.kind == CBOX_LOG_ARG_NONE) {
+            cbox_log_string_append(line, "%", 1);
+            continue;
+        }
+
+        size_t len = spec.end - spec.start;
+        if (len >= sizeof(conv)) len = sizeof(conv) - 1;
+        memcpy(conv, spec.start, len);
+        conv[len] = '\0';
+
+        for (i = 0; i < spec.stars; ++i)
+            cbox_log_read(reader, &s[i], sizeof(s[i]));
+
+        int64_t v = 0;
+        double d = 0;
+        long double ld = 0;
+        uint32_t n = 0;
+        const char *text = NULL;
+        char *copy = NULL;
+
+        switch (spec.kind) {
+            case CBOX_LOG_ARG_DOUBLE:
+                cbox_log_read(reader, &d, sizeof(d));
+                CBOX_LOG_PRINT_SPEC(line, conv, spec.stars, s, d);
+                break;
+            case CBOX_LOG_ARG_LDOUBLE:
+                cbox_log_read(reader, &ld, sizeof(ld));
+                CBOX_LOG_PRINT_SPEC(line, conv, spec.stars, s, ld);
+                break;
+            case CBOX_LOG_ARG_STRING:
+                text = cbox_log_read_text(reader, &n);
+                if ((copy = strndup(text, n)) != NULL)
+                    CBOX_LOG_PRINT_SPEC(line, conv, spec.stars, s, copy);
+                CBOX_SAFETY_FREE(copy);
+                break;
+            case CBOX_LOG_ARG_INVALID:
+                cbox_log_string_append(line, conv, len);
+                break;
+            default:
+                cbox_log_read(reader, &v, sizeof(v));
+                switch (spec.kind) {
+                    case CBOX_LOG_ARG_INT: CBOX_LOG_PRINT_SPEC(line, conv, spec.stars, s, (int)v); break;
+                    case CBOX_LOG_ARG_LONG: CBOX_LOG_PRINT_SPEC(line, conv, spec.stars, s, (long)v); break;
+                    case CBOX_LOG_ARG_LLONG: CBOX_LOG_PRINT_SPEC(line, conv, spec.stars, s, (long long)v); break;
+                    case CBOX_LOG_ARG_INTMAX: CBOX_LOG_PRINT_SPEC(line, conv, spec.stars, s, (intmax_t)v); break;
+                    case CBOX_LOG_ARG_SIZE: CBOX_LOG_PRINT_SPEC(line, conv, spec.stars, s, (size_t)v); break;
+                    case CBOX_LOG_ARG_PTRDIFF: CBOX_LOG_PRINT_SPEC(line, conv, spec.stars, s, (ptrdiff_t)v); break;
+                    case CBOX_LOG_ARG_POINTER: CBOX_LOG_PRINT_SPEC(line, conv, spec.stars, s, (void *)(uintptr_t)v); break;
+                    default: break;
+                }
+                break;
+        }
+    }
+
+    cbox_log_string_append(line, p, strlen(p));
+}
+
+extern int cbox_log_recorder_decode(const char *path, cbox_log_function_t cb, void *user);
+
+int cbox_log_decode(const char *path, cbox_log_function_t cb, void *user)
+{
+    static const char *categories[] = { "E", "A", "C", "E", "W", "N", "I", "D" };
+    char magic[8], name[256] = { 0 };
+    uint32_t version = 0, id = 0, len = 0, size = 0, i = 0;
+    uint16_t name_len = 0;
+    uint8_t type = 0, eager = 0;
+    char **formats = NULL;
+    uint8_t *eagers = NULL;
+    char *data = NULL;
+    cbox_log_string_t line = { NULL, 0, 0 };
+    int ret = -1;
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+
+    if (fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, "CBOXFREC", sizeof(magic)) == 0) {
+        fclose(fp);
+        return cbox_log_recorder_decode(path, cb, user);
+    }
+
+    if (fseek(fp, 0, SEEK_SET) != 0 ||
+        fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, CBOX_LOG_BINARY_MAGIC, sizeof(magic)) != 0 ||
+        fread(&version, sizeof(version), 1, fp) != 1 || version != CBOX_LOG_BINARY_VERSION ||
+        fread(&name_len, sizeof(name_len), 1, fp) != 1 || name_len >= sizeof(name) ||
+        fread(name, 1, name_len, fp) != name_len)
+        goto CLEANUP;
+
+    // a record cut by a crash ends the file
+    while (fread(&type, sizeof(type), 1, fp) == 1) {
+        if (type == CBOX_LOG_BINARY_RECORD_FORMAT) {
+            if (fread(&id, sizeof(id), 1, fp) != 1 || fread(&eager, sizeof(eager), 1, fp) != 1 ||
+                fread(&len, sizeof(len), 1, fp) != 1)
+                break;
+
+            if (id >= size) {
+                uint32_t new_size = size ? size : 64;
+                while (new_size <= id) new_size *= 2;
+
+                char **new_formats = (char **)realloc(formats, new_size * sizeof(char *));
+                if (new_formats == NULL) goto CLEANUP;
+                formats = new_formats;
+
+                uint8_t *new_eagers = (uint8_t *)realloc(eagers, new_size);
+                if (new_eagers == NULL) goto CLEANUP;
+                eagers = new_eagers;
+
+                memset(formats + size, 0, (new_size - size) * sizeof(char *));
+                size = new_size;
+            }
+
+            CBOX_SAFETY_FREE(formats[id]);
+            if ((formats[id] = (char *)malloc(len + 1)) == NULL)
+                goto CLEANUP;
+            if (fread(formats[id], 1, len, fp) != len)
+                break;
+            formats[id][len] = '\0';
+            eagers[id] = eager;
+            continue;
+        }
+
+        if (type != CBOX_LOG_BINARY_RECORD_DATA || fread(&len, sizeof(len), 1, fp) != 1)
+            break;
+
+        char *new_data = (char *)realloc(data, len ? len : 1);
+        if (new_data == NULL)
+            goto CLEANUP;
+        data = new_data;
+        if (fread(data, 1, len, fp) != len)
+            break;
+
+        cbox_log_reader_t reader = { data, len, 0 };
+        uint8_t level = 0, style = 0;
+        int32_t result = 0, usec = 0;
+        int64_t sec = 0, tid = 0;
+        uint32_t prefix_len = 0, suffix_len = 0;
+
+        cbox_log_read(&reader, &level, sizeof(level));
+        cbox_log_read(&reader, &style, sizeof(style));
+        cbox_log_read(&reader, &id, sizeof(id));
+        cbox_log_read(&reader, &result, sizeof(result));
+        cbox_log_read(&reader, &sec, sizeof(sec));
+        cbox_log_read(&reader, &usec, sizeof(usec));
+        cbox_log_read(&reader, &tid, sizeof(tid));
+        const char *prefix = cbox_log_read_text(&reader, &prefix_len);
+        const char *suffix = cbox_log_read_text(&reader, &suffix_len);
+
+        if (reader.error || id >= size || formats[id] == NULL || level > CBOX_LOG_LEVEL_DEBUG)
+            break;
+
+        line.len = 0;
+        if (cbox_log_string_reserve(&line, 256) != 0)
+            goto CLEANUP;
+
+        if (style == CBOX_LOG_BINARY_STYLE_FULL) {
+            struct tm tm;
+            char time_str[32];
+            time_t t = sec;
+            localtime_r(&t, &tm);
+            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm);
+            cbox_log_string_printf(&line, "[%s:%03d] %s %s [%lld]: ", time_str, (int)(usec / 1000), categories[level], name, (long long)tid);
+        } else {
+            cbox_log_string_printf(&line, "%s %s [%lld] ", categories[level], name, (long long)tid);
+        }
+
+        cbox_log_string_append(&line, prefix, prefix_len);
+        if (eagers[id]) {
+            const char *msg = cbox_log_read_text(&reader, &len);
+            cbox_log_string_append(&line, msg, len);
+        } else {
+            cbox_log_decode_message(&line, formats[id], &reader);
+        }
+        cbox_log_string_append(&line, suffix, suffix_len);
+        if (result != 0)
+            cbox_log_string_printf(&line, " [errno:%d]", result);
+
+        if (cbox_log_string_append(&line, "", 1) != 0)
+            goto CLEANUP;
+
+        (*cb)(level, line.data, user);
+    }
+
+    ret = 0;
+
+CLEANUP:
+    for (i = 0; i < size; ++i)
+        CBOX_SAFETY_FREE(formats[i]);
+    CBOX_SAFETY_FREE(formats);
+    CBOX_SAFETY_FREE(eagers);
+    CBOX_SAFETY_FREE(data);
+    CBOX_SAFETY_FREE(line.data);
+    fclose(fp);
+    return ret;
+}
@@ -0,0 +1,503 @@
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "macros.h"
+
+#define CBOX_LOG_FILE_MAX_PATH (4096)
+
+extern char **environ;
+
+typedef struct cbox_log_file_compress
+{
+    char *path;
+    struct cbox_log_file_compress *next;
+} cbox_log_file_compress_t;
+
+/*
+ * two buffers, the producers fill the front one while the flusher thread writes the back one,
+ * the file is rotated in the flusher thread too. the rotated files are compressed one by one
+ * in the compressor thread, which applies the retention after each, otherwise the flusher does
+ */
+typedef struct cbox_log_file
+{
+    cbox_log_file_option_t option;
+    char *path;
+    int fd;
+    size_t size;            //!< bytes in the current file
+    time_t rotate_time;     //!< when to rotate by time
+
+    char *front;
+    size_t front_used;
+    char *back;
+    size_t back_used;
+
+    uint64_t requested;     //!< flushes requested by cbox_log_file_flush()
+    uint64_t flushed;
+    int urgent;             //!< a message at flush_level is in the front buffer
+    int stop;
+    int refs;               //!< atomic
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;    //!< wakes the flusher
+    pthread_cond_t done;    //!< wakes the producers waiting for room and the flush callers
+
+    cbox_log_file_compress_t *compress_head;    //!< rotated files waiting for gzip
+    cbox_log_file_compress_t *compress_tail;
+    int compress_stop;
+    pthread_t compressor;
+    pthread_cond_t compress_cond;
+} cbox_log_file_t;
+
+static int cbox_log_file_write_fd(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int cbox_log_file_open_fd(cbox_log_file_t *file)
+{
+    struct stat st;
+
+    file->fd = open(file->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (file->fd < 0)
+        return -1;
+
+    file->size = fstat(file->fd, &st) == 0 ? (size_t)st.st_size : 0;
+    file->rotate_time = file->option.rotate_interval ? time(NULL) + file->option.rotate_interval : 0;
+    return 0;
+}
+
+static int cbox_log_file_name_compare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ *@return 1 if suffix is "YYYYmmdd-HHMMSS-NNN" or "YYYYmmdd-HHMMSS-NNN.gz", the one cbox_log_file_rotate() appends
+ */
+static int cbox_log_file_is_rotated(const char *suffix)
+{
+    static const char pattern[] = "dddddddd-dddddd-ddd";
+    size_t i = 0;
+
+    for (i = 0; i < sizeof(pattern) - 1; ++i) {
+        if (pattern[i] == 'd' ? !isdigit((unsigned char)suffix[i]) : suffix[i] != pattern[i])
+            return 0;
+    }
+
+    return suffix[i] == '\0' || strcmp(suffix + i, ".gz") == 0;
+}
+
+/*
+ * removes the oldest rotated files, their names are "<path>.YYYYmmdd-HHMMSS-NNN[.gz]"
+ * so they sort by time
+ */
+static void cbox_log_file_retain(const char *path, uint32_t max_files)
+{
+    char dir_buf[CBOX_LOG_FILE_MAX_PATH], base_buf[CBOX_LOG_FILE_MAX_PATH], name[CBOX_LOG_FILE_MAX_PATH];
+    char **names = NULL;
+    size_t count = 0, size = 0, i = 0;
+    struct dirent *entry = NULL;
+
+    if (max_files == 0)
+        return;
+
+    snprintf(dir_buf, sizeof(dir_buf), "%s", path);
+    snprintf(base_buf, sizeof(base_buf), "%s", path);
+    const char *dir = dirname(dir_buf), *base = basename(base_buf);
+    size_t base_len = strlen(base);
+
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return;
+
+    while ((entry = readdir(d)) != NULL) {
+        // the other files of the directory, e.g., the rotated ones of "<path>.xxx", are not ours
+        if (strncmp(entry->d_name, base, base_len) != 0 || entry->d_name[base_len] != '.' ||
+            !cbox_log_file_is_rotated(entry->d_name + base_len + 1))
+            continue;
+
+        if (count == size) {
+            size = size ? size * 2 : 16;
+            char **new_names = (char **)realloc(names, size * sizeof(char *));
+            if (new_names == NULL)
+                break;
+            names = new_names;
+        }
+
+        // a file being compressed is there with and without ".gz", count it once
+        if ((names[count] = strdup(entry->d_name)) == NULL)
+            continue;
+        size_t len = strlen(names[count]);
+        if (len > 3 && strcmp(names[count] + len - 3, ".gz") == 0)
+            names[count][len - 3] = '\0';
+        count ++;
+    }
+    closedir(d);
+
+    qsort(names, count, sizeof(char *), cbox_log_file_name_compare);
+    for (i = 0; i + 1 < count; ) {
+        if (strcmp(names[i], names[i + 1]) == 0) {
+            CBOX_SAFETY_FREE(names[i]);
+            memmove(names + i, names + i + 1, (--count - i) * sizeof(char *));
+        } else {
+            i++;
+        }
+    }
+
+    for (i = 0; count > max_files && i < count - max_files; ++i) {
+        snprintf(name, sizeof(name), "%s/%s", dir, names[i]);
+        unlink(name);
+        snprintf(name, sizeof(name), "%s/%s.gz", dir, names[i]);
+        unlink(name);
+    }
+
+    for (i = 0; i < count; ++i)
+        CBOX_SAFETY_FREE(names[i]);
+    CBOX_SAFETY_FREE(names);
+}
+
+static void cbox_log_file_gzip(const char *path)
+{
+    char *argv[] = { (char *)"gzip", (char *)"-f", (char *)path, NULL };
+    pid_t pid = 0;
+    int status = 0;
+
+    // a queued file may be removed by the retention after an earlier one, keep gzip quiet
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    if (posix_spawnp(&pid, "gzip", &actions, NULL, argv, environ) == 0)
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    posix_spawn_file_actions_destroy(&actions);
+}
+
+/*
+ * compresses the queued files in order and drains the queue before exiting
+ */
+static void *cbox_log_file_compress_func(void *arg)
+{
+    cbox_log_file_t *file = (cbox_log_file_t *)arg;
+
+    pthread_mutex_lock(&file->mutex);
+
+    for (;;) {
+        while (file->compress_head == NULL && !file->compress_stop)
+            pthread_cond_wait(&file->compress_cond, &file->mutex);
+
+        cbox_log_file_compress_t *compress = file->compress_head;
+        if (compress == NULL)
+            break;
+
+        file->compress_head = compress->next;
+        if (file->compress_head == NULL)
+            file->compress_tail = NULL;
+        pthread_mutex_unlock(&file->mutex);
+
+        cbox_log_file_gzip(compress->path);
+        cbox_log_file_retain(file->path, file->option.max_files);
+        CBOX_SAFETY_FREE(compress->path);
+        CBOX_SAFETY_FREE(compress);
+
+        pthread_mutex_lock(&file->mutex);
+    }
+
+    pthread_mutex_unlock(&file->mutex);
+    return NULL;
+}
+
+/*
+ * called in the flusher thread, the producers keep filling the front buffer
+ */
+static void cbox_log_file_rotate(cbox_log_file_t *file)
+{
+    char rotated[CBOX_LOG_FILE_MAX_PATH], stamp[32];
+    struct tm tm;
+    time_t now = time(NULL);
+    int i = 0;
+
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    // the sequence orders the files rotated in the same second, compressed or not
+    for (i = 0; i < 1000; ++i) {
+        snprintf(rotated, sizeof(rotated), "%s.%s-%03d.gz", file->path, stamp, i);
+        if (access(rotated, F_OK) == 0)
+            continue;
+
+        rotated[strlen(rotated) - 3] = '\0';
+        if (access(rotated, F_OK) != 0)
+            break;
+    }
+
+    close(file->fd);
+    file->fd = -1;
+    rename(file->path, rotated);
+
+    if (cbox_log_file_open_fd(file) != 0) {
+        // keep logging into the rotated one rather than losing the messages
+        rename(rotated, file->path);
+        cbox_log_file_open_fd(file);
+        return;
+    }
+
+    if (!file->option.compress) {
+        cbox_log_file_retain(file->path, file->option.max_files);
+        return;
+    }
+
+    // left uncompressed if out of memory, the next retention still counts it
+    cbox_log_file_compress_t *compress = (cbox_log_file_compress_t *)calloc(1, sizeof(cbox_log_file_compress_t));
+    if (compress == NULL || (compress->path = strdup(rotated)) == NULL) {
+        CBOX_SAFETY_FREE(compress);
+        return;
+    }
+
+    pthread_mutex_lock(&file->mutex);
+    if (file->compress_tail)
+        file->compress_tail->next = compress;
+    else
+        file->compress_head = compress;
+    file->compress_tail = compress;
+    pthread_cond_signal(&file->compress_cond);
+    pthread_mutex_unlock(&file->mutex);
+}
+
+static void *cbox_log_file_thread_func(void *arg)
+{
+    cbox_log_file_t *file = (cbox_log_file_t *)arg;
+    struct timespec ts;
+
+    pthread_mutex_lock(&file->mutex);
+
+    for (;;) {
+        if (!file->stop && !file->urgent && file->requested == file->flushed && file->back_used == 0) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += file->option.flush_interval / 1000;
+            ts.tv_nsec += (file->option.flush_interval % 1000) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec ++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&file->cond, &file->mutex, &ts);
+        }
+
+        uint64_t requested = file->requested;
+
+        if (file->back_used == 0 && file->front_used > 0) {
+            char *buffer = file->back;
+            file->back = file->front;
+            file->back_used = file->front_used;
+            file->front = buffer;
+            file->front_used = 0;
+        }
+        file->urgent = 0;
+        int stop = file->stop;
+
+        pthread_mutex_unlock(&file->mutex);
+
+        if (file->back_used > 0) {
+            cbox_log_file_write_fd(file->fd, file->back, file->back_used);
+            file->size += file->back_used;
+        }
+
+        if ((file->option.max_size && file->size >= file->option.max_size) ||
+            (file->rotate_time && time(NULL) >= file->rotate_time))
+            cbox_log_file_rotate(file);
+
+        pthread_mutex_lock(&file->mutex);
+        file->back_used = 0;
+
+        // what was buffered before the request has been written
+        if (requested > file->flushed)
+            file->flushed = requested;
+        pthread_cond_broadcast(&file->done);
+
+        if (stop && file->front_used == 0)
+            break;
+    }
+
+    pthread_mutex_unlock(&file->mutex);
+    return NULL;
+}
+
+cbox_log_file_t *cbox_log_file_open(const char *path, const cbox_log_file_option_t *option)
+{
+    cbox_log_file_option_t def = CBOX_LOG_FILE_OPTION_INITIALIZER;
+
+    cbox_log_file_t *file = (cbox_log_file_t *)calloc(1, sizeof(cbox_log_file_t));
+    if (file == NULL)
+        return NULL;
+
+    file->option = option ? *option : def;
+    if (file->option.buffer_size == 0) file->option.buffer_size = def.buffer_size;
+    if (file->option.flush_interval == 0) file->option.flush_interval = def.flush_interval;
+
+    file->fd = -1;
+    file->refs = 1;
+    file->path = strdup(path);
+    file->front = (char *)malloc(file->option.buffer_size);
+    file->back = (char *)malloc(file->option.buffer_size);
+    if (file->path == NULL || file->front == NULL || file->back == NULL || cbox_log_file_open_fd(file) != 0)
+        goto CLEANUP;
+
+    pthread_mutex_init(&file->mutex, NULL);
+    pthread_cond_init(&file->cond, NULL);
+    pthread_cond_init(&file->done, NULL);
+    pthread_cond_init(&file->compress_cond, NULL);
+
+    if (file->option.compress && pthread_create(&file->compressor, NULL, cbox_log_file_compress_func, file) != 0)
+        goto DESTROY;
+
+    if (pthread_create(&file->thread, NULL, cbox_log_file_thread_func, file) != 0) {
+        if (file->option.compress) {
+            file->compress_stop = 1;
+            pthread_cond_signal(&file->compress_cond);
+            pthread_join(file->compressor, NULL);
+        }
+        goto DESTROY;
+    }
+
+    return file;
+
+DESTROY:
+    pthread_cond_destroy(&file->compress_cond);
+    pthread_cond_destroy(&file->done);
+    pthread_cond_destroy(&file->cond);
+    pthread_mutex_destroy(&file->mutex);
+
+CLEANUP:
+    if (file->fd >= 0) close(file->fd);
+    CBOX_SAFETY_FREE(file->back);
+    CBOX_SAFETY_FREE(file->front);
+    CBOX_SAFETY_FREE(file->path);
+    CBOX_SAFETY_FREE(file);
+    return NULL;
+}
+
+void cbox_log_file_ref(cbox_log_file_t *file)
+{
+    __atomic_add_fetch(&file->refs, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * the last reference writes the buffered messages, stops the flusher, waits for the
+ * compressor to finish the rotated files and closes the file
+ */
+void cbox_log_file_unref(cbox_log_file_t *file)
+{
+    if (file == NULL || __atomic_sub_fetch(&file->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    pthread_mutex_lock(&file->mutex);
+    file->stop = 1;
+    pthread_cond_signal(&file->cond);
+    pthread_mutex_unlock(&file->mutex);
+
+    pthread_join(file->thread, NULL);
+
+    // the flusher may queue a last rotation before it exits
+    if (file->option.compress) {
+        pthread_mutex_lock(&file->mutex);
+        file->compress_stop = 1;
+        pthread_cond_signal(&file->compress_cond);
+        pthread_mutex_unlock(&file->mutex);
+        pthread_join(file->compressor, NULL);
+    }
+
+    close(file->fd);
+    pthread_cond_destroy(&file->compress_cond);
+    pthread_cond_destroy(&file->done);
+    pthread_cond_destroy(&file->cond);
+    pthread_mutex_destroy(&file->mutex);
+    CBOX_SAFETY_FREE(file->back);
+    CBOX_SAFETY_FREE(file->front);
+    CBOX_SAFETY_FREE(file->path);
+    CBOX_SAFETY_FREE(file);
+}
+
+/*
+ *@brief copy the lines into the front buffer, blocks only when both buffers are full.
+ *       lines longer than the buffer are copied piece by piece
+ *@param level - the most severe level of the lines
+ */
+void cbox_log_file_write(cbox_log_file_t *file, int level, const struct iovec *iov, int count)
+{
+    size_t len = 0, capacity = file->option.buffer_size;
+    int i = 0;
+
+    for (i = 0; i < count; ++i)
+        len += iov[i].iov_len;
+
+    pthread_mutex_lock(&file->mutex);
+
+    for (i = 0; i < count; ++i) {
+        const char *data = (const char *)iov[i].iov_base;
+        size_t left = iov[i].iov_len;
+
+        while (left > 0) {
+            // keeps the lines which fit in one buffer together
+            size_t need = len <= capacity ? len : 1;
+            while (file->front_used + need > capacity) {
+                file->urgent = 1;
+                pthread_cond_signal(&file->cond);
+                pthread_cond_wait(&file->done, &file->mutex);
+            }
+
+            size_t n = capacity - file->front_used < left ? capacity - file->front_used : left;
+            memcpy(file->front + file->front_used, data, n);
+            file->front_used += n;
+            data += n;
+            left -= n;
+            len -= n;
+        }
+    }
+
+    if (level <= file->option.flush_level && !file->urgent) {
+        file->urgent = 1;
+        pthread_cond_signal(&file->cond);
+    }
+
+    pthread_mutex_unlock(&file->mutex);
+}
+
+/*
+ *@brief wait until the buffered lines are written to the file
+ */
+void cbox_log_file_flush(cbox_log_file_t *file)
+{
+    pthread_mutex_lock(&file->mutex);
+
+    uint64_t requested = ++file->requested;
+    pthread_cond_signal(&file->cond);
+    while (file->flushed < requested)
+        pthread_cond_wait(&file->done, &file->mutex);
+
+    pthread_mutex_unlock(&file->mutex);
+}
@@ -0,0 +1,260 @@
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "macros.h"
+
+/*
+ * the file is a header page followed by the ring, records are 8 bytes aligned:
+ *   u64 pos, u32 length, u8 level, u8 style, u16 reserved, i64 sec, i32 usec, u32 reserved, i64 tid, body
+ * pos is the offset of the record since the ring was created, it is stored last, so a record
+ * whose pos does not match its offset is torn or overwritten, the decoder skips it
+ */
+#define CBOX_LOG_RECORDER_MAGIC "CBOXFREC"
+#define CBOX_LOG_RECORDER_VERSION (1)
+#define CBOX_LOG_RECORDER_HEADER_SIZE (4096)
+#define CBOX_LOG_RECORDER_MIN_SIZE (64 * 1024)
+#define CBOX_LOG_RECORDER_ALIGN(x) (((x) + 7) & ~(uint64_t)7)
+
+#define CBOX_LOG_RECORDER_STYLE_RAW (0)     //!< CBOX_LOG_STYLE_RAW of log.c, body only
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t capacity;
+    uint64_t head;          //!< atomic, bytes reserved since the ring was created
+    char name[64];
+} cbox_log_recorder_header_t;
+
+typedef struct
+{
+    uint64_t pos;
+    uint32_t len;
+    uint8_t level;
+    uint8_t style;
+    uint16_t reserved;
+    int64_t sec;
+    int32_t usec;
+    uint32_t reserved2;
+    int64_t tid;
+} cbox_log_record_t;
+
+typedef struct cbox_log_recorder
+{
+    cbox_log_recorder_header_t *header;
+    char *ring;
+    uint64_t mask;
+    size_t map_size;
+} cbox_log_recorder_t;
+
+static void cbox_log_ring_write(char *ring, uint64_t mask, uint64_t pos, const void *data, size_t len)
+{
+    size_t offset = pos & mask, first = mask + 1 - offset;
+
+    if (len <= first) {
+        memcpy(ring + offset, data, len);
+    } else {
+        memcpy(ring + offset, data, first);
+        memcpy(ring, (const char *)data + first, len - first);
+    }
+}
+
+static void cbox_log_ring_read(const char *ring, uint64_t mask, uint64_t pos, void *data, size_t len)
+{
+    size_t offset = pos & mask, first = mask + 1 - offset;
+
+    if (len <= first) {
+        memcpy(data, ring + offset, len);
+    } else {
+        memcpy(data, ring + offset, first);
+        memcpy((char *)data + first, ring, len - first);
+    }
+}
+
+/*
+ *@brief map the file as the ring, the records already in it are kept if it has the same size,
+ *       so the log of the previous run survives a restart
+ *@param size - bytes of the ring, rounded up to power of 2
+ */
+cbox_log_recorder_t *cbox_log_recorder_open(const char *path, size_t size, const char *name)
+{
+    uint64_t capacity = CBOX_LOG_RECORDER_MIN_SIZE;
+    struct stat st;
+
+    while (capacity < size)
+        capacity <<= 1;
+
+    cbox_log_recorder_t *recorder = (cbox_log_recorder_t *)calloc(1, sizeof(cbox_log_recorder_t));
+    if (recorder == NULL)
+        return NULL;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        goto CLEANUP;
+
+    recorder->map_size = CBOX_LOG_RECORDER_HEADER_SIZE + capacity;
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size != recorder->map_size && ftruncate(fd, recorder->map_size) != 0))
+        goto CLEANUP;
+
+    void *map = mmap(NULL, recorder->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto CLEANUP;
+
+    close(fd);
+    fd = -1;
+
+    recorder->header = (cbox_log_recorder_header_t *)map;
+    recorder->ring = (char *)map + CBOX_LOG_RECORDER_HEADER_SIZE;
+    recorder->mask = capacity - 1;
+
+    cbox_log_recorder_header_t *header = recorder->header;
+    if (memcmp(header->magic, CBOX_LOG_RECORDER_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != CBOX_LOG_RECORDER_VERSION || header->header_size != CBOX_LOG_RECORDER_HEADER_SIZE ||
+        header->capacity != capacity) {
+        memset(map, 0, recorder->map_size);
+        header->version = CBOX_LOG_RECORDER_VERSION;
+        header->header_size = CBOX_LOG_RECORDER_HEADER_SIZE;
+        header->capacity = capacity;
+        header->head = 0;
+        memcpy(header->magic, CBOX_LOG_RECORDER_MAGIC, sizeof(header->magic));
+    }
+    snprintf(header->name, sizeof(header->name), "%s", name);
+
+    return recorder;
+
+CLEANUP:
+    if (fd >= 0) close(fd);
+    CBOX_SAFETY_FREE(recorder);
+    return NULL;
+}
+
+void cbox_log_recorder_close(cbox_log_recorder_t *recorder)
+{
+    if (recorder == NULL)
+        return;
+
+    munmap(recorder->header, recorder->map_size);
+    CBOX_SAFETY_FREE(recorder);
+}
+
+/*
+ *@brief ask the kernel to write the pages, the records survive a crash of the process
+ *       without it, but not a power loss or reset of the machine
+ */
+void cbox_log_recorder_sync(cbox_log_recorder_t *recorder)
+{
+    msync(recorder->header, recorder->map_size, MS_SYNC);
+}
+
+/*
+ *@brief lock-free and without syscalls, the writers only share the head counter
+ */
+void cbox_log_recorder_write(cbox_log_recorder_t *recorder, int level, int style, const struct timeval *tv,
+                             long tid, const char *body, size_t len)
+{
+    cbox_log_record_t record;
+    uint64_t capacity = recorder->mask + 1;
+
+    if (sizeof(record) + len > capacity / 4)
+        len = capacity / 4 - sizeof(record);
+
+    uint64_t total = CBOX_LOG_RECORDER_ALIGN(sizeof(record) + len);
+    uint64_t pos = __atomic_fetch_add(&recorder->header->head, total, __ATOMIC_RELAXED);
+
+    record.pos = ~pos;
+    record.len = sizeof(record) + len;
+    record.level = level;
+    record.style = style;
+    record.reserved = 0;
+    record.sec = tv->tv_sec;
+    record.usec = tv->tv_usec;
+    record.reserved2 = 0;
+    record.tid = tid;
+
+    // the previous lap may have left a valid pos here, it is not ours until committed
+    cbox_log_ring_write(recorder->ring, recorder->mask, pos, &record, sizeof(record));
+    cbox_log_ring_write(recorder->ring, recorder->mask, pos + sizeof(record), body, len);
+
+    // pos never wraps, the ring and the records are 8 bytes aligned
+    __atomic_store_n((uint64_t *)(recorder->ring + (pos & recorder->mask)), pos, __ATOMIC_RELEASE);
+}
+
+/*
+ *@brief decode the records of a flight recorder file from the oldest one,
+ *       called by cbox_log_decode() for the files starting with the recorder magic
+ */
+int cbox_log_recorder_decode(const char *path, cbox_log_function_t cb, void *user)
+{
+    static const char *categories[] = { "E", "A", "C", "E", "W", "N", "I", "D" };
+    cbox_log_recorder_header_t header;
+    cbox_log_record_t record;
+    char *ring = NULL, *line = NULL;
+    int ret = -1;
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, CBOX_LOG_RECORDER_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CBOX_LOG_RECORDER_VERSION || header.capacity < CBOX_LOG_RECORDER_MIN_SIZE ||
+        (header.capacity & (header.capacity - 1)) != 0)
+        goto CLEANUP;
+
+    header.name[sizeof(header.name) - 1] = '\0';
+    ring = (char *)malloc(header.capacity);
+    line = (char *)malloc(header.capacity + 256);
+    if (ring == NULL || line == NULL || fseek(fp, header.header_size, SEEK_SET) != 0 ||
+        fread(ring, 1, header.capacity, fp) != header.capacity)
+        goto CLEANUP;
+
+    uint64_t mask = header.capacity - 1;
+    uint64_t pos = header.head > header.capacity ? header.head - header.capacity : 0;
+
+    while (pos + sizeof(record) <= header.head) {
+        cbox_log_ring_read(ring, mask, pos, &record, sizeof(record));
+
+        uint64_t total = CBOX_LOG_RECORDER_ALIGN(record.len);
+        if (record.pos != pos || record.len < sizeof(record) || pos + total > header.head || record.level > CBOX_LOG_LEVEL_DEBUG) {
+            pos += 8;
+            continue;
+        }
+
+        int n = 0;
+        if (record.style != CBOX_LOG_RECORDER_STYLE_RAW) {
+            struct tm tm;
+            char time_str[32];
+            time_t sec = record.sec;
+            localtime_r(&sec, &tm);
+            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm);
+            n = snprintf(line, 256, "[%s:%03d] %s %s [%lld]: ", time_str, (int)(record.usec / 1000),
+                         categories[record.level], header.name, (long long)record.tid);
+        }
+
+        cbox_log_ring_read(ring, mask, pos + sizeof(record), line + n, record.len - sizeof(record));
+        line[n + record.len - sizeof(record)] = '\0';
+        (*cb)(record.level, line, user);
+
+        pos += total;
+    }
+
+    ret = 0;
+
+CLEANUP:
+    CBOX_SAFETY_FREE(line);
+    CBOX_SAFETY_FREE(ring);
+    fclose(fp);
+    return ret;
+}
@@ -1,4 +1,13 @@
 #include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <string>
+#include <regex>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <fstream>
+#include <algorithm>
 #include "utils.h"
 #include "log.h"
 
@@ -16,9 +25,11 @@ public:
     static void redirect_cb(int level, const char *msg, void *user);
     static void log_level_cb(int level, const char *msg, void *user);
     static void log_name_cb(int level, const char *msg, void *user);
+    static void log_async_cb(int level, const char *msg, void *user);
 
 protected:
     int count = 0;
+    int delay = 0;
 }; 
 
 
@@ -109,7 +120,14 @@ void LogTest::log_name_cb(int level, const char *msg, void *user)
     self->count ++;
 }
 
-
+void LogTest::log_async_cb(int level, const char *msg, void *user)
+{
+    LogTest *self = (LogTest *)user;
+    EXPECT_EQ(level, CBOX_LOG_LEVEL_INFO);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "log_async", msg);
+    if (self->delay) usleep(self->delay);
+    __atomic_add_fetch(&self->count, 1, __ATOMIC_RELAXED);
+}
 
 TEST_F(LogTest, Redirect)
 {
@@ -152,3 +170,411 @@ TEST_F(LogTest, Name)
     LOGD("log_debug");
     EXPECT_EQ(this->count, 1);
 }
+
+TEST_F(LogTest, Async)
+{
+    CBOX_LOG_REDIRECT(log_async_cb, this, 0);
+    EXPECT_EQ(cbox_log_set_async(cbox_log_instance, 1, 64, CBOX_LOG_OVERFLOW_BLOCK), 0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([] {
+            for (int j = 0; j < 1000; ++j) LOGI("log_async %d", j);
+        });
+    }
+    for (auto &t : threads) t.join();
+
+    CBOX_LOG_FLUSH();
+    EXPECT_EQ(__atomic_load_n(&this->count, __ATOMIC_RELAXED), 4000);
+    EXPECT_EQ(cbox_log_dropped(cbox_log_instance), 0u);
+
+    // disabling writes the rest synchronously
+    EXPECT_EQ(cbox_log_set_async(cbox_log_instance, 0, 0, CBOX_LOG_OVERFLOW_BLOCK), 0);
+    LOGI("log_async sync");
+    EXPECT_EQ(this->count, 4001);
+}
+
+TEST_F(LogTest, AsyncDrop)
+{
+    this->delay = 1000;
+    CBOX_LOG_REDIRECT(log_async_cb, this, 0);
+    EXPECT_EQ(cbox_log_set_async(cbox_log_instance, 1, 4, CBOX_LOG_OVERFLOW_DROP), 0);
+
+    for (int i = 0; i < 100; ++i) LOGI("log_async %d", i);
+
+    CBOX_LOG_FLUSH();
+    uint64_t dropped = cbox_log_dropped(cbox_log_instance);
+    EXPECT_GT(dropped, 0u);
+    EXPECT_EQ(__atomic_load_n(&this->count, __ATOMIC_RELAXED) + dropped, 100u);
+}
+
+static void log_decode_cb(int level, const char *msg, void *user)
+{
+    ((std::vector<std::string> *)user)->push_back(msg);
+    (void)level;
+}
+
+TEST_F(LogTest, Binary)
+{
+    const char *path = "/tmp/cbox_log_test.blog";
+    std::vector<std::string> lines;
+    char expect[256];
+
+    EXPECT_EQ(cbox_log_set_binary(cbox_log_instance, path), 0);
+    for (int i = 0; i < 3; ++i)
+        LOGI("binary %d %s %5.2f %lu %c %% %*d|%-4s|%.3s", i, "str", 3.14159, 123456789UL, 'x', 6, 42, "ab", "truncated");
+    LOGW("eager %1$d %1$d", 7);
+    cbox_log_set_result(cbox_log_instance, 11);
+    cbox_log_basic(cbox_log_instance, CBOX_LOG_LEVEL_ERROR, "basic %lld %p", -5LL, (void *)0x1234);
+    CBOX_LOG_FLUSH();
+
+    EXPECT_EQ(cbox_log_decode(path, log_decode_cb, &lines), 0);
+    ASSERT_EQ(lines.size(), 5u);
+    for (int i = 0; i < 3; ++i) {
+        snprintf(expect, sizeof(expect), " I test.log [%ld]: TestBody: binary %d str  3.14 123456789 x %%     42|ab  |tru (log_test.cpp:",
+                 (long)gettid(), i);
+        EXPECT_PRED_FORMAT2(testing::IsSubstring, expect, lines[i]);
+    }
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "eager 7 7", lines[3]);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "basic -5 0x1234", lines[4]);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "[errno:11]", lines[4]);
+    EXPECT_EQ(lines[4].compare(0, 4, "E te"), 0);
+
+    EXPECT_EQ(cbox_log_set_binary(cbox_log_instance, NULL), 0);
+    EXPECT_EQ(cbox_log_decode("/nonexistent/cbox.blog", log_decode_cb, &lines), -1);
+    unlink(path);
+}
+
+TEST_F(LogTest, BinaryPrecision)
+{
+    const char *path = "/tmp/cbox_log_test_precision.blog";
+    std::vector<std::string> lines;
+    long page = sysconf(_SC_PAGESIZE);
+
+    // 4 bytes at the end of a page followed by an inaccessible one, strlen() would fault
+    char *mem = (char *)mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(mem, MAP_FAILED);
+    ASSERT_EQ(mprotect(mem + page, page, PROT_NONE), 0);
+    char *buf = mem + page - 4;
+    memcpy(buf, "abcd", 4);
+
+    EXPECT_EQ(cbox_log_set_binary(cbox_log_instance, path), 0);
+    LOGI("star [%.*s]", 4, buf);
+    LOGI("fixed [%.4s] [%.2s]", buf, buf);
+    LOGI("both [%*.*s]", 6, 3, buf);
+    CBOX_LOG_FLUSH();
+
+    EXPECT_EQ(cbox_log_decode(path, log_decode_cb, &lines), 0);
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "star [abcd]", lines[0]);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "fixed [abcd] [ab]", lines[1]);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "both [   abc]", lines[2]);
+
+    EXPECT_EQ(cbox_log_set_binary(cbox_log_instance, NULL), 0);
+    munmap(mem, page * 2);
+    unlink(path);
+}
+
+static void log_from_a(void) { LOGI("site_a"); }
+static void log_from_b(void) { LOGI("site_b"); }
+
+static void log_site_cb(int level, const char *msg, void *user)
+{
+    if (strstr(msg, "site_a")) {
+        EXPECT_PRED_FORMAT2(testing::IsSubstring, "log_from_a: site_a (log_test.cpp:", msg);
+    } else {
+        EXPECT_PRED_FORMAT2(testing::IsSubstring, "log_from_b: site_b (log_test.cpp:", msg);
+    }
+    EXPECT_PRED_FORMAT2(testing::IsNotSubstring, "errno", msg);
+    (*(int *)user) ++;
+    (void)level;
+}
+
+TEST_F(LogTest, Site)
+{
+    int count = 0;
+    CBOX_LOG_REDIRECT(log_site_cb, &count, 0);
+
+    std::thread a([] { for (int i = 0; i < 1000; ++i) log_from_a(); });
+    std::thread b([] { for (int i = 0; i < 1000; ++i) log_from_b(); });
+    a.join();
+    b.join();
+    EXPECT_EQ(count, 2000);
+
+    // the result belongs to the next message of the thread which sets it
+    cbox_log_set_result(cbox_log_instance, 5);
+    std::thread c([] { log_from_b(); });
+    c.join();
+    CBOX_LOG_REDIRECT(redirect_cb, this, 0);
+    cbox_log_set_result(cbox_log_instance, 0);
+    LOGD("log_debug");
+    EXPECT_EQ(this->count, 1);
+}
+
+static void log_header_cb(int level, const char *msg, void *user)
+{
+    ((std::vector<std::string> *)user)->push_back(msg);
+    (void)level;
+}
+
+TEST_F(LogTest, Header)
+{
+    std::vector<std::string> lines;
+    CBOX_LOG_REDIRECT(log_header_cb, &lines, 0);
+
+    LOGI("log_header");
+    CBOX_LOG_SET_COARSE_CLOCK(1);
+    LOGI("log_header");
+    cbox_log_basic(cbox_log_instance, CBOX_LOG_LEVEL_WARNING, "log_header");
+    CBOX_LOG_SET_COARSE_CLOCK(0);
+
+    std::string tid = std::to_string((long)gettid());
+    std::regex full("\\[\\d{4}-\\d{2}-\\d{2} \\d{2}:\\d{2}:\\d{2}:\\d{3}\\] I test\\.log \\[" + tid + "\\]: TestBody: log_header \\(log_test\\.cpp:\\d+\\)");
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_TRUE(std::regex_match(lines[0], full)) << lines[0];
+    EXPECT_TRUE(std::regex_match(lines[1], full)) << lines[1];
+    EXPECT_EQ(lines[2], "W test.log [" + tid + "] log_header");
+
+    // a thread logs with its own tid
+    std::thread t([&lines] { LOGI("log_header"); });
+    t.join();
+    ASSERT_EQ(lines.size(), 4u);
+    EXPECT_EQ(lines[3].find("[" + tid + "]"), std::string::npos);
+}
+
+static std::vector<std::string> log_dir_files(const std::string &dir)
+{
+    std::vector<std::string> files;
+    DIR *d = opendir(dir.c_str());
+    struct dirent *entry = NULL;
+    while (d && (entry = readdir(d)) != NULL)
+        if (entry->d_name[0] != '.') files.push_back(entry->d_name);
+    if (d) closedir(d);
+    return files;
+}
+
+static std::vector<std::string> log_file_lines(const std::string &path)
+{
+    std::vector<std::string> lines;
+    std::ifstream in(path);
+    for (std::string line; std::getline(in, line); ) lines.push_back(line);
+    return lines;
+}
+
+TEST_F(LogTest, File)
+{
+    char dir[] = "/tmp/cbox_log_file_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string path = std::string(dir) + "/test.log";
+
+    // a foreign file, and the rotated files of a logger at "test.log.old", they are not ours to remove
+    const char *foreign[] = { "test.log.something-long", "test.log.old.20240101-000000-000",
+                              "test.log.old.20240101-000000-001.gz" };
+    for (auto name : foreign) std::ofstream(std::string(dir) + "/" + name) << name;
+
+    cbox_log_file_option_t option = CBOX_LOG_FILE_OPTION_INITIALIZER;
+    option.buffer_size = 1024;
+    option.max_size = 4096;
+    option.max_files = 2;
+    EXPECT_EQ(cbox_log_set_file(cbox_log_instance, path.c_str(), &option), 0);
+
+    for (int i = 0; i < 1000; ++i) LOGI("log_file %d", i);
+    CBOX_LOG_FLUSH();
+
+    // the current file, at most 2 rotated ones, and the foreign ones
+    std::vector<std::string> files = log_dir_files(dir);
+    EXPECT_EQ(files.size(), 3u + sizeof(foreign) / sizeof(foreign[0]));
+    for (auto name : foreign)
+        EXPECT_NE(std::find(files.begin(), files.end(), name), files.end()) << name;
+
+    std::vector<std::string> lines = log_file_lines(path);
+    if (!lines.empty()) {
+        EXPECT_PRED_FORMAT2(testing::IsSubstring, "log_file 999 (log_test.cpp:", lines.back());
+        EXPECT_EQ(lines.back().find("\033"), std::string::npos);
+    }
+
+    // async writer into the file, a long line goes through the buffer in pieces
+    EXPECT_EQ(cbox_log_set_file(cbox_log_instance, path.c_str(), NULL), 0);
+    EXPECT_EQ(cbox_log_set_async(cbox_log_instance, 1, 0, CBOX_LOG_OVERFLOW_BLOCK), 0);
+    std::string big(4000, 'x');
+    LOGI("log_file_async %s", big.c_str());
+    CBOX_LOG_FLUSH();
+    lines = log_file_lines(path);
+    ASSERT_FALSE(lines.empty());
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "log_file_async " + big, lines.back());
+
+    EXPECT_EQ(cbox_log_set_async(cbox_log_instance, 0, 0, CBOX_LOG_OVERFLOW_BLOCK), 0);
+    EXPECT_EQ(cbox_log_set_file(cbox_log_instance, NULL, NULL), 0);
+    for (auto &file : log_dir_files(dir)) unlink((std::string(dir) + "/" + file).c_str());
+    rmdir(dir);
+}
+
+TEST_F(LogTest, FileCompress)
+{
+    if (system("gzip --version > /dev/null 2>&1") != 0)
+        GTEST_SKIP() << "no gzip";
+
+    char dir[] = "/tmp/cbox_log_file_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    std::string path = std::string(dir) + "/test.log";
+
+    cbox_log_file_option_t option = CBOX_LOG_FILE_OPTION_INITIALIZER;
+    option.buffer_size = 1024;
+    option.max_size = 4096;
+    option.max_files = 2;
+    option.compress = 1;
+    EXPECT_EQ(cbox_log_set_file(cbox_log_instance, path.c_str(), &option), 0);
+
+    for (int i = 0; i < 1000; ++i) LOGI("log_file_compress %d", i);
+
+    // closing waits for the compressor, every rotated file is compressed and retained by then
+    EXPECT_EQ(cbox_log_set_file(cbox_log_instance, NULL, NULL), 0);
+    std::vector<std::string> files = log_dir_files(dir);
+    EXPECT_EQ(files.size(), 3u);
+    for (auto &file : files) {
+        if (file != "test.log") {
+            EXPECT_EQ(file.compare(file.size() - 3, 3, ".gz"), 0) << file;
+        }
+    }
+
+    for (auto &file : files) unlink((std::string(dir) + "/" + file).c_str());
+    rmdir(dir);
+}
+
+TEST_F(LogTest, Recorder)
+{
+    const char *path = "/tmp/cbox_log_test.frec";
+    std::vector<std::string> lines;
+    char expect[64];
+    unlink(path);
+
+    // the debug messages go only to the recorder, the ring wraps several times
+    CBOX_LOG_SET_LEVEL(CBOX_LOG_LEVEL_ERROR);
+    EXPECT_EQ(cbox_log_set_recorder(cbox_log_instance, path, 0, CBOX_LOG_LEVEL_DEBUG), 0);
+    for (int i = 0; i < 5000; ++i) LOGD("log_recorder %d", i);
+    LOGE("log_recorder_error");
+    CBOX_LOG_FLUSH();
+
+    EXPECT_EQ(cbox_log_decode(path, log_decode_cb, &lines), 0);
+    ASSERT_GT(lines.size(), 100u);
+    ASSERT_LT(lines.size(), 5001u);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "log_recorder_error", lines.back());
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, " D test.log [", lines[0]);
+
+    // the oldest records were overwritten, the rest are in order
+    size_t first = 5000 - (lines.size() - 1);
+    for (size_t i = 0; i + 1 < lines.size(); ++i) {
+        snprintf(expect, sizeof(expect), "log_recorder %zu (log_test.cpp:", first + i);
+        EXPECT_PRED_FORMAT2(testing::IsSubstring, expect, lines[i]);
+    }
+
+    // the records of the previous run are kept
+    EXPECT_EQ(cbox_log_set_recorder(cbox_log_instance, NULL, 0, CBOX_LOG_LEVEL_DEBUG), 0);
+    EXPECT_EQ(cbox_log_set_recorder(cbox_log_instance, path, 0, CBOX_LOG_LEVEL_DEBUG), 0);
+    LOGD("log_recorder_reopen");
+    std::vector<std::string> reopened;
+    EXPECT_EQ(cbox_log_decode(path, log_decode_cb, &reopened), 0);
+    ASSERT_FALSE(reopened.empty());
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "log_recorder_reopen", reopened.back());
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "log_recorder_error", reopened[reopened.size() - 2]);
+
+    EXPECT_EQ(cbox_log_set_recorder(cbox_log_instance, NULL, 0, CBOX_LOG_LEVEL_DEBUG), 0);
+    unlink(path);
+}
+
+TEST_F(LogTest, ModuleLevel)
+{
+    std::vector<std::string> lines;
+    int evaluated = 0;
+
+    CBOX_LOG_REDIRECT(log_decode_cb, &lines, 0);
+    CBOX_LOG_SET_LEVEL(CBOX_LOG_LEVEL_INFO);
+
+    // the arguments of a disabled message are not evaluated
+    LOGD("module_level %d", ++evaluated);
+    EXPECT_EQ(evaluated, 0);
+    EXPECT_TRUE(lines.empty());
+
+    // this file is built with LOG_MODULE_ID "cbox.base"
+    EXPECT_EQ(cbox_log_set_module_level(cbox_log_instance, "cbox.event", CBOX_LOG_LEVEL_DEBUG), 0);
+    LOGD("module_level %d", ++evaluated);
+    EXPECT_EQ(evaluated, 0);
+
+    EXPECT_EQ(cbox_log_set_module_level(cbox_log_instance, "cbox.base", CBOX_LOG_LEVEL_DEBUG), 0);
+    LOGD("module_level %d", ++evaluated);
+    EXPECT_EQ(evaluated, 1);
+    ASSERT_EQ(lines.size(), 1u);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "module_level 1", lines[0]);
+
+    // the module level overrides a more verbose log level too
+    EXPECT_EQ(cbox_log_set_module_level(cbox_log_instance, "cbox.base", CBOX_LOG_LEVEL_ERROR), 0);
+    LOGW("module_level_warning");
+    EXPECT_EQ(lines.size(), 1u);
+
+    EXPECT_EQ(cbox_log_set_module_level(cbox_log_instance, "cbox.base", -1), 0);
+    LOGW("module_level_warning");
+    EXPECT_EQ(lines.size(), 2u);
+
+    EXPECT_EQ(cbox_log_set_module_level(cbox_log_instance, NULL, CBOX_LOG_LEVEL_DEBUG), -1);
+    CBOX_LOG_REDIRECT(NULL, NULL, 0);
+}
+
+static void log_storm(int count)
+{
+    for (int i = 0; i < count; ++i) LOGW_RATELIMIT(200, 3, "log_ratelimit %d", i);
+}
+
+TEST_F(LogTest, RateLimit)
+{
+    std::vector<std::string> lines;
+
+    CBOX_LOG_REDIRECT(log_decode_cb, &lines, 0);
+    log_storm(100);
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "log_ratelimit 2", lines[2]);
+
+    // the next window reports the dropped ones first
+    usleep(250 * 1000);
+    log_storm(100);
+    ASSERT_EQ(lines.size(), 7u);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "suppressed 97 messages", lines[3]);
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "log_ratelimit 0", lines[4]);
+
+    lines.clear();
+    int evaluated = 0;
+    for (int i = 0; i < 100; ++i) LOGD_SAMPLE(10, "log_sample %d", ++evaluated);
+    EXPECT_EQ(lines.size(), 10u);
+    EXPECT_EQ(evaluated, 10);
+    CBOX_LOG_REDIRECT(NULL, NULL, 0);
+}
+
+TEST_F(LogTest, KeyValue)
+{
+    std::vector<std::string> lines;
+
+    CBOX_LOG_REDIRECT(log_decode_cb, &lines, 0);
+    cbox_log_kv_ctx_t *ctx = cbox_log_kv_ctx_create(CBOX_KV_STR("client_id", "c\"1"), CBOX_KV_INT("session", 7), CBOX_KV_END);
+    ASSERT_NE(ctx, nullptr);
+
+    LOGKV(CBOX_LOG_LEVEL_INFO, ctx, "connected", CBOX_KV_INT("rc", -1), CBOX_KV_STR("host", "a b"),
+          CBOX_KV_DOUBLE("ratio", 0.5), CBOX_KV_BOOL("tls", 1), CBOX_KV_U64("bytes", 1ULL << 40));
+    ASSERT_EQ(lines.size(), 1u);
+    EXPECT_TRUE(std::regex_match(lines[0], std::regex("ts=\\d{4}-\\d\\d-\\d\\dT\\d\\d:\\d\\d:\\d\\d\\.\\d{3} level=info logger=test.log tid=\\d+ "
+        "msg=connected client_id=\"c\\\\\"1\" session=7 rc=-1 host=\"a b\" ratio=0.5 tls=true bytes=1099511627776")));
+
+    CBOX_LOG_SET_KV_FORMAT(CBOX_LOG_KV_JSON);
+    LOGKV(CBOX_LOG_LEVEL_WARNING, ctx, "line\nbreak", CBOX_KV_I64("delta", -5));
+    LOGKV(CBOX_LOG_LEVEL_DEBUG, NULL, "plain");
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_TRUE(std::regex_match(lines[1], std::regex("\\{\"ts\":\"[0-9T:.-]+\",\"level\":\"warning\",\"logger\":\"test.log\",\"tid\":\\d+,"
+        "\"msg\":\"line\\\\nbreak\",\"client_id\":\"c\\\\\"1\",\"session\":7,\"delta\":-5\\}")));
+    EXPECT_PRED_FORMAT2(testing::IsSubstring, "\"msg\":\"plain\"}", lines[2]);
+
+    // filtered by the log level
+    CBOX_LOG_SET_LEVEL(CBOX_LOG_LEVEL_INFO);
+    LOGKV(CBOX_LOG_LEVEL_DEBUG, ctx, "filtered");
+    EXPECT_EQ(lines.size(), 3u);
+
+    cbox_log_kv_ctx_destroy(ctx);
+    CBOX_LOG_REDIRECT(NULL, NULL, 0);
+}
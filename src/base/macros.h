@@ -13,6 +13,14 @@
 #define CBOX_SAFETY_FUNC(f, a) do { if (a) { f(a); a = NULL; } } while (0)
 #endif
 
+#ifndef CBOX_MIN
+#define CBOX_MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef CBOX_MAX
+#define CBOX_MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
 #ifndef CBOX_ARRAY_SIZE
 #define CBOX_ARRAY_SIZE(x) sizeof(x) / sizeof(x[0])
 #endif
@@ -0,0 +1,266 @@
+
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <syscall.h>
+#include <linux/futex.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mpmc_queue.h"
+#include "macros.h"
+
+#define CBOX_MPMC_CACHE_LINE (64)
+#define CBOX_MPMC_SPIN (64)             //!< failed tries before a blocking call sleeps
+#define CBOX_MPMC_MAX_BACKOFF (1000)    //!< microseconds, polling without futex
+
+typedef struct
+{
+    size_t seq;     //!< atomic, pos: free for the push at pos, pos + 1: full for the pop at pos
+    /* followed by the element */
+} cbox_mpmc_slot_t;
+
+/*
+ * a futex word bumped by one side to wake the waiters of the other side,
+ * waiters is checked first so the bump and the syscall are skipped when nobody waits
+ */
+typedef struct
+{
+    uint32_t word;
+    uint32_t waiters;
+} cbox_mpmc_event_t;
+
+struct cbox_mpmc_queue_s
+{
+    size_t push_pos __attribute__((aligned(CBOX_MPMC_CACHE_LINE)));    //!< atomic
+    size_t pop_pos __attribute__((aligned(CBOX_MPMC_CACHE_LINE)));     //!< atomic
+
+    cbox_mpmc_event_t not_full __attribute__((aligned(CBOX_MPMC_CACHE_LINE)));
+    cbox_mpmc_event_t not_empty;
+
+    size_t mask __attribute__((aligned(CBOX_MPMC_CACHE_LINE)));
+    size_t elem_size;
+    size_t stride;      //!< slot and element, 8 bytes aligned
+    int flags;
+    unsigned char *slots;
+};
+
+static inline cbox_mpmc_slot_t *cbox_mpmc_slot(cbox_mpmc_queue_t *queue, size_t pos)
+{
+    return (cbox_mpmc_slot_t *)(queue->slots + (pos & queue->mask) * queue->stride);
+}
+
+cbox_mpmc_queue_t *cbox_mpmc_queue_create(size_t elem_size, size_t capacity, int flags)
+{
+    cbox_mpmc_queue_t *queue = NULL;
+    size_t size = 2, i = 0;
+    void *mem = NULL;
+
+    while (size < capacity)
+        size <<= 1;
+
+    if (elem_size == 0 || posix_memalign(&mem, CBOX_MPMC_CACHE_LINE, sizeof(cbox_mpmc_queue_t)) != 0)
+        return NULL;
+
+    queue = (cbox_mpmc_queue_t *)mem;
+    memset(queue, 0, sizeof(cbox_mpmc_queue_t));
+    queue->mask = size - 1;
+    queue->elem_size = elem_size;
+    queue->stride = (sizeof(cbox_mpmc_slot_t) + elem_size + 7) & ~(size_t)7;
+    queue->flags = flags;
+
+    if (posix_memalign(&mem, CBOX_MPMC_CACHE_LINE, size * queue->stride) != 0) {
+        CBOX_SAFETY_FREE(queue);
+        return NULL;
+    }
+
+    queue->slots = (unsigned char *)mem;
+    for (i = 0; i < size; ++i)
+        cbox_mpmc_slot(queue, i)->seq = i;
+
+    return queue;
+}
+
+void cbox_mpmc_queue_destroy(cbox_mpmc_queue_t *queue)
+{
+    if (queue == NULL)
+        return;
+
+    CBOX_SAFETY_FREE(queue->slots);
+    CBOX_SAFETY_FREE(queue);
+}
+
+static void cbox_mpmc_event_notify(cbox_mpmc_queue_t *queue, cbox_mpmc_event_t *event)
+{
+    if (!(queue->flags & CBOX_MPMC_QUEUE_FUTEX))
+        return;
+
+    // pairs with the fence of cbox_mpmc_event_wait(), one of them sees the other
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&event->waiters, __ATOMIC_RELAXED) == 0)
+        return;
+
+    __atomic_add_fetch(&event->word, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &event->word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+int cbox_mpmc_queue_try_push(cbox_mpmc_queue_t *queue, const void *elem)
+{
+    size_t pos = __atomic_load_n(&queue->push_pos, __ATOMIC_RELAXED);
+    cbox_mpmc_slot_t *slot = NULL;
+
+    for (;;) {
+        slot = cbox_mpmc_slot(queue, pos);
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->push_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&queue->push_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(slot + 1, elem, queue->elem_size);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    cbox_mpmc_event_notify(queue, &queue->not_empty);
+    return 0;
+}
+
+int cbox_mpmc_queue_try_pop(cbox_mpmc_queue_t *queue, void *elem)
+{
+    size_t pos = __atomic_load_n(&queue->pop_pos, __ATOMIC_RELAXED);
+    cbox_mpmc_slot_t *slot = NULL;
+
+    for (;;) {
+        slot = cbox_mpmc_slot(queue, pos);
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->pop_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&queue->pop_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(elem, slot + 1, queue->elem_size);
+    __atomic_store_n(&slot->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+
+    cbox_mpmc_event_notify(queue, &queue->not_full);
+    return 0;
+}
+
+static long cbox_mpmc_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/*
+ *@brief sleep until the other side notifies the event, or the deadline
+ *@param deadline - microseconds of CLOCK_MONOTONIC, -1 means forever
+ *@return 0: retry, -1: timeout
+ */
+static int cbox_mpmc_event_wait(cbox_mpmc_queue_t *queue, cbox_mpmc_event_t *event, void *elem,
+                                int (*try_op)(cbox_mpmc_queue_t *, void *), long deadline, long *backoff)
+{
+    struct timespec ts, *timeout = NULL;
+    long left = 0;
+
+    if (deadline >= 0 && (left = deadline - cbox_mpmc_now_us()) <= 0)
+        return -1;
+
+    if (!(queue->flags & CBOX_MPMC_QUEUE_FUTEX)) {
+        *backoff = *backoff ? CBOX_MIN(*backoff * 2, CBOX_MPMC_MAX_BACKOFF) : 1;
+        usleep(deadline >= 0 ? CBOX_MIN(*backoff, left) : *backoff);
+        return 0;
+    }
+
+    if (deadline >= 0) {
+        ts.tv_sec = left / 1000000;
+        ts.tv_nsec = left % 1000000 * 1000;
+        timeout = &ts;
+    }
+
+    uint32_t word = __atomic_load_n(&event->word, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&event->waiters, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // the element may have come before the waiter was counted
+    int ret = try_op(queue, elem);
+    if (ret != 0)
+        syscall(SYS_futex, &event->word, FUTEX_WAIT_PRIVATE, word, timeout, NULL, 0);
+
+    __atomic_sub_fetch(&event->waiters, 1, __ATOMIC_RELAXED);
+    return ret == 0 ? 1 : 0;
+}
+
+static int cbox_mpmc_try_push_op(cbox_mpmc_queue_t *queue, void *elem)
+{
+    return cbox_mpmc_queue_try_push(queue, elem);
+}
+
+static int cbox_mpmc_try_pop_op(cbox_mpmc_queue_t *queue, void *elem)
+{
+    return cbox_mpmc_queue_try_pop(queue, elem);
+}
+
+/*
+ * spins a little, then sleeps on the event between tries
+ */
+static int cbox_mpmc_wait_for(cbox_mpmc_queue_t *queue, cbox_mpmc_event_t *event, void *elem,
+                              int (*try_op)(cbox_mpmc_queue_t *, void *), int timeout)
+{
+    long deadline = timeout < 0 ? -1 : cbox_mpmc_now_us() + timeout * 1000L, backoff = 0;
+    int i = 0;
+
+    for (i = 0; i < CBOX_MPMC_SPIN; ++i) {
+        if (try_op(queue, elem) == 0)
+            return 0;
+        sched_yield();
+    }
+
+    for (;;) {
+        int ret = cbox_mpmc_event_wait(queue, event, elem, try_op, deadline, &backoff);
+        if (ret != 0)
+            return ret > 0 ? 0 : -1;
+
+        if (try_op(queue, elem) == 0)
+            return 0;
+    }
+}
+
+int cbox_mpmc_queue_push(cbox_mpmc_queue_t *queue, const void *elem, int timeout)
+{
+    return cbox_mpmc_wait_for(queue, &queue->not_full, (void *)elem, cbox_mpmc_try_push_op, timeout);
+}
+
+int cbox_mpmc_queue_pop(cbox_mpmc_queue_t *queue, void *elem, int timeout)
+{
+    return cbox_mpmc_wait_for(queue, &queue->not_empty, elem, cbox_mpmc_try_pop_op, timeout);
+}
+
+size_t cbox_mpmc_queue_size(cbox_mpmc_queue_t *queue)
+{
+    size_t pop = __atomic_load_n(&queue->pop_pos, __ATOMIC_ACQUIRE);
+    size_t push = __atomic_load_n(&queue->push_pos, __ATOMIC_ACQUIRE);
+
+    return push > pop ? CBOX_MIN(push - pop, queue->mask + 1) : 0;
+}
+
+size_t cbox_mpmc_queue_capacity(cbox_mpmc_queue_t *queue)
+{
+    return queue->mask + 1;
+}
@@ -0,0 +1,71 @@
+#ifndef _CBOX_MPMC_QUEUE_H_
+#define _CBOX_MPMC_QUEUE_H_
+
+#include <stddef.h>
+
+/*
+ * bounded multi-producer multi-consumer queue of fixed size elements,
+ * an array of slots with a sequence number each (Dmitry Vyukov's design).
+ * a push or pop is one CAS on the shared position and a copy into or out of its slot,
+ * the producers and the consumers only contend among themselves
+ */
+typedef struct cbox_mpmc_queue_s cbox_mpmc_queue_t;
+
+/*
+ * flags of cbox_mpmc_queue_create()
+ */
+#define CBOX_MPMC_QUEUE_FUTEX (1 << 0)  //!< the blocking calls sleep on a futex, instead of polling with backoff
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/*
+ *@brief create the queue
+ *@param elem_size - bytes of an element
+ *@param capacity - elements, rounded up to power of 2, at least 2
+ *@param flags - CBOX_MPMC_QUEUE_*
+ *@return the queue, NULL: failed
+ */
+cbox_mpmc_queue_t *cbox_mpmc_queue_create(size_t elem_size, size_t capacity, int flags);
+
+/*
+ *@brief destroy the queue, nobody may be using it
+ */
+void cbox_mpmc_queue_destroy(cbox_mpmc_queue_t *queue);
+
+/*
+ *@return 0: succeed, -1: full
+ */
+int cbox_mpmc_queue_try_push(cbox_mpmc_queue_t *queue, const void *elem);
+
+/*
+ *@return 0: succeed, -1: empty
+ */
+int cbox_mpmc_queue_try_pop(cbox_mpmc_queue_t *queue, void *elem);
+
+/*
+ *@brief push, waiting for room when it is full
+ *@param timeout - miliseconds, -1 means forever
+ *@return 0: succeed, -1: timeout
+ */
+int cbox_mpmc_queue_push(cbox_mpmc_queue_t *queue, const void *elem, int timeout);
+
+/*
+ *@brief pop, waiting for an element when it is empty
+ *@param timeout - miliseconds, -1 means forever
+ *@return 0: succeed, -1: timeout
+ */
+int cbox_mpmc_queue_pop(cbox_mpmc_queue_t *queue, void *elem, int timeout);
+
+/*
+ *@brief number of elements, a snapshot when other threads are using it
+ */
+size_t cbox_mpmc_queue_size(cbox_mpmc_queue_t *queue);
+size_t cbox_mpmc_queue_capacity(cbox_mpmc_queue_t *queue);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif //_CBOX_MPMC_QUEUE_H_
@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include "mpmc_queue.h"
+
+TEST(MpmcQueue, try_push_pop)
+{
+    cbox_mpmc_queue_t *queue = cbox_mpmc_queue_create(sizeof(int), 3, 0);
+    ASSERT_NE(queue, nullptr);
+    EXPECT_EQ(cbox_mpmc_queue_capacity(queue), 4u);
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(cbox_mpmc_queue_try_push(queue, &i), 0);
+    }
+    int value = 100;
+    EXPECT_EQ(cbox_mpmc_queue_try_push(queue, &value), -1);
+    EXPECT_EQ(cbox_mpmc_queue_size(queue), 4u);
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(cbox_mpmc_queue_try_pop(queue, &value), 0);
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_EQ(cbox_mpmc_queue_try_pop(queue, &value), -1);
+    EXPECT_EQ(cbox_mpmc_queue_size(queue), 0u);
+
+    cbox_mpmc_queue_destroy(queue);
+}
+
+TEST(MpmcQueue, timeout)
+{
+    cbox_mpmc_queue_t *queue = cbox_mpmc_queue_create(sizeof(int), 2, CBOX_MPMC_QUEUE_FUTEX);
+    int value = 1;
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(cbox_mpmc_queue_pop(queue, &value, 50), -1);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+
+    EXPECT_EQ(cbox_mpmc_queue_push(queue, &value, 0), 0);
+    EXPECT_EQ(cbox_mpmc_queue_push(queue, &value, 0), 0);
+    EXPECT_EQ(cbox_mpmc_queue_push(queue, &value, 20), -1);
+
+    cbox_mpmc_queue_destroy(queue);
+}
+
+static void mpmc_queue_threads(int flags)
+{
+    const int producers = 4, consumers = 4, count = 50000;
+    cbox_mpmc_queue_t *queue = cbox_mpmc_queue_create(sizeof(uint64_t), 64, flags);
+    std::vector<std::thread> threads;
+    std::vector<uint64_t> sums(consumers, 0);
+
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([queue, &sums, c, count, producers, consumers] {
+            uint64_t value = 0;
+            for (int i = 0; i < count * producers / consumers; ++i) {
+                cbox_mpmc_queue_pop(queue, &value, -1);
+                sums[c] += value;
+            }
+        });
+    }
+
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([queue, p, count] {
+            for (uint64_t i = 0; i < (uint64_t)count; ++i) {
+                uint64_t value = (uint64_t)p * count + i;
+                cbox_mpmc_queue_push(queue, &value, -1);
+            }
+        });
+    }
+
+    for (auto &t : threads) t.join();
+
+    uint64_t total = 0, n = (uint64_t)producers * count;
+    for (auto sum : sums) total += sum;
+    EXPECT_EQ(total, n * (n - 1) / 2);
+    EXPECT_EQ(cbox_mpmc_queue_size(queue), 0u);
+    cbox_mpmc_queue_destroy(queue);
+}
+
+TEST(MpmcQueue, threads)
+{
+    mpmc_queue_threads(0);
+}
+
+TEST(MpmcQueue, threads_futex)
+{
+    mpmc_queue_threads(CBOX_MPMC_QUEUE_FUTEX);
+}
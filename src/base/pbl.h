@@ -53,6 +53,8 @@ extern "C" {
 #endif
 #endif
 
+#include <stdint.h>
+
 /*****************************************************************************/
 /* #defines                                                                  */
 /*****************************************************************************/
@@ -651,6 +653,10 @@ extern int    pbl_LongSize( unsigned long value );
 extern int    pbl_VarBufSize( unsigned char * buffer );
 extern void   pbl_LongToHexString( unsigned char * buf, unsigned long l );
 
+extern uint64_t pblHtHash64( const void * key, size_t keylen, uint64_t seed );
+extern void     pblHtSetSeed( uint64_t seed );
+extern uint64_t pblHtGetSeed( void );
+
 extern int pblHtHashValue( const unsigned char * key, size_t keylen );
 extern int pblHtHashValueOfString( const unsigned char * key );
 
@@ -43,6 +43,7 @@
 char* pblhash_c_id = "$Id: pblhash.c,v 1.24 2021/06/23 14:32:49 peter Exp $";
 
 #include <stdio.h>
+#include <stdint.h>
 #include <memory.h>
 
 #ifndef __APPLE__
@@ -54,7 +55,9 @@ char* pblhash_c_id = "$Id: pblhash.c,v 1.24 2021/06/23 14:32:49 peter Exp $";
 /*****************************************************************************/
 /* #defines                                                                  */
 /*****************************************************************************/
-#define PBL_HASHTABLE_SIZE      1019
+#define PBL_HASHTABLE_SIZE      64      /* initial number of buckets, power of 2 */
+#define PBL_HASHTABLE_LOAD      1       /* items per bucket that trigger a grow  */
+#define PBL_HASHTABLE_STEP      4       /* buckets migrated by each operation    */
 
 /*****************************************************************************/
 /* typedefs                                                                  */
@@ -64,6 +67,7 @@ typedef struct pbl_hashitem_s
 {
     void                  * key;
     size_t                  keylen;
+    int                     hashval;
 
     void                  * data;
 
@@ -82,6 +86,14 @@ typedef struct pbl_hashbucket_s
 
 } pbl_hashbucket_t;
 
+/*
+ * The table grows by doubling its bucket array. The items are not moved at once,
+ * every insert, lookup and remove migrates a few buckets of the old array,
+ * so no single operation pays for the rehash of the whole table.
+ *
+ * An item is in the old array if its bucket there has not been migrated yet,
+ * i.e. if ( hashval & ( noldbuckets - 1 )) >= rehashidx, otherwise in the new one.
+ */
 struct pbl_hashtable_s
 {
     char             * magic;
@@ -90,6 +102,12 @@ struct pbl_hashtable_s
     pbl_hashitem_t   * tail;
     pbl_hashitem_t   * current;
     pbl_hashbucket_t * buckets;
+    size_t             nbuckets;
+    size_t             nitems;
+
+    pbl_hashbucket_t * oldbuckets;     /* NULL if no rehash is in progress */
+    size_t             noldbuckets;
+    size_t             rehashidx;      /* next bucket of oldbuckets to migrate */
 
 };
 typedef struct pbl_hashtable_s pbl_hashtable_t;
@@ -98,6 +116,11 @@ typedef struct pbl_hashtable_s pbl_hashtable_t;
 /* globals                                                                   */
 /*****************************************************************************/
 
+/*
+ * seed of the default hash function, see pblHtSetSeed()
+ */
+static uint64_t pblHtSeed = 0x5851f42d4c957f2dULL;
+
 /*****************************************************************************/
 /* functions                                                                 */
 /*****************************************************************************/
@@ -211,13 +234,163 @@ int pblHt_J_Zobel_Hash( const unsigned char * key, size_t keylen )
     return ret & 0x7fffffff;
 }
 
+/*
+ * The 64 bit hash function used, it is wyhash (final version 4) by Wang Yi,
+ * released into the public domain. It reads 8 bytes at a time and
+ * consumes 48 bytes per round for long keys.
+ */
+
+static const uint64_t pblHtSecret[ 4 ] =
+{
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+static void pblHtMum( uint64_t * a, uint64_t * b )
+{
+#if defined( __SIZEOF_INT128__ )
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)( r >> 64 );
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + ( rm0 << 32 ), c = t < rl, lo;
+
+    lo = t + ( rm1 << 32 );
+    c += lo < t;
+    *a = lo;
+    *b = rh + ( rm0 >> 32 ) + ( rm1 >> 32 ) + c;
+#endif
+}
+
+static uint64_t pblHtMix( uint64_t a, uint64_t b )
+{
+    pblHtMum( &a, &b );
+    return a ^ b;
+}
+
+static uint64_t pblHtRead8( const unsigned char * p )
+{
+    uint64_t v;
+    memcpy( &v, p, 8 );
+    return v;
+}
+
+static uint64_t pblHtRead4( const unsigned char * p )
+{
+    uint32_t v;
+    memcpy( &v, p, 4 );
+    return v;
+}
+
+/**
+ * Calculates a 64 bit hash value of a buffer.
+ *
+ * Tables whose keys may be chosen by an attacker should use a random seed,
+ * so the keys colliding in them cannot be computed in advance.
+ *
+ * @return uint64_t rc: The hash value.
+ */
+
+uint64_t pblHtHash64(
+const void * key,     /** Buffer to hash                          */
+size_t       keylen,  /** Length of the buffer                    */
+uint64_t     seed     /** Seed, different seeds give unrelated hashes */
+)
+{
+    const unsigned char * p = (const unsigned char *)key;
+    uint64_t a, b;
+
+    seed ^= pblHtMix( seed ^ pblHtSecret[ 0 ], pblHtSecret[ 1 ] );
+
+    if( keylen <= 16 )
+    {
+        if( keylen >= 4 )
+        {
+            a = ( pblHtRead4( p ) << 32 ) | pblHtRead4( p + (( keylen >> 3 ) << 2 ));
+            b = ( pblHtRead4( p + keylen - 4 ) << 32 ) | pblHtRead4( p + keylen - 4 - (( keylen >> 3 ) << 2 ));
+        }
+        else if( keylen > 0 )
+        {
+            a = ( (uint64_t)p[ 0 ] << 16 ) | ( (uint64_t)p[ keylen >> 1 ] << 8 ) | p[ keylen - 1 ];
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        size_t i = keylen;
+
+        if( i > 48 )
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = pblHtMix( pblHtRead8( p ) ^ pblHtSecret[ 1 ], pblHtRead8( p + 8 ) ^ seed );
+                see1 = pblHtMix( pblHtRead8( p + 16 ) ^ pblHtSecret[ 2 ], pblHtRead8( p + 24 ) ^ see1 );
+                see2 = pblHtMix( pblHtRead8( p + 32 ) ^ pblHtSecret[ 3 ], pblHtRead8( p + 40 ) ^ see2 );
+                p += 48;
+                i -= 48;
+            } while( i > 48 );
+            seed ^= see1 ^ see2;
+        }
+
+        while( i > 16 )
+        {
+            seed = pblHtMix( pblHtRead8( p ) ^ pblHtSecret[ 1 ], pblHtRead8( p + 8 ) ^ seed );
+            i -= 16;
+            p += 16;
+        }
+
+        a = pblHtRead8( p + i - 16 );
+        b = pblHtRead8( p + i - 8 );
+    }
+
+    a ^= pblHtSecret[ 1 ];
+    b ^= seed;
+    pblHtMum( &a, &b );
+
+    return pblHtMix( a ^ pblHtSecret[ 0 ] ^ keylen, b ^ pblHtSecret[ 1 ] );
+}
+
+/**
+ * Sets the seed of the hash function used by hash tables, hash sets and hash maps.
+ *
+ * The hash values of the elements are cached, so this has to be called
+ * before any of them is created, typically with a random value at startup.
+ *
+ * @return void
+ */
+
+void pblHtSetSeed(
+uint64_t seed         /** The new seed */
+)
+{
+    pblHtSeed = seed;
+}
+
+/**
+ * Gets the seed of the hash function used by hash tables, hash sets and hash maps.
+ *
+ * @return uint64_t rc: The seed.
+ */
+
+uint64_t pblHtGetSeed( void )
+{
+    return pblHtSeed;
+}
+
 /*
  * Calculates the hash value of a buffer.
  */
 
 int pblHtHashValue( const unsigned char * key, size_t keylen )
 {
-    return pblHt_J_Zobel_Hash( key, keylen ) & 0x7fffffff;
+    return (int)( pblHtHash64( key, keylen, pblHtSeed ) & 0x7fffffff );
 }
 
 /*
@@ -226,16 +399,95 @@ int pblHtHashValue( const unsigned char * key, size_t keylen )
 
 int pblHtHashValueOfString( const unsigned char * key )
 {
-    return pblHt_J_Zobel_Hash( key, strlen( (char*)key ) ) & 0x7fffffff;
+    return (int)( pblHtHash64( key, strlen( (char*)key ), pblHtSeed ) & 0x7fffffff );
+}
+
+/*
+ * Find the bucket an item with the given hash value belongs to.
+ */
+
+static pbl_hashbucket_t * pblHtBucket( pbl_hashtable_t * ht, int hashval )
+{
+    if( ht->oldbuckets )
+    {
+        size_t index = hashval & ( ht->noldbuckets - 1 );
+        if( index >= ht->rehashidx )
+        {
+            return ht->oldbuckets + index;
+        }
+    }
+
+    return ht->buckets + ( hashval & ( ht->nbuckets - 1 ));
+}
+
+/*
+ * Migrate up to steps buckets of the old bucket array to the new one,
+ * frees the old array once all of its buckets are migrated.
+ */
+
+static void pblHtRehashStep( pbl_hashtable_t * ht, size_t steps )
+{
+    pbl_hashbucket_t * bucket;
+    pbl_hashitem_t   * item;
+
+    while( ht->oldbuckets && steps-- > 0 )
+    {
+        bucket = ht->oldbuckets + ht->rehashidx++;
+
+        while(( item = bucket->tail ))
+        {
+            pbl_hashbucket_t * target = ht->buckets + ( item->hashval & ( ht->nbuckets - 1 ));
+
+            /*
+             * take from the tail and push to the head, keeps the order of the chain
+             */
+            PBL_LIST_UNLINK( bucket->head, bucket->tail, item, bucketnext, bucketprev );
+            PBL_LIST_PUSH( target->head, target->tail, item, bucketnext, bucketprev );
+        }
+
+        if( ht->rehashidx >= ht->noldbuckets )
+        {
+            PBL_FREE( ht->oldbuckets );
+            ht->noldbuckets = 0;
+            ht->rehashidx = 0;
+        }
+    }
 }
 
 /*
- * Calculate index into hash table.
+ * Double the bucket array if the load factor is exceeded,
+ * the items are migrated later by pblHtRehashStep().
  */
 
-static int pblHtHashIndex( const unsigned char * key, size_t keylen )
+static void pblHtGrow( pbl_hashtable_t * ht )
 {
-    return pblHtHashValue( key, keylen ) % PBL_HASHTABLE_SIZE;
+    pbl_hashbucket_t * buckets;
+
+    if( ht->nitems < ht->nbuckets * PBL_HASHTABLE_LOAD )
+    {
+        return;
+    }
+
+    /*
+     * a previous grow is not complete yet, finish it first
+     */
+    pblHtRehashStep( ht, ht->noldbuckets );
+
+    buckets = (pbl_hashbucket_t *)pbl_malloc0( "pblHtGrow buckets",
+                              sizeof( pbl_hashbucket_t ) * ht->nbuckets * 2 );
+    if( !buckets )
+    {
+        /*
+         * not fatal, the chains just get longer
+         */
+        return;
+    }
+
+    ht->oldbuckets = ht->buckets;
+    ht->noldbuckets = ht->nbuckets;
+    ht->rehashidx = 0;
+    ht->buckets = buckets;
+    ht->nbuckets *= 2;
 }
 
 /**
@@ -263,6 +515,8 @@ pblHashTable_t * pblHtCreate( void )
         return NULL;
     }
 
+    ht->nbuckets = PBL_HASHTABLE_SIZE;
+
     /*
      * set the magic marker of the hashtable
      */
@@ -294,9 +548,10 @@ void                    * dataptr /** Dataptr to insert                   */
     pbl_hashbucket_t * bucket = 0;
     pbl_hashitem_t   * item = 0;
 
-    int                hashval = pblHtHashIndex( key, keylen );
+    int                hashval = pblHtHashValue( key, keylen );
 
-    bucket = ht->buckets + hashval;
+    pblHtRehashStep( ht, PBL_HASHTABLE_STEP );
+    bucket = pblHtBucket( ht, hashval );
 
     if( keylen < (size_t)1 )
     {
@@ -309,7 +564,7 @@ void                    * dataptr /** Dataptr to insert                   */
 
     for( item = bucket->head; item; item = item->bucketnext )
     {
-        if(( item->keylen == keylen ) && !memcmp( item->key, key, keylen ))
+        if(( item->hashval == hashval ) && ( item->keylen == keylen ) && !memcmp( item->key, key, keylen ))
         {
 #ifdef _WIN32
 #pragma warning(disable: 4996)
@@ -334,6 +589,7 @@ void                    * dataptr /** Dataptr to insert                   */
         return -1;
     }
     item->keylen = keylen;
+    item->hashval = hashval;
     item->data = dataptr;
 
     /*
@@ -343,6 +599,9 @@ void                    * dataptr /** Dataptr to insert                   */
     PBL_LIST_APPEND( ht->head, ht->tail, item, next, prev );
 
     ht->current = item;
+    ht->nitems++;
+
+    pblHtGrow( ht );
     return 0;
 }
 
@@ -364,13 +623,14 @@ size_t                        keylen  /** Length of that key               */
     pbl_hashbucket_t * bucket = 0;
     pbl_hashitem_t   * item = 0;
 
-    int                hashval = pblHtHashIndex( key, keylen );
+    int                hashval = pblHtHashValue( key, keylen );
 
-    bucket = ht->buckets + hashval;
+    pblHtRehashStep( ht, PBL_HASHTABLE_STEP );
+    bucket = pblHtBucket( ht, hashval );
 
     for( item = bucket->head; item; item = item->bucketnext )
     {
-        if(( item->keylen == keylen ) && !memcmp( item->key, key, keylen ))
+        if(( item->hashval == hashval ) && ( item->keylen == keylen ) && !memcmp( item->key, key, keylen ))
         {
             ht->current = item;
             ht->currentdeleted = 0;
@@ -591,14 +851,16 @@ size_t                      keylen /** OPT: Length of that key             */
 
     int                hashval = 0;
 
+    pblHtRehashStep( ht, PBL_HASHTABLE_STEP );
+
     if( keylen && key )
     {
-        hashval = pblHtHashIndex( key, keylen );
-        bucket = ht->buckets + hashval;
+        hashval = pblHtHashValue( key, keylen );
+        bucket = pblHtBucket( ht, hashval );
 
         for( item = bucket->head; item; item = item->bucketnext )
         {
-            if(( item->keylen == keylen ) && !memcmp( item->key, key, keylen ))
+            if(( item->hashval == hashval ) && ( item->keylen == keylen ) && !memcmp( item->key, key, keylen ))
             {
                 break;
             }
@@ -610,8 +872,7 @@ size_t                      keylen /** OPT: Length of that key             */
 
         if( item )
         {
-            hashval = pblHtHashIndex( item->key, item->keylen );
-            bucket = ht->buckets + hashval;
+            bucket = pblHtBucket( ht, item->hashval );
         }
     }
 
@@ -632,6 +893,7 @@ size_t                      keylen /** OPT: Length of that key             */
 
         PBL_FREE( item->key );
         PBL_FREE( item );
+        ht->nitems--;
         return 0;
     }
 
@@ -661,6 +923,7 @@ pblHashTable_t * h        /** Hash table to delete */
         return -1;
     }
 
+    PBL_FREE( ht->oldbuckets );
     PBL_FREE( ht->buckets );
     PBL_FREE( ht );
 
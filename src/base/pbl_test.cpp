@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+#include "pbl.h"
+
+TEST(pbl, hashtable_grow)
+{
+    const uint32_t count = 100000;
+    static uint32_t values[count];
+    pblHashTable_t *ht = pblHtCreate();
+    ASSERT_NE(ht, nullptr);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        values[i] = i;
+        ASSERT_EQ(pblHtInsert(ht, &i, sizeof(i), &values[i]), 0);
+        // the items of the buckets not migrated yet must still be found
+        uint32_t half = i / 2;
+        ASSERT_EQ(pblHtLookup(ht, &half, sizeof(half)), &values[half]);
+    }
+
+    uint32_t key = 7;
+    EXPECT_EQ(pblHtInsert(ht, &key, sizeof(key), &values[key]), -1);
+    key = count;
+    EXPECT_EQ(pblHtLookup(ht, &key, sizeof(key)), nullptr);
+
+    // remove the odd keys through the cursor
+    uint32_t visited = 0;
+    for (void *data = pblHtFirst(ht); data; data = pblHtNext(ht)) {
+        EXPECT_EQ(*(uint32_t *)pblHtCurrentKey(ht, NULL), *(uint32_t *)data);
+        if (*(uint32_t *)data % 2) {
+            EXPECT_EQ(pblHtRemove(ht, NULL, 0), 0);
+        }
+        ++visited;
+    }
+    EXPECT_EQ(visited, count);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        void *data = pblHtLookup(ht, &i, sizeof(i));
+        EXPECT_EQ(data, i % 2 ? nullptr : &values[i]);
+    }
+
+    for (uint32_t i = 0; i < count; i += 2)
+        ASSERT_EQ(pblHtRemove(ht, &i, sizeof(i)), 0);
+    EXPECT_EQ(pblHtFirst(ht), nullptr);
+    EXPECT_EQ(pblHtDelete(ht), 0);
+}
+
+TEST(pbl, hash64)
+{
+    // test vectors of the wyhash reference implementation, the seed is the index
+    static const struct {
+        const char *key;
+        uint64_t hash;
+    } vectors[] = {
+        { "", 0x93228a4de0eec5a2ULL },
+        { "a", 0xc5bac3db178713c4ULL },
+        { "abc", 0xa97f2f7b1d9b3314ULL },
+        { "message digest", 0x786d1f1df3801df4ULL },
+        { "abcdefghijklmnopqrstuvwxyz", 0xdca5a8138ad37c87ULL },
+        { "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", 0xb9e734f117cfaf70ULL },
+        { "12345678901234567890123456789012345678901234567890123456789012345678901234567890", 0x6cc5eab49a92d617ULL },
+    };
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i)
+        EXPECT_EQ(pblHtHash64(vectors[i].key, strlen(vectors[i].key), i), vectors[i].hash);
+
+    const unsigned char *topic = (const unsigned char *)"device/0001/sensor/temperature";
+    uint64_t seed = pblHtGetSeed();
+    int value = pblHtHashValueOfString(topic);
+    EXPECT_GE(value, 0);
+    EXPECT_EQ(value, pblHtHashValue(topic, strlen((const char *)topic)));
+
+    pblHtSetSeed(seed + 1);
+    EXPECT_NE(value, pblHtHashValueOfString(topic));
+    pblHtSetSeed(seed);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,6 +7,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sched.h>
 #include <syscall.h>
 #include <unistd.h>
 #include "macros.h"
@@ -87,31 +89,121 @@ int cbox_utils_running_in_main()
     return getpid() == syscall(SYS_gettid);
 }
 
-void cbox_utils_hexstr_to_bin(const char *hexstr, unsigned char *bin)
+/*
+ * two characters per byte, so encoding is one copy per byte
+ */
+static const char cbox_utils_hex_lower[513] =
+    "000102030405060708090a0b0c0d0e0f"
+    "101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f"
+    "303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f"
+    "505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f"
+    "707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f"
+    "909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+    "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+    "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+    "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+static const char cbox_utils_hex_upper[513] =
+    "000102030405060708090A0B0C0D0E0F"
+    "101112131415161718191A1B1C1D1E1F"
+    "202122232425262728292A2B2C2D2E2F"
+    "303132333435363738393A3B3C3D3E3F"
+    "404142434445464748494A4B4C4D4E4F"
+    "505152535455565758595A5B5C5D5E5F"
+    "606162636465666768696A6B6C6D6E6F"
+    "707172737475767778797A7B7C7D7E7F"
+    "808182838485868788898A8B8C8D8E8F"
+    "909192939495969798999A9B9C9D9E9F"
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAF"
+    "B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF"
+    "D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF"
+    "F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+/*
+ * value of a hex digit, -1 for the other characters
+ */
+static const signed char cbox_utils_hex_value[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+ssize_t cbox_utils_hex_encode(char *hex, size_t hex_len, const void *bin, size_t bin_len, char sep, int upper)
 {
-    const char *p_hex = hexstr;
-    size_t hex_len = strlen(hexstr);
-    size_t i = 0;
-    for (i = 0; i < hex_len / 2; i++, p_hex += 2) {
-        char s[3];
-        strncpy(s, p_hex, 2);
-        s[2] = '\0';
-        bin[i] = (unsigned char)strtol(s, NULL, 16);
+    const char *table = upper ? cbox_utils_hex_upper : cbox_utils_hex_lower;
+    const unsigned char *p = (const unsigned char *)bin;
+    size_t width = sep ? 3 : 2, i = 0;
+    char *out = hex;
+
+    if (bin_len > hex_len / width)
+        return -1;
+
+    if (sep) {
+        for (i = 0; i < bin_len; ++i, out += 3) {
+            memcpy(out, table + p[i] * 2, 2);
+            out[2] = sep;
+        }
+    } else {
+        for (i = 0; i < bin_len; ++i, out += 2)
+            memcpy(out, table + p[i] * 2, 2);
     }
+
+    return out - hex;
 }
 
-void cbox_utils_bin_to_hexstr(unsigned char *bin, unsigned bin_len, char *hexstr, int space, int upper)
+ssize_t cbox_utils_hex_decode(void *bin, size_t bin_len, const char *hex, size_t hex_len)
 {
-    size_t i = 0, j = 0;
-    for (i = 0; i < bin_len; ++i) {
-        sprintf(hexstr + i * 2 + j, upper ? "%02X" : "%02x", bin[i]);
+    const unsigned char *p = (const unsigned char *)hex;
+    unsigned char *out = (unsigned char *)bin;
+    size_t i = 0;
+
+    if ((hex_len & 1) || hex_len / 2 > bin_len)
+        return -1;
 
-        if (!space)
-            continue;
+    for (i = 0; i < hex_len / 2; ++i, p += 2) {
+        int high = cbox_utils_hex_value[p[0]], low = cbox_utils_hex_value[p[1]];
+        if ((high | low) < 0)
+            return -1;
 
-        strcat((char *)hexstr, " ");
-        j++;
+        out[i] = (unsigned char)(high << 4 | low);
     }
+
+    return i;
+}
+
+void cbox_utils_hexstr_to_bin(const char *hexstr, unsigned char *bin)
+{
+    size_t hex_len = strlen(hexstr) & ~(size_t)1;
+    cbox_utils_hex_decode(bin, hex_len / 2, hexstr, hex_len);
+}
+
+void cbox_utils_bin_to_hexstr(unsigned char *bin, unsigned bin_len, char *hexstr, int space, int upper)
+{
+    size_t hex_len = (size_t)bin_len * (space ? 3 : 2);
+    cbox_utils_hex_encode(hexstr, hex_len, bin, bin_len, space ? ' ' : 0, upper);
+    hexstr[hex_len] = '\0';
 }
 
 void cbox_utils_system(const char *fmt, ...)
@@ -200,3 +292,126 @@ int cbox_utils_create_pair_fd(int *readfd, int *writefd)
     return 1;
 }
 
+static int parse_cpulist(const char *cpulist, cpu_set_t *set)
+{
+    const char *p = cpulist;
+    int count = 0;
+
+    CPU_ZERO(set);
+    while (*p && *p != '\n') {
+        char *end = NULL;
+        long first = strtol(p, &end, 10), last = 0;
+        if (end == p || first < 0)
+            return -1;
+
+        last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(++p, &end, 10);
+            if (end == p || last < first)
+                return -1;
+            p = end;
+        }
+
+        for (; first <= last; ++first) {
+            if (first >= CPU_SETSIZE)
+                return -1;
+            CPU_SET(first, set);
+            count ++;
+        }
+
+        if (*p == ',')
+            p ++;
+        else if (*p && *p != '\n')
+            return -1;
+    }
+
+    return count > 0 ? 0 : -1;
+}
+
+int cbox_utils_set_thread_affinity(pthread_t thread, const char *cpulist)
+{
+    cpu_set_t set;
+
+    if (cpulist == NULL || parse_cpulist(cpulist, &set) != 0)
+        return -1;
+
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0 ? 0 : -1;
+}
+
+int cbox_utils_set_threads_affinity(const pthread_t *threads, int count, const char *cpulist)
+{
+    cpu_set_t set, *saved = NULL;
+    int i = 0;
+
+    if (threads == NULL || count < 0 || cpulist == NULL || parse_cpulist(cpulist, &set) != 0)
+        return -1;
+
+    saved = (cpu_set_t *)malloc(sizeof(cpu_set_t) * (count > 0 ? count : 1));
+    if (saved == NULL)
+        return -1;
+
+    for (i = 0; i < count; ++i) {
+        if (pthread_getaffinity_np(threads[i], sizeof(saved[i]), &saved[i]) != 0)
+            goto error;
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (pthread_setaffinity_np(threads[i], sizeof(set), &set) != 0) {
+            while (i-- > 0)
+                pthread_setaffinity_np(threads[i], sizeof(saved[i]), &saved[i]);
+            goto error;
+        }
+    }
+
+    CBOX_SAFETY_FREE(saved);
+    return 0;
+
+error:
+    CBOX_SAFETY_FREE(saved);
+    return -1;
+}
+
+int cbox_utils_numa_node_cpulist(int node, char *cpulist, size_t len)
+{
+    char path[64];
+    FILE *fp = NULL;
+
+    if (node < 0 || cpulist == NULL || len == 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    char *line = fgets(cpulist, len, fp);
+    fclose(fp);
+    if (line == NULL)
+        return -1;
+
+    cpulist[strcspn(cpulist, "\n")] = '\0';
+    return *cpulist ? 0 : -1;
+}
+
+int cbox_utils_set_numa_preferred(int node)
+{
+#if defined(SYS_set_mempolicy)
+    // from <numaif.h>, avoid depending on libnuma
+    const int mpol_default = 0, mpol_preferred = 1;
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+
+    if (node < 0)
+        return syscall(SYS_set_mempolicy, mpol_default, NULL, 0) == 0 ? 0 : -1;
+
+    if ((size_t)node >= sizeof(mask) * 8)
+        return -1;
+
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_set_mempolicy, mpol_preferred, mask, sizeof(mask) * 8) == 0 ? 0 : -1;
+#else
+    (void)node;
+    return -1;
+#endif
+}
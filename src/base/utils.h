@@ -1,6 +1,10 @@
 #ifndef _UTILS_H_20221106_
 #define _UTILS_H_20221106_
 
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
 #if defined (__cplusplus)
 extern "C" {
 #endif
@@ -39,7 +43,35 @@ int cbox_utils_running_in_main();
 
 
 /*
- * @brief convert hex-string to binary array
+ * @brief encode binary array to hex characters with a lookup table, no '\0' is appended
+ *
+ * @param hex: output buffer
+ * @param hex_len: size of hex, at least bin_len * 2, or bin_len * 3 with sep
+ * @param bin: input binary array
+ * @param bin_len: array length
+ * @param sep: character after every byte, e.g., ' ', 0 means none
+ * @param upper: make every character upper, 1:true, 0:false
+ *
+ * @return characters written
+ * @return -1: hex_len is too small
+ */
+ssize_t cbox_utils_hex_encode(char *hex, size_t hex_len, const void *bin, size_t bin_len, char sep, int upper);
+
+/*
+ * @brief decode hex characters to binary array with a lookup table
+ *
+ * @param bin: output buffer
+ * @param bin_len: size of bin, at least hex_len / 2
+ * @param hex: input hex characters, upper or lower, no '\0' needed
+ * @param hex_len: number of characters, must be even
+ *
+ * @return bytes written
+ * @return -1: odd hex_len, bin_len is too small or invalid character
+ */
+ssize_t cbox_utils_hex_decode(void *bin, size_t bin_len, const char *hex, size_t hex_len);
+
+/*
+ * @brief convert hex-string to binary array, stops at the first invalid character
  *
  * @param bin: output buffer to store binary elements
  * @param hex: input hex-dumped string
@@ -54,6 +86,7 @@ void cbox_utils_hexstr_to_bin(const char *hexstr, unsigned char *bin);
  * @param hexstr: output hexstr
  * @param space: add space between every hexstr, 1:true, 0:false
  * @param upper: make every character upper, 1:true, 0:false
+ * @note  hexstr must hold bin_len * 2 + 1 bytes, or bin_len * 3 + 1 with space
  */
 void cbox_utils_bin_to_hexstr(unsigned char *bin, unsigned bin_len, char *hexstr, int space, int upper);
 
@@ -94,6 +127,53 @@ int cbox_utils_copy_file(const char *dest, const char *src);
  */
 int cbox_utils_create_pair_fd(int *readfd, int *writefd);
 
+/*
+ * @brief pin the thread to the cpus
+ *
+ * @param thread: the thread to pin, e.g., pthread_self()
+ * @param cpulist: cpus in the kernel cpulist format, e.g., "0-3,8,10-11"
+ *
+ * @return 0: succeed
+ * @return -1: failed, bad cpulist or the kernel refused it
+ */
+int cbox_utils_set_thread_affinity(pthread_t thread, const char *cpulist);
+
+/*
+ * @brief pin the threads to the cpus, all or none of them
+ *
+ * @param threads: the threads to pin
+ * @param count: number of threads
+ * @param cpulist: cpus in the kernel cpulist format, parsed once for all threads
+ *
+ * @return 0: succeed
+ * @return -1: failed, bad cpulist, or the kernel refused a thread and the masks of the
+ *             threads already pinned are restored
+ */
+int cbox_utils_set_threads_affinity(const pthread_t *threads, int count, const char *cpulist);
+
+/*
+ * @brief get the cpus of the numa node
+ *
+ * @param node: the numa node
+ * @param cpulist: output buffer in the kernel cpulist format
+ * @param len: size of cpulist
+ *
+ * @return 0: succeed
+ * @return -1: failed, e.g., no such node
+ */
+int cbox_utils_numa_node_cpulist(int node, char *cpulist, size_t len);
+
+/*
+ * @brief make the memory allocated by the calling thread prefer the numa node,
+ *        only the calling thread is affected
+ *
+ * @param node: the numa node, -1 to reset to the default policy
+ *
+ * @return 0: succeed
+ * @return -1: failed, e.g., kernel without numa support
+ */
+int cbox_utils_set_numa_preferred(int node);
+
 #if defined (__cplusplus)
 }
 #endif
@@ -1,6 +1,36 @@
 #include <gtest/gtest.h>
+#include <sched.h>
+#include <string>
 #include "utils.h"
 
+/*
+ * the threads created later inherit the mask of the main thread,
+ * the affinity tests put it back so the concurrency tests keep all the cpus
+ */
+class AffinityGuard {
+public:
+    AffinityGuard() {
+        CPU_ZERO(&saved_);
+        EXPECT_EQ(sched_getaffinity(0, sizeof(saved_), &saved_), 0);
+    }
+
+    ~AffinityGuard() {
+        EXPECT_EQ(sched_setaffinity(0, sizeof(saved_), &saved_), 0);
+    }
+
+    // the first cpu the test is allowed to run on, cpu 0 may be outside the cpuset
+    int cpu() const {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &saved_)) return cpu;
+        return -1;
+    }
+
+    bool allowed(int cpu) const { return cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &saved_); }
+
+private:
+    cpu_set_t saved_;
+};
+
 TEST(Utils, runing_in_main)
 {
     EXPECT_EQ(cbox_utils_running_in_main(), 1);
@@ -21,3 +51,72 @@ TEST(Utils, hex_str_to_bin)
     EXPECT_EQ(buff[3], 0xFF);
     EXPECT_EQ(buff[4], 0x87);
 }
+
+TEST(Utils, hex_codec)
+{
+    const unsigned char bin[] = { 0x00, 0x01, 0x9A, 0x3B, 0xFF };
+    unsigned char out[8] = { 0 };
+    char hex[32] = { 0 };
+
+    EXPECT_EQ(cbox_utils_hex_encode(hex, sizeof(hex), bin, sizeof(bin), 0, 0), 10);
+    EXPECT_EQ(std::string(hex, 10), "00019a3bff");
+    EXPECT_EQ(cbox_utils_hex_encode(hex, sizeof(hex), bin, sizeof(bin), ' ', 1), 15);
+    EXPECT_EQ(std::string(hex, 15), "00 01 9A 3B FF ");
+    EXPECT_EQ(cbox_utils_hex_encode(hex, 14, bin, sizeof(bin), ' ', 1), -1);
+
+    EXPECT_EQ(cbox_utils_hex_decode(out, sizeof(out), "00019a3BfF", 10), 5);
+    EXPECT_EQ(memcmp(out, bin, sizeof(bin)), 0);
+    EXPECT_EQ(cbox_utils_hex_decode(out, sizeof(out), "0001x", 5), -1);
+    EXPECT_EQ(cbox_utils_hex_decode(out, sizeof(out), "00g1", 4), -1);
+    EXPECT_EQ(cbox_utils_hex_decode(out, 1, "0001", 4), -1);
+
+    cbox_utils_bin_to_hexstr((unsigned char *)bin, sizeof(bin), hex, 1, 0);
+    EXPECT_STREQ(hex, "00 01 9a 3b ff ");
+    cbox_utils_bin_to_hexstr((unsigned char *)bin, sizeof(bin), hex, 0, 1);
+    EXPECT_STREQ(hex, "00019A3BFF");
+}
+
+TEST(Utils, thread_affinity)
+{
+    AffinityGuard guard;
+    std::string cpu = std::to_string(guard.cpu());
+
+    EXPECT_EQ(cbox_utils_set_thread_affinity(pthread_self(), cpu.c_str()), 0);
+    EXPECT_EQ(sched_getcpu(), guard.cpu());
+    EXPECT_EQ(cbox_utils_set_thread_affinity(pthread_self(), (cpu + "-" + cpu + "," + cpu + "\n").c_str()), 0);
+    EXPECT_EQ(cbox_utils_set_thread_affinity(pthread_self(), ""), -1);
+    EXPECT_EQ(cbox_utils_set_thread_affinity(pthread_self(), "3-1"), -1);
+    EXPECT_EQ(cbox_utils_set_thread_affinity(pthread_self(), "a"), -1);
+    EXPECT_EQ(cbox_utils_set_thread_affinity(pthread_self(), NULL), -1);
+}
+
+TEST(Utils, threads_affinity)
+{
+    AffinityGuard guard;
+    std::string cpu = std::to_string(guard.cpu());
+    pthread_t threads[2] = { pthread_self(), pthread_self() };
+    cpu_set_t before, after;
+
+    EXPECT_EQ(sched_getaffinity(0, sizeof(before), &before), 0);
+    EXPECT_EQ(cbox_utils_set_threads_affinity(threads, 2, "a"), -1);
+    EXPECT_EQ(cbox_utils_set_threads_affinity(threads, 2, std::to_string(CPU_SETSIZE - 1).c_str()), -1);
+    EXPECT_EQ(sched_getaffinity(0, sizeof(after), &after), 0);
+    EXPECT_TRUE(CPU_EQUAL(&before, &after));
+
+    EXPECT_EQ(cbox_utils_set_threads_affinity(threads, 2, cpu.c_str()), 0);
+    EXPECT_EQ(sched_getcpu(), guard.cpu());
+    EXPECT_EQ(cbox_utils_set_threads_affinity(threads, 0, cpu.c_str()), 0);
+    EXPECT_EQ(cbox_utils_set_threads_affinity(NULL, 2, cpu.c_str()), -1);
+}
+
+TEST(Utils, numa_node)
+{
+    AffinityGuard guard;
+    char cpulist[256];
+    EXPECT_EQ(cbox_utils_numa_node_cpulist(-1, cpulist, sizeof(cpulist)), -1);
+    EXPECT_EQ(cbox_utils_numa_node_cpulist(100000, cpulist, sizeof(cpulist)), -1);
+    if (cbox_utils_numa_node_cpulist(0, cpulist, sizeof(cpulist)) == 0 && guard.allowed(atoi(cpulist))) {
+        EXPECT_EQ(cbox_utils_set_thread_affinity(pthread_self(), cpulist), 0);
+    }
+    EXPECT_EQ(cbox_utils_set_numa_preferred(100000), -1);
+}
@@ -6,16 +6,19 @@
 #include <time.h>
 #include <errno.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "base/macros.h"
+#include "base/utils.h"
+#include "base/hashmap.h"
 #include "loop.h"
 #include "delegator.h"
 #include "fd_event.h"
-#include "base/pbl.h"
 
 
 #define CBOX_MAX_EVENTS (64)
 #define CBOX_DEFAULT_TIMER_HEAP_CAPACITY (64)
 #define CBOX_TOKEN_SIZE (17)
+#define CBOX_CPULIST_SIZE (256)
 
 typedef uint64_t cbox_basic_timer_token_t;
 
@@ -40,13 +43,17 @@ struct cbox_loop
     cbox_delegator_t *delegator;
     cbox_basic_timer_t *exit_timer;
     int running;
-    PblMap *fd_nodes; //!<key:fd, value: struct cbox_fd_event_shared_data *
+    cbox_hashmap_t *fd_nodes; //!<key:fd, value: struct cbox_fd_event_shared_data *
+    pthread_mutex_t placement_mutex;   //!< guards cpulist and numa_node, set from any thread
+    char cpulist[CBOX_CPULIST_SIZE];   //!< empty means not pinned
+    int numa_node;                     //!< -1 means default memory policy
 };
 
 static void on_tick(cbox_loop_t *);
 static inline uint64_t top_expired(cbox_loop_t *);
 static void min_heap_percolate_down(cbox_loop_t *, int);
 static inline cbox_basic_timer_token_t generate_timer_token(cbox_loop_t *, cbox_basic_timer_t *);
+static void apply_placement(void *);
 
 int cbox_fd_node_add(cbox_loop_t *loop, int fd, void *value);
 int cbox_fd_node_del(cbox_loop_t *loop, int fd);
@@ -69,7 +76,7 @@ cbox_loop_t *cbox_loop_new()
     for (i = 0; i < loop->timer_heap_capacity; ++i)
         loop->timer_heap[i] = NULL;
 
-    loop->fd_nodes = pblMapNewTreeMap();
+    loop->fd_nodes = cbox_hashmap_create(sizeof(int), sizeof(void *), NULL, NULL);
     if (loop->fd_nodes == NULL)
         goto error;
 
@@ -80,6 +87,9 @@ cbox_loop_t *cbox_loop_new()
 
     loop->exit_timer = NULL;
     loop->running = 0;
+    pthread_mutex_init(&loop->placement_mutex, NULL);
+    loop->cpulist[0] = '\0';
+    loop->numa_node = -1;
 
     return loop;
 error:
@@ -93,8 +103,7 @@ void cbox_loop_delete(cbox_loop_t *loop)
 
     CBOX_SAFETY_FUNC(cbox_delegator_delete, loop->delegator);
 
-    CBOX_SAFETY_FUNC(pblMapClear, loop->fd_nodes);
-    CBOX_SAFETY_FUNC(pblMapFree, loop->fd_nodes);
+    CBOX_SAFETY_FUNC(cbox_hashmap_destroy, loop->fd_nodes);
 
     if (loop->exit_timer) {
         cbox_basic_timer_disable(loop, loop->exit_timer);
@@ -107,6 +116,7 @@ void cbox_loop_delete(cbox_loop_t *loop)
         loop->epoll_fd = -1;
     }
 
+    pthread_mutex_destroy(&loop->placement_mutex);
     CBOX_SAFETY_FREE(loop->timer_heap);
     CBOX_SAFETY_FREE(loop);
 }
@@ -119,6 +129,7 @@ void cbox_loop_dispatch(cbox_loop_t * loop, uint32_t mode)
 
     loop->exit_flag = (mode == CBOX_RUN_MODE_ONCE) ? 1 : 0;
     loop->running = 1;
+    apply_placement(loop);
 
     do {
         struct epoll_event events[CBOX_MAX_EVENTS];
@@ -184,6 +195,58 @@ void cbox_loop_exit_after(cbox_loop_t *loop, uint64_t miliseconds)
     cbox_basic_timer_enable(loop, timer);
 }
 
+static void apply_placement(void *user)
+{
+    cbox_loop_t *loop = (cbox_loop_t *)user;
+    char cpulist[CBOX_CPULIST_SIZE];
+    int numa_node = -1;
+
+    pthread_mutex_lock(&loop->placement_mutex);
+    strcpy(cpulist, loop->cpulist);
+    numa_node = loop->numa_node;
+    pthread_mutex_unlock(&loop->placement_mutex);
+
+    if (cpulist[0])
+        cbox_utils_set_thread_affinity(pthread_self(), cpulist);
+
+    if (numa_node >= 0)
+        cbox_utils_set_numa_preferred(numa_node);
+}
+
+static int set_placement(cbox_loop_t *loop, const char *cpulist, int numa_node)
+{
+    if (strlen(cpulist) >= sizeof(loop->cpulist))
+        return -1;
+
+    pthread_mutex_lock(&loop->placement_mutex);
+    strcpy(loop->cpulist, cpulist);
+    if (numa_node >= 0)
+        loop->numa_node = numa_node;
+    pthread_mutex_unlock(&loop->placement_mutex);
+
+    // applied by the dispatch thread, if it is not running yet, it applies at start anyway
+    cbox_loop_delegate(loop, apply_placement, loop);
+    return 0;
+}
+
+int cbox_loop_set_affinity(cbox_loop_t *loop, const char *cpulist)
+{
+    if (loop == NULL || cpulist == NULL)
+        return -1;
+
+    return set_placement(loop, cpulist, -1);
+}
+
+int cbox_loop_set_numa_node(cbox_loop_t *loop, int node)
+{
+    char cpulist[CBOX_CPULIST_SIZE];
+
+    if (loop == NULL || node < 0 || cbox_utils_numa_node_cpulist(node, cpulist, sizeof(cpulist)) != 0)
+        return -1;
+
+    return set_placement(loop, cpulist, node);
+}
+
 cbox_basic_timer_t *cbox_basic_timer_new(uint64_t ms, int repeat, cbox_timeout_func_t cb, void *user)
 {
     cbox_basic_timer_t *timer = (cbox_basic_timer_t *)malloc(sizeof(cbox_basic_timer_t));
@@ -340,33 +403,17 @@ static cbox_basic_timer_token_t generate_timer_token(cbox_loop_t *loop, cbox_bas
 
 int cbox_fd_node_add(cbox_loop_t *loop, int fd, void *value)
 {
-    int ret = pblMapAdd(loop->fd_nodes, &fd, sizeof(fd), &value, sizeof(void *));
-    if (ret < 0)
-        return -1;
-
-    return 0;
+    return cbox_hashmap_put_int(loop->fd_nodes, fd, value);
 }
 
 int cbox_fd_node_del(cbox_loop_t *loop, int fd)
 {
-    size_t val_len = 0;
-    void *ret = pblMapRemove(loop->fd_nodes, &fd, sizeof(fd), &val_len);
-
-    if (ret == NULL || ret == (void *)-1) //!< could not found key : fd
-        return -1;
-
-    return 0; 
+    return cbox_hashmap_remove_int(loop->fd_nodes, fd);
 }
 
 void *cbox_fd_node_search(cbox_loop_t *loop, int fd)
 {
-    void *value = NULL;
-    size_t ret_len = 0;
-    value = pblMapGet(loop->fd_nodes, &fd, sizeof(fd), &ret_len);
-    void **pvalue = &value;
-
-    (void)ret_len;
-    return *pvalue;
+    return cbox_hashmap_get_int(loop->fd_nodes, fd);
 }
 
 int cbox_loop_epoll_fd(cbox_loop_t *loop)
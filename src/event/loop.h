@@ -26,6 +26,19 @@ void cbox_loop_delegate(cbox_loop_t * /*cbox_loop*/, cbox_run_in_loop_func_t /*c
 void cbox_loop_exit(cbox_loop_t *);
 void cbox_loop_exit_after(cbox_loop_t *, uint64_t /*miliseconds*/);
 
+/*
+ * pin the thread running cbox_loop_dispatch() to the cpus in kernel cpulist format, e.g., "0-3,8",
+ * applied at once if the loop is running, otherwise when it starts, a failure of the kernel
+ * leaves the thread as it was. return 0: succeed, -1: failed
+ */
+int cbox_loop_set_affinity(cbox_loop_t *, const char * /*cpulist*/);
+
+/*
+ * pin the dispatch thread to the cpus of the numa node, and make the memory it allocates
+ * prefer the node. return 0: succeed, -1: failed
+ */
+int cbox_loop_set_numa_node(cbox_loop_t *, int /*node*/);
+
 // basic timer
 cbox_basic_timer_t *cbox_basic_timer_new(uint64_t /*miliseconds*/, int /*repeat*/, cbox_timeout_func_t /* timeout handler*/, void * /*user*/);
 void cbox_basic_timer_delete(cbox_basic_timer_t * /*timer*/);
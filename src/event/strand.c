@@ -0,0 +1,158 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "strand.h"
+#include "base/macros.h"
+#include "base/dqueue.h"
+
+#define CBOX_STRAND_BATCH (16)  //!< tasks run in one turn before giving the thread to others
+
+typedef struct
+{
+    cbox_work_func_t func;
+    cbox_work_func_t done;
+    struct list_head node;
+    void *arg;
+} cbox_strand_task_t;
+
+struct cbox_strand
+{
+    cbox_worker_t *worker;
+    cbox_worker_task_attr_t attr;
+    pthread_mutex_t mutex;
+    struct list_head task_list;
+    int scheduled;  //!< a turn is queued in the worker or running
+    int deleted;    //!< deleted during a turn, the turn frees the strand
+};
+
+extern int cbox_worker_push_task(cbox_worker_t *worker, const cbox_worker_task_attr_t *attr,
+                                 cbox_work_func_t func, cbox_work_func_t done, void *user);
+extern cbox_loop_t *cbox_worker_loop(cbox_worker_t *worker);
+
+static void cbox_strand_run(void *arg);
+
+cbox_strand_t *cbox_strand_new(cbox_worker_t *worker, const cbox_worker_task_attr_t *attr)
+{
+    static const cbox_worker_task_attr_t default_attr = CBOX_WORKER_TASK_ATTR_INITIALIZER;
+
+    if (worker == NULL)
+        return NULL;
+
+    cbox_strand_t *strand = (cbox_strand_t *)calloc(1, sizeof(cbox_strand_t));
+    if (strand == NULL)
+        return NULL;
+
+    strand->worker = worker;
+    strand->attr = attr ? *attr : default_attr;
+    strand->scheduled = 0;
+    strand->deleted = 0;
+    DQUEUE_CREATE(&strand->task_list);
+    pthread_mutex_init(&strand->mutex, NULL);
+
+    return strand;
+}
+
+static void cbox_strand_free(cbox_strand_t *strand)
+{
+    while (!DQUEUE_EMPTY(&strand->task_list)) {
+        cbox_strand_task_t *task = DQUEUE_POP_FRONT(&strand->task_list, cbox_strand_task_t, node);
+        CBOX_SAFETY_FREE(task);
+    }
+
+    pthread_mutex_destroy(&strand->mutex);
+    CBOX_SAFETY_FREE(strand);
+}
+
+void cbox_strand_delete(cbox_strand_t *strand)
+{
+    if (strand == NULL)
+        return;
+
+    pthread_mutex_lock(&strand->mutex);
+    if (strand->scheduled) {
+        strand->deleted = 1;
+        pthread_mutex_unlock(&strand->mutex);
+        return;
+    }
+    pthread_mutex_unlock(&strand->mutex);
+
+    cbox_strand_free(strand);
+}
+
+int cbox_strand_post(cbox_strand_t *strand, cbox_work_func_t func, cbox_work_func_t done, void *user)
+{
+    int ret = 0;
+
+    if (strand == NULL || func == NULL)
+        return -1;
+
+    cbox_strand_task_t *task = (cbox_strand_task_t *)malloc(sizeof(cbox_strand_task_t));
+    if (task == NULL)
+        return -1;
+
+    task->func = func;
+    task->done = done;
+    task->arg = user;
+
+    pthread_mutex_lock(&strand->mutex);
+    DQUEUE_PUSH_BACK(&task->node, &strand->task_list);
+
+    if (!strand->scheduled) {
+        ret = cbox_worker_push_task(strand->worker, &strand->attr, cbox_strand_run, NULL, strand);
+        if (ret == 0) {
+            strand->scheduled = 1;
+        } else {
+            list_del(&task->node);
+            CBOX_SAFETY_FREE(task);
+        }
+    }
+
+    pthread_mutex_unlock(&strand->mutex);
+    return ret;
+}
+
+static void cbox_strand_run(void *arg)
+{
+    cbox_strand_t *strand = (cbox_strand_t *)arg;
+    cbox_loop_t *loop = cbox_worker_loop(strand->worker);
+    int i = 0;
+
+    for (;;) {
+        for (i = 0; i < CBOX_STRAND_BATCH; ++i) {
+            pthread_mutex_lock(&strand->mutex);
+            if (strand->deleted || DQUEUE_EMPTY(&strand->task_list)) {
+                pthread_mutex_unlock(&strand->mutex);
+                break;
+            }
+
+            cbox_strand_task_t *task = DQUEUE_POP_FRONT(&strand->task_list, cbox_strand_task_t, node);
+            pthread_mutex_unlock(&strand->mutex);
+
+            task->func(task->arg);
+            if (task->done)
+                cbox_loop_delegate(loop, task->done, task->arg);
+
+            CBOX_SAFETY_FREE(task);
+        }
+
+        pthread_mutex_lock(&strand->mutex);
+        if (strand->deleted) {
+            pthread_mutex_unlock(&strand->mutex);
+            cbox_strand_free(strand);
+            return;
+        }
+
+        // the turn ends only when the queue is empty, scheduled stays set while tasks are left
+        if (DQUEUE_EMPTY(&strand->task_list)) {
+            strand->scheduled = 0;
+            pthread_mutex_unlock(&strand->mutex);
+            return;
+        }
+
+        // requeue the strand behind the others instead of holding the thread,
+        // if the worker refuses, e.g., it is full, keep running the tasks here
+        int ret = cbox_worker_push_task(strand->worker, &strand->attr, cbox_strand_run, NULL, strand);
+        pthread_mutex_unlock(&strand->mutex);
+        if (ret == 0)
+            return;
+    }
+}
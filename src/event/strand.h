@@ -0,0 +1,42 @@
+#ifndef _CBOX_EVENT_STRAND_H_
+#define _CBOX_EVENT_STRAND_H_
+
+#include "event/worker.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * A strand runs the tasks posted to it one by one in FIFO order on the threads
+ * of a shared worker, different strands run in parallel.
+ */
+typedef struct cbox_strand cbox_strand_t;
+
+/*
+ *@brief create a strand on the worker
+ *@param worker - the worker which runs the tasks, must outlive the strand
+ *@param attr - the attribute of the tasks pushed to the worker, NULL means default
+ */
+cbox_strand_t *cbox_strand_new(cbox_worker_t *worker, const cbox_worker_task_attr_t *attr);
+
+/*
+ *@brief delete the strand, the tasks not started yet are discarded,
+ *       the running one finishes in background
+ */
+void cbox_strand_delete(cbox_strand_t *strand);
+
+/*
+ *@brief post the task to the strand
+ *@param strand - the strand object
+ *@param task - the task to excute, never overlaps with the other tasks of the strand
+ *@param done - the callback to be excuted in loop thread when the task is done
+ *@param user - the user data
+ *@return 0: succeed, -1: failed
+ */
+int cbox_strand_post(cbox_strand_t *strand, cbox_work_func_t task, cbox_work_func_t done, void *user);
+
+#if defined (__cplusplus)
+}
+#endif
+#endif
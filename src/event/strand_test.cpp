@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "base/utils.h"
+#include "loop.h"
+#include "worker.h"
+#include "strand.h"
+
+#define STRAND_NUM (8)
+#define TASK_NUM (1000)
+
+class StrandTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        loop_ = cbox_loop_new();
+        worker_ = cbox_worker_new(loop_, 4);
+    }
+
+    void TearDown() override {
+        cbox_worker_delete(worker_);
+        cbox_loop_delete(loop_);
+    }
+
+public:
+    cbox_loop_t* loop_ = nullptr;
+    cbox_worker_t *worker_ = nullptr;
+};
+
+struct StrandContext {
+    StrandTest *test;
+    int running;
+    int overlapped;
+    int next;
+    int disorder;
+    int done;
+};
+
+static int g_strand_done = 0;
+
+static void strand_task(void *arg)
+{
+    StrandContext *ctx = (StrandContext *)arg;
+    if (__atomic_exchange_n(&ctx->running, 1, __ATOMIC_ACQ_REL))
+        ctx->overlapped ++;
+
+    ctx->next ++;
+    usleep(1);
+    __atomic_store_n(&ctx->running, 0, __ATOMIC_RELEASE);
+}
+
+static void strand_done(void *arg)
+{
+    StrandContext *ctx = (StrandContext *)arg;
+    EXPECT_EQ(cbox_utils_running_in_main(), 1);
+    if (++ctx->done == TASK_NUM && ++g_strand_done == STRAND_NUM)
+        cbox_loop_exit(ctx->test->loop_);
+}
+
+TEST_F(StrandTest, SerialInStrand) {
+    StrandContext ctxs[STRAND_NUM];
+    cbox_strand_t *strands[STRAND_NUM];
+    int i = 0, j = 0;
+
+    g_strand_done = 0;
+    memset(ctxs, 0, sizeof(ctxs));
+    for (i = 0; i < STRAND_NUM; ++i) {
+        ctxs[i].test = this;
+        strands[i] = cbox_strand_new(worker_, NULL);
+        ASSERT_TRUE(strands[i] != nullptr);
+    }
+
+    for (j = 0; j < TASK_NUM; ++j) {
+        for (i = 0; i < STRAND_NUM; ++i)
+            EXPECT_EQ(cbox_strand_post(strands[i], strand_task, strand_done, &ctxs[i]), 0);
+    }
+
+    cbox_loop_dispatch(loop_, CBOX_RUN_MODE_FOREVER);
+
+    for (i = 0; i < STRAND_NUM; ++i) {
+        EXPECT_EQ(ctxs[i].overlapped, 0);
+        EXPECT_EQ(ctxs[i].next, TASK_NUM);
+        EXPECT_EQ(ctxs[i].done, TASK_NUM);
+        cbox_strand_delete(strands[i]);
+    }
+}
+
+static int g_order[16];
+static int g_order_count = 0;
+
+static void order_task(void *arg)
+{
+    g_order[g_order_count ++] = (int)(intptr_t)arg;
+}
+
+TEST_F(StrandTest, Order) {
+    cbox_strand_t *strand = cbox_strand_new(worker_, NULL);
+    ASSERT_TRUE(strand != nullptr);
+    g_order_count = 0;
+
+    for (int i = 0; i < 16; ++i)
+        cbox_strand_post(strand, order_task, NULL, (void *)(intptr_t)i);
+
+    while (__atomic_load_n(&g_order_count, __ATOMIC_ACQUIRE) < 16)
+        usleep(1000);
+
+    for (int i = 0; i < 16; ++i)
+        EXPECT_EQ(g_order[i], i);
+
+    EXPECT_EQ(cbox_strand_post(strand, NULL, NULL, NULL), -1);
+    cbox_strand_delete(strand);
+}
@@ -0,0 +1,264 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "task_graph.h"
+#include "base/macros.h"
+#include "base/list.h"
+
+struct cbox_task_node
+{
+    struct list_head node;
+    cbox_task_graph_t *graph;
+    cbox_graph_func_t func;
+    void *user;
+    cbox_task_node_t **successors;
+    int successor_count;
+    int successor_capacity;
+    int dependencies;   //!< number of dependencies
+    int pending;        //!< dependencies not finished in current run, atomic
+};
+
+struct cbox_task_graph
+{
+    cbox_worker_t *worker;
+    struct list_head node_list;
+    int node_count;
+    int remaining;      //!< nodes not finished in current run, atomic
+    int status;         //!< atomic, first failure wins
+    int running;
+    cbox_graph_done_func_t done;
+    void *user;
+};
+
+extern int cbox_worker_push_task(cbox_worker_t *worker, const cbox_worker_task_attr_t *attr,
+                                 cbox_work_func_t func, cbox_work_func_t done, void *user);
+extern cbox_loop_t *cbox_worker_loop(cbox_worker_t *worker);
+
+static void cbox_task_graph_run_node(void *arg);
+
+cbox_task_graph_t *cbox_task_graph_new(cbox_worker_t *worker)
+{
+    if (worker == NULL)
+        return NULL;
+
+    cbox_task_graph_t *graph = (cbox_task_graph_t *)calloc(1, sizeof(cbox_task_graph_t));
+    if (graph == NULL)
+        return NULL;
+
+    graph->worker = worker;
+    INIT_LIST_HEAD(&graph->node_list);
+    return graph;
+}
+
+void cbox_task_graph_delete(cbox_task_graph_t *graph)
+{
+    cbox_task_node_t *pos = NULL, *tmp = NULL;
+
+    if (graph == NULL)
+        return;
+
+    list_for_each_entry_safe(pos, tmp, &graph->node_list, node) {
+        list_del(&pos->node);
+        CBOX_SAFETY_FREE(pos->successors);
+        CBOX_SAFETY_FREE(pos);
+    }
+
+    CBOX_SAFETY_FREE(graph);
+}
+
+cbox_task_node_t *cbox_task_graph_add(cbox_task_graph_t *graph, cbox_graph_func_t func, void *user)
+{
+    if (graph == NULL || func == NULL || graph->running)
+        return NULL;
+
+    cbox_task_node_t *node = (cbox_task_node_t *)calloc(1, sizeof(cbox_task_node_t));
+    if (node == NULL)
+        return NULL;
+
+    node->graph = graph;
+    node->func = func;
+    node->user = user;
+    list_add_tail(&node->node, &graph->node_list);
+    graph->node_count ++;
+    return node;
+}
+
+int cbox_task_graph_depend(cbox_task_graph_t *graph, cbox_task_node_t *node, cbox_task_node_t *dependency)
+{
+    if (graph == NULL || node == NULL || dependency == NULL || node == dependency ||
+            node->graph != graph || dependency->graph != graph || graph->running)
+        return -1;
+
+    if (dependency->successor_count >= dependency->successor_capacity) {
+        int capacity = dependency->successor_capacity ? dependency->successor_capacity * 2 : 4;
+        cbox_task_node_t **tmp = (cbox_task_node_t **)realloc(dependency->successors, sizeof(cbox_task_node_t *) * capacity);
+        if (tmp == NULL)
+            return -1;
+
+        dependency->successors = tmp;
+        dependency->successor_capacity = capacity;
+    }
+
+    dependency->successors[dependency->successor_count ++] = node;
+    node->dependencies ++;
+    return 0;
+}
+
+/*
+ * Kahn's algorithm, the graph is acyclic if every node can be reached from the roots
+ * return 1: has a cycle, 0: acyclic, -1: no memory to tell
+ */
+static int cbox_task_graph_has_cycle(cbox_task_graph_t *graph)
+{
+    cbox_task_node_t *pos = NULL;
+    int head = 0, tail = 0, i = 0;
+
+    cbox_task_node_t **ready = (cbox_task_node_t **)malloc(sizeof(cbox_task_node_t *) * graph->node_count);
+    if (ready == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    list_for_each_entry(pos, &graph->node_list, node) {
+        pos->pending = pos->dependencies;
+        if (pos->pending == 0)
+            ready[tail ++] = pos;
+    }
+
+    while (head < tail) {
+        cbox_task_node_t *node = ready[head ++];
+        for (i = 0; i < node->successor_count; ++i) {
+            if (--node->successors[i]->pending == 0)
+                ready[tail ++] = node->successors[i];
+        }
+    }
+
+    CBOX_SAFETY_FREE(ready);
+    return tail != graph->node_count ? 1 : 0;
+}
+
+static void cbox_task_graph_on_done(void *arg)
+{
+    cbox_task_graph_t *graph = (cbox_task_graph_t *)arg;
+    cbox_graph_done_func_t done = graph->done;
+
+    graph->running = 0;
+    if (done)
+        done(__atomic_load_n(&graph->status, __ATOMIC_ACQUIRE), graph->user);
+}
+
+static void cbox_task_graph_fail(cbox_task_graph_t *graph, int status)
+{
+    int expected = 0;
+    __atomic_compare_exchange_n(&graph->status, &expected, status, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static void cbox_task_graph_schedule(cbox_task_node_t *node)
+{
+    cbox_task_graph_t *graph = node->graph;
+
+    if (__atomic_load_n(&graph->status, __ATOMIC_ACQUIRE) == 0 &&
+            cbox_worker_push_task(graph->worker, NULL, cbox_task_graph_run_node, NULL, node) == 0)
+        return;
+
+    if (__atomic_load_n(&graph->status, __ATOMIC_ACQUIRE) == 0)
+        cbox_task_graph_fail(graph, -ENOMEM);
+
+    // cancelled, skip it here instead of another round through the worker
+    cbox_task_graph_run_node(node);
+}
+
+static void cbox_task_graph_run_node(void *arg)
+{
+    cbox_task_node_t *node = (cbox_task_node_t *)arg;
+    cbox_task_graph_t *graph = node->graph;
+    int i = 0;
+
+    while (node) {
+        cbox_task_node_t *next = NULL;
+
+        if (__atomic_load_n(&graph->status, __ATOMIC_ACQUIRE) == 0) {
+            int ret = node->func(node->user);
+            if (ret != 0)
+                cbox_task_graph_fail(graph, ret);
+        }
+
+        // keep the first ready successor in this thread, hand the others to the worker
+        for (i = 0; i < node->successor_count; ++i) {
+            cbox_task_node_t *successor = node->successors[i];
+            if (__atomic_sub_fetch(&successor->pending, 1, __ATOMIC_ACQ_REL) != 0)
+                continue;
+
+            if (next == NULL)
+                next = successor;
+            else
+                cbox_task_graph_schedule(successor);
+        }
+
+        if (__atomic_sub_fetch(&graph->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+            cbox_loop_delegate(cbox_worker_loop(graph->worker), cbox_task_graph_on_done, graph);
+
+        node = next;
+    }
+}
+
+int cbox_task_graph_run(cbox_task_graph_t *graph, cbox_graph_done_func_t done, void *user)
+{
+    cbox_task_node_t *pos = NULL;
+    int roots = 0, i = 0, cycle = 0;
+
+    if (graph == NULL || graph->running) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (graph->node_count > 0 && (cycle = cbox_task_graph_has_cycle(graph)) != 0) {
+        if (cycle > 0)
+            errno = ELOOP;
+        return -1;
+    }
+
+    graph->done = done;
+    graph->user = user;
+    graph->status = 0;
+    graph->running = 1;
+
+    if (graph->node_count == 0) {
+        cbox_loop_delegate(cbox_worker_loop(graph->worker), cbox_task_graph_on_done, graph);
+        return 0;
+    }
+
+    list_for_each_entry(pos, &graph->node_list, node) {
+        pos->pending = pos->dependencies;
+        if (pos->pending == 0)
+            roots ++;
+    }
+
+    __atomic_store_n(&graph->remaining, graph->node_count, __ATOMIC_RELEASE);
+
+    // collect the roots first, the scheduled nodes may change pending at once
+    cbox_task_node_t **ready = (cbox_task_node_t **)malloc(sizeof(cbox_task_node_t *) * roots);
+    if (ready == NULL) {
+        graph->running = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    roots = 0;
+    list_for_each_entry(pos, &graph->node_list, node) {
+        if (pos->dependencies == 0)
+            ready[roots ++] = pos;
+    }
+
+    for (i = 0; i < roots; ++i)
+        cbox_task_graph_schedule(ready[i]);
+
+    CBOX_SAFETY_FREE(ready);
+    return 0;
+}
+
+void cbox_task_graph_cancel(cbox_task_graph_t *graph)
+{
+    if (graph)
+        cbox_task_graph_fail(graph, -ECANCELED);
+}
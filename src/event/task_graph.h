@@ -0,0 +1,65 @@
+#ifndef _CBOX_EVENT_TASK_GRAPH_H_
+#define _CBOX_EVENT_TASK_GRAPH_H_
+
+#include "event/worker.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * A task graph runs tasks with dependencies on a worker, a task starts in the
+ * worker thread as soon as all its dependencies are finished, without going
+ * through the loop. A failed task or cbox_task_graph_cancel() skips all the
+ * tasks not started yet, and the done callback is called once in loop thread.
+ */
+typedef struct cbox_task_graph cbox_task_graph_t;
+typedef struct cbox_task_node cbox_task_node_t;
+
+/*
+ *@return 0: succeed, other value: failed, the graph is cancelled with this value as status
+ */
+typedef int (*cbox_graph_func_t)(void *user);
+
+/*
+ *@param status - 0: every task succeed, -ECANCELED: cancelled, other value: the first failure
+ */
+typedef void (*cbox_graph_done_func_t)(int status, void *user);
+
+cbox_task_graph_t *cbox_task_graph_new(cbox_worker_t *worker);
+
+/*
+ *@brief delete the graph, must not be running
+ */
+void cbox_task_graph_delete(cbox_task_graph_t *graph);
+
+/*
+ *@brief add a task to the graph, must not be running
+ *@return the task node, NULL: failed
+ */
+cbox_task_node_t *cbox_task_graph_add(cbox_task_graph_t *graph, cbox_graph_func_t func, void *user);
+
+/*
+ *@brief make node start after dependency is finished, must not be running
+ *@return 0: succeed, -1: failed
+ */
+int cbox_task_graph_depend(cbox_task_graph_t *graph, cbox_task_node_t *node, cbox_task_node_t *dependency);
+
+/*
+ *@brief start the graph, may be called again after done is called
+ *@param done - called in loop thread when all tasks are finished or skipped
+ *@return 0: succeed, -1: failed, errno is EINVAL if already running, ELOOP if it has a cycle,
+ *        ENOMEM if out of memory
+ */
+int cbox_task_graph_run(cbox_task_graph_t *graph, cbox_graph_done_func_t done, void *user);
+
+/*
+ *@brief cancel the running graph, can be called from any thread,
+ *       the running tasks finish, the others are skipped
+ */
+void cbox_task_graph_cancel(cbox_task_graph_t *graph);
+
+#if defined (__cplusplus)
+}
+#endif
+#endif
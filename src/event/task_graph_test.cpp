@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <unistd.h>
+#include "base/utils.h"
+#include "loop.h"
+#include "worker.h"
+#include "task_graph.h"
+
+#define BLOCK_NUM (64)
+#define STAGE_NUM (4)
+
+class TaskGraphTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        loop_ = cbox_loop_new();
+        worker_ = cbox_worker_new(loop_, 4);
+        graph_ = cbox_task_graph_new(worker_);
+    }
+
+    void TearDown() override {
+        cbox_task_graph_delete(graph_);
+        cbox_worker_delete(worker_);
+        cbox_loop_delete(loop_);
+    }
+
+public:
+    cbox_loop_t* loop_ = nullptr;
+    cbox_worker_t *worker_ = nullptr;
+    cbox_task_graph_t *graph_ = nullptr;
+    int status_ = 1;
+    int done_count_ = 0;
+    int ran_ = 0;
+    int stages_[BLOCK_NUM] = { 0 };
+    int disorder_ = 0;
+};
+
+struct StageContext {
+    TaskGraphTest *test;
+    int block;
+    int stage;
+    int result;
+};
+
+static int stage_task(void *arg)
+{
+    StageContext *ctx = (StageContext *)arg;
+    EXPECT_EQ(cbox_utils_running_in_main(), 0);
+    if (ctx->test->stages_[ctx->block] != ctx->stage)
+        __atomic_add_fetch(&ctx->test->disorder_, 1, __ATOMIC_RELAXED);
+
+    ctx->test->stages_[ctx->block] = ctx->stage + 1;
+    __atomic_add_fetch(&ctx->test->ran_, 1, __ATOMIC_RELAXED);
+
+    if (ctx->result == -ECANCELED)
+        return 0;
+
+    return ctx->result;
+}
+
+static int cancel_task(void *arg)
+{
+    StageContext *ctx = (StageContext *)arg;
+    __atomic_add_fetch(&ctx->test->ran_, 1, __ATOMIC_RELAXED);
+    cbox_task_graph_cancel(ctx->test->graph_);
+    return 0;
+}
+
+static void graph_done(int status, void *user)
+{
+    TaskGraphTest *self = (TaskGraphTest *)user;
+    EXPECT_EQ(cbox_utils_running_in_main(), 1);
+    self->status_ = status;
+    self->done_count_ ++;
+    cbox_loop_exit(self->loop_);
+}
+
+TEST_F(TaskGraphTest, Pipeline) {
+    static StageContext ctxs[BLOCK_NUM][STAGE_NUM];
+    for (int b = 0; b < BLOCK_NUM; ++b) {
+        cbox_task_node_t *prev = NULL;
+        for (int s = 0; s < STAGE_NUM; ++s) {
+            ctxs[b][s] = { this, b, s, 0 };
+            cbox_task_node_t *node = cbox_task_graph_add(graph_, stage_task, &ctxs[b][s]);
+            ASSERT_TRUE(node != nullptr);
+            if (prev) {
+                EXPECT_EQ(cbox_task_graph_depend(graph_, node, prev), 0);
+            }
+            prev = node;
+        }
+    }
+
+    EXPECT_EQ(cbox_task_graph_run(graph_, graph_done, this), 0);
+    EXPECT_EQ(cbox_task_graph_run(graph_, graph_done, this), -1);
+    cbox_loop_dispatch(loop_, CBOX_RUN_MODE_FOREVER);
+
+    EXPECT_EQ(status_, 0);
+    EXPECT_EQ(done_count_, 1);
+    EXPECT_EQ(ran_, BLOCK_NUM * STAGE_NUM);
+    EXPECT_EQ(disorder_, 0);
+}
+
+TEST_F(TaskGraphTest, Failure) {
+    StageContext a = { this, 0, 0, 0 }, b = { this, 0, 1, -5 }, c = { this, 1, 0, 0 }, d = { this, 0, 2, 0 };
+    cbox_task_node_t *na = cbox_task_graph_add(graph_, stage_task, &a);
+    cbox_task_node_t *nb = cbox_task_graph_add(graph_, stage_task, &b);
+    cbox_task_node_t *nc = cbox_task_graph_add(graph_, stage_task, &c);
+    cbox_task_node_t *nd = cbox_task_graph_add(graph_, stage_task, &d);
+
+    // diamond: a -> b, c -> d
+    EXPECT_EQ(cbox_task_graph_depend(graph_, nb, na), 0);
+    EXPECT_EQ(cbox_task_graph_depend(graph_, nc, na), 0);
+    EXPECT_EQ(cbox_task_graph_depend(graph_, nd, nb), 0);
+    EXPECT_EQ(cbox_task_graph_depend(graph_, nd, nc), 0);
+
+    EXPECT_EQ(cbox_task_graph_run(graph_, graph_done, this), 0);
+    cbox_loop_dispatch(loop_, CBOX_RUN_MODE_FOREVER);
+
+    EXPECT_EQ(status_, -5);
+    EXPECT_EQ(stages_[0], 2);
+    EXPECT_LE(ran_, 3);
+}
+
+TEST_F(TaskGraphTest, Cancel) {
+    StageContext a = { this, 0, 0, 0 }, b = { this, 0, 1, 0 };
+    cbox_task_node_t *na = cbox_task_graph_add(graph_, cancel_task, &a);
+    cbox_task_node_t *nb = cbox_task_graph_add(graph_, stage_task, &b);
+    EXPECT_EQ(cbox_task_graph_depend(graph_, nb, na), 0);
+
+    EXPECT_EQ(cbox_task_graph_run(graph_, graph_done, this), 0);
+    cbox_loop_dispatch(loop_, CBOX_RUN_MODE_FOREVER);
+
+    EXPECT_EQ(status_, -ECANCELED);
+    EXPECT_EQ(ran_, 1);
+
+    // run again after done
+    ran_ = 0;
+    EXPECT_EQ(cbox_task_graph_run(graph_, graph_done, this), 0);
+    cbox_loop_dispatch(loop_, CBOX_RUN_MODE_FOREVER);
+    EXPECT_EQ(done_count_, 2);
+    EXPECT_EQ(ran_, 1);
+}
+
+TEST_F(TaskGraphTest, Cycle) {
+    StageContext a = { this, 0, 0, 0 }, b = { this, 0, 1, 0 };
+    cbox_task_node_t *na = cbox_task_graph_add(graph_, stage_task, &a);
+    cbox_task_node_t *nb = cbox_task_graph_add(graph_, stage_task, &b);
+    EXPECT_EQ(cbox_task_graph_depend(graph_, nb, na), 0);
+    EXPECT_EQ(cbox_task_graph_depend(graph_, na, nb), 0);
+    EXPECT_EQ(cbox_task_graph_depend(graph_, na, na), -1);
+    errno = 0;
+    EXPECT_EQ(cbox_task_graph_run(graph_, graph_done, this), -1);
+    EXPECT_EQ(errno, ELOOP);
+}
@@ -2,50 +2,156 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
 #include "worker.h"
 #include "base/macros.h"
 #include "base/dqueue.h"
+#include "base/utils.h"
+
+#define CBOX_WORKER_DEFAULT_AGING_HIGH (0)
+#define CBOX_WORKER_DEFAULT_AGING_NORMAL (100)
+#define CBOX_WORKER_DEFAULT_AGING_LOW (1000)
 
 typedef struct
 {
     cbox_work_func_t func;
     cbox_work_func_t done;
     struct list_head node;
+    struct list_head age_node;  //!< linked in age_list if the task counts against the capacity
     void *arg;
+    uint64_t expired;   //!< effective deadline, used by the EDF pick
+    int priority;
+    int has_deadline;
+    unsigned int tag;
+    struct cbox_worker_stats_block *stats;  //!< set if enqueued with stats enabled
+    uint64_t enqueue_ns;
+    uint64_t finish_ns;
 } cbox_task_t;
 
+/*
+ * outlives the worker while done callbacks are on the way to the loop
+ */
+typedef struct cbox_worker_stats_block
+{
+    int refs;   //!< atomic
+    cbox_worker_stats_t stats;
+} cbox_worker_stats_block_t;
+
+typedef struct
+{
+    cbox_worker_watermark_func_t cb;
+    void *user;
+    size_t depth;
+    int high;
+} cbox_watermark_event_t;
+
 struct cbox_worker
 {
     cbox_loop_t *loop;
-    struct list_head task_list;
+    struct list_head task_list[CBOX_WORKER_PRIORITY_NUM];  //!< tasks without deadline, FIFO per priority
+    struct list_head deadline_list;                         //!< tasks with deadline, sorted by expired
+    struct list_head age_list;                              //!< bounded tasks in enqueue order, for dropping the oldest
+    uint64_t aging[CBOX_WORKER_PRIORITY_NUM];
+    size_t task_count;
+    size_t bounded_count;
+    size_t capacity;        //!< 0 means unlimited
+    cbox_worker_policy_t policy;
+    size_t high_watermark;
+    size_t low_watermark;
+    int above_watermark;
+    cbox_worker_watermark_func_t watermark_cb;
+    void *watermark_user;
     pthread_t *threads;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+    pthread_cond_t space_cond;  //!< signaled when a bounded task leaves the queue
     int max_worker;
     int exit;
+    int stats_enabled;  //!< atomic
+    cbox_worker_stats_block_t *stats;
+    int numa_node;              //!< preferred memory node of the threads, -1 means default
+    unsigned int numa_version;  //!< bumped on change, every thread applies it itself
 };
 
+typedef struct
+{
+    cbox_worker_t *worker;
+    size_t next;        //!< first index not grabbed yet, atomic
+    size_t end;
+    size_t grain;
+    size_t remaining;   //!< number of indexes not finished yet, atomic
+    int participants;
+    int refs;           //!< atomic
+    int finished;
+    cbox_parallel_func_t func;
+    cbox_parallel_map_func_t map;
+    cbox_parallel_reduce_func_t reduce;
+    void *result;
+    size_t result_size;
+    cbox_work_func_t done;
+    void *user;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned char identity[];
+} cbox_parallel_t;
+
 static void *cbox_worker_thread_func(void *arg);
 static void *cbox_worker_perform_thread_func(void *arg);
+int cbox_worker_push_task(cbox_worker_t *worker, const cbox_worker_task_attr_t *attr,
+                          cbox_work_func_t func, cbox_work_func_t done, void *user);
+cbox_loop_t *cbox_worker_loop(cbox_worker_t *worker);
+static int cbox_worker_submit(cbox_worker_t *worker, const cbox_worker_task_attr_t *attr,
+                              cbox_work_func_t func, cbox_work_func_t done, void *user, int bounded);
+static int cbox_worker_task_empty(cbox_worker_t *worker);
+static void cbox_worker_remove_task(cbox_worker_t *worker, cbox_task_t *task);
+static cbox_task_t *cbox_worker_pick_task(cbox_worker_t *worker);
+static void cbox_worker_stats_release(cbox_worker_stats_block_t *block);
+
+#define CBOX_STATS_ADD(field, n) __atomic_add_fetch(&(field), (n), __ATOMIC_RELAXED)
+
+static inline uint64_t cbox_worker_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
 
 
 cbox_worker_t *cbox_worker_new(cbox_loop_t *loop, unsigned int max_worker)
 {
     unsigned int i = 0;
-    cbox_worker_t *worker = (cbox_worker_t *)malloc(sizeof(cbox_worker_t));
+    cbox_worker_t *worker = (cbox_worker_t *)calloc(1, sizeof(cbox_worker_t));
     if (worker == NULL)
         goto CLEANUP;
 
     worker->exit = 0;
     worker->loop = loop;
     worker->max_worker = max_worker;
-    DQUEUE_CREATE(&worker->task_list);
+    for (i = 0; i < CBOX_WORKER_PRIORITY_NUM; ++i)
+        DQUEUE_CREATE(&worker->task_list[i]);
+    DQUEUE_CREATE(&worker->deadline_list);
+    DQUEUE_CREATE(&worker->age_list);
+    worker->policy = CBOX_WORKER_POLICY_BLOCK;
+    worker->numa_node = -1;
+    worker->numa_version = 0;
+
+    worker->stats = (cbox_worker_stats_block_t *)calloc(1, sizeof(cbox_worker_stats_block_t));
+    if (worker->stats == NULL)
+        goto CLEANUP;
+    worker->stats->refs = 1;
+
+    worker->aging[CBOX_WORKER_PRIORITY_HIGH] = CBOX_WORKER_DEFAULT_AGING_HIGH;
+    worker->aging[CBOX_WORKER_PRIORITY_NORMAL] = CBOX_WORKER_DEFAULT_AGING_NORMAL;
+    worker->aging[CBOX_WORKER_PRIORITY_LOW] = CBOX_WORKER_DEFAULT_AGING_LOW;
 
     if (worker->max_worker <= 0)
         goto CLEANUP;
 
     pthread_mutex_init(&worker->mutex, NULL);
     pthread_cond_init(&worker->cond, NULL);
+    pthread_cond_init(&worker->space_cond, NULL);
 
     worker->threads = (pthread_t *)malloc(sizeof(pthread_t) * max_worker);
     if (worker->threads == NULL)
@@ -58,65 +164,654 @@ cbox_worker_t *cbox_worker_new(cbox_loop_t *loop, unsigned int max_worker)
     return worker;
 
 CLEANUP:
-    CBOX_SAFETY_FREE(worker->threads);
+    if (worker) {
+        CBOX_SAFETY_FREE(worker->threads);
+        CBOX_SAFETY_FREE(worker->stats);
+    }
     CBOX_SAFETY_FREE(worker);
     return NULL;
 }
 
 void cbox_worker_delete(cbox_worker_t *worker)
 {
-   int i = 0;
+    int i = 0;
     if (worker == NULL)
         return;
 
+    pthread_mutex_lock(&worker->mutex);
     worker->exit = 1;
-
     pthread_cond_broadcast(&worker->cond);
+    pthread_cond_broadcast(&worker->space_cond);
+    pthread_mutex_unlock(&worker->mutex);
 
     for (i = 0; i < worker->max_worker; ++i)
         pthread_join(worker->threads[i], NULL);
 
     CBOX_SAFETY_FREE(worker->threads);
+
     pthread_cond_destroy(&worker->cond);
+    pthread_cond_destroy(&worker->space_cond);
     pthread_mutex_destroy(&worker->mutex);
 
-    while(!DQUEUE_EMPTY(&worker->task_list)) {
-        cbox_task_t *task = DQUEUE_POP_FRONT(&worker->task_list, cbox_task_t, node);
-        CBOX_SAFETY_FREE(task);
-    }
-
+    cbox_worker_stats_release(worker->stats);
     CBOX_SAFETY_FREE(worker);
 }
 
-void cbox_worker_enqueue_task(cbox_worker_t *worker, cbox_work_func_t func, cbox_work_func_t done, void *user)
+int cbox_worker_enqueue_task(cbox_worker_t *worker, cbox_work_func_t func, cbox_work_func_t done, void *user)
 {
-    pthread_mutex_lock(&worker->mutex);
+    return cbox_worker_submit(worker, NULL, func, done, user, 1);
+}
+
+int cbox_worker_enqueue_task_with_attr(cbox_worker_t *worker, const cbox_worker_task_attr_t *attr,
+                                       cbox_work_func_t func, cbox_work_func_t done, void *user)
+{
+    return cbox_worker_submit(worker, attr, func, done, user, 1);
+}
+
+/*
+ * used by strand, task graph and parallel helpers, their tasks never block,
+ * get rejected or dropped, otherwise they would hang
+ */
+int cbox_worker_push_task(cbox_worker_t *worker, const cbox_worker_task_attr_t *attr,
+                          cbox_work_func_t func, cbox_work_func_t done, void *user)
+{
+    return cbox_worker_submit(worker, attr, func, done, user, 0);
+}
+
+static void cbox_worker_on_watermark(void *arg)
+{
+    cbox_watermark_event_t *event = (cbox_watermark_event_t *)arg;
+    event->cb(event->depth, event->high, event->user);
+    CBOX_SAFETY_FREE(event);
+}
+
+/*
+ * must be called with mutex locked
+ */
+static void cbox_worker_check_watermark(cbox_worker_t *worker)
+{
+    int high = 0;
+
+    if (worker->watermark_cb == NULL || worker->high_watermark == 0)
+        return;
+
+    if (!worker->above_watermark && worker->task_count >= worker->high_watermark)
+        high = 1;
+    else if (worker->above_watermark && worker->task_count <= worker->low_watermark)
+        high = 0;
+    else
+        return;
+
+    cbox_watermark_event_t *event = (cbox_watermark_event_t *)malloc(sizeof(cbox_watermark_event_t));
+    if (event == NULL)
+        return;
+
+    worker->above_watermark = high;
+    event->cb = worker->watermark_cb;
+    event->user = worker->watermark_user;
+    event->depth = worker->task_count;
+    event->high = high;
+    cbox_loop_delegate(worker->loop, cbox_worker_on_watermark, event);
+}
+
+static int cbox_worker_submit(cbox_worker_t *worker, const cbox_worker_task_attr_t *attr,
+                              cbox_work_func_t func, cbox_work_func_t done, void *user, int bounded)
+{
+    static const cbox_worker_task_attr_t default_attr = CBOX_WORKER_TASK_ATTR_INITIALIZER;
+    struct list_head *pos = NULL;
+
+    if (worker == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (attr == NULL)
+        attr = &default_attr;
+
     cbox_task_t *task = (cbox_task_t *)malloc(sizeof(cbox_task_t));
     if (task == NULL)
-        goto END;
+        return -1;
 
     task->arg = user;
     task->done = done;
     task->func = func;
+    task->priority = (attr->priority >= CBOX_WORKER_PRIORITY_HIGH && attr->priority < CBOX_WORKER_PRIORITY_NUM) ?
+                        attr->priority : CBOX_WORKER_PRIORITY_NORMAL;
+    task->has_deadline = (attr->deadline != 0);
+    task->tag = attr->tag < CBOX_WORKER_TAG_NUM ? attr->tag : 0;
+    task->stats = NULL;
+    task->enqueue_ns = 0;
+    task->finish_ns = 0;
+
+    INIT_LIST_HEAD(&task->age_node);
+
+    pthread_mutex_lock(&worker->mutex);
+
+    while (bounded && worker->capacity > 0 && worker->bounded_count >= worker->capacity) {
+        if (worker->policy == CBOX_WORKER_POLICY_BLOCK && !worker->exit) {
+            pthread_cond_wait(&worker->space_cond, &worker->mutex);
+            continue;
+        }
+
+        if (worker->policy == CBOX_WORKER_POLICY_DROP_OLDEST) {
+            cbox_task_t *oldest = list_entry(worker->age_list.next, cbox_task_t, age_node);
+            cbox_worker_remove_task(worker, oldest);
+            if (oldest->stats)
+                CBOX_STATS_ADD(oldest->stats->stats.dropped, 1);
+            CBOX_SAFETY_FREE(oldest);
+            continue;
+        }
+
+        int caller_runs = (worker->policy == CBOX_WORKER_POLICY_CALLER_RUNS && !worker->exit);
+        int exiting = worker->exit;
+        pthread_mutex_unlock(&worker->mutex);
+        CBOX_SAFETY_FREE(task);
+
+        if (__atomic_load_n(&worker->stats_enabled, __ATOMIC_RELAXED)) {
+            if (caller_runs)
+                CBOX_STATS_ADD(worker->stats->stats.caller_runs, 1);
+            else
+                CBOX_STATS_ADD(worker->stats->stats.rejected, 1);
+        }
+
+        if (caller_runs) {
+            if (func)
+                func(user);
+            if (done)
+                cbox_loop_delegate(worker->loop, done, user);
+            return 0;
+        }
+
+        errno = exiting ? ECANCELED : EAGAIN;
+        return -1;
+    }
+
+    uint64_t now = CBOX_CURRENT_CLOCK_MILLISECONDS();
+
+    if (__atomic_load_n(&worker->stats_enabled, __ATOMIC_RELAXED)) {
+        task->stats = worker->stats;
+        task->enqueue_ns = cbox_worker_now_ns();
+        CBOX_STATS_ADD(worker->stats->stats.enqueued, 1);
+    }
+
+    if (attr->deadline == 0) {
+        task->expired = now + worker->aging[task->priority];
+        DQUEUE_PUSH_BACK(&task->node, &worker->task_list[task->priority]);
+    } else {
+        // deadlines mostly come in order, search the insert position from the tail
+        task->expired = now + attr->deadline;
+        for (pos = worker->deadline_list.prev; pos != &worker->deadline_list; pos = pos->prev) {
+            if (list_entry(pos, cbox_task_t, node)->expired <= task->expired)
+                break;
+        }
+        list_add(&task->node, pos);
+    }
+
+    if (bounded) {
+        DQUEUE_PUSH_BACK(&task->age_node, &worker->age_list);
+        worker->bounded_count ++;
+    }
+
+    worker->task_count ++;
+    cbox_worker_check_watermark(worker);
 
-    DQUEUE_PUSH_BACK(&task->node, &worker->task_list);
     pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+    return 0;
+}
+
+int cbox_worker_set_aging(cbox_worker_t *worker, cbox_worker_priority_t priority, uint64_t miliseconds)
+{
+    if (worker == NULL || priority < CBOX_WORKER_PRIORITY_HIGH || priority >= CBOX_WORKER_PRIORITY_NUM)
+        return -1;
 
-END:
+    pthread_mutex_lock(&worker->mutex);
+    worker->aging[priority] = miliseconds;
     pthread_mutex_unlock(&worker->mutex);
+    return 0;
+}
 
+int cbox_worker_set_capacity(cbox_worker_t *worker, size_t capacity, cbox_worker_policy_t policy)
+{
+    if (worker == NULL || policy < CBOX_WORKER_POLICY_BLOCK || policy > CBOX_WORKER_POLICY_CALLER_RUNS)
+        return -1;
+
+    pthread_mutex_lock(&worker->mutex);
+    worker->capacity = capacity;
+    worker->policy = policy;
+    pthread_cond_broadcast(&worker->space_cond);
+    pthread_mutex_unlock(&worker->mutex);
+    return 0;
+}
+
+int cbox_worker_set_watermark(cbox_worker_t *worker, size_t high, size_t low, cbox_worker_watermark_func_t cb, void *user)
+{
+    if (worker == NULL || (cb != NULL && (high == 0 || low >= high)))
+        return -1;
+
+    pthread_mutex_lock(&worker->mutex);
+    worker->high_watermark = high;
+    worker->low_watermark = low;
+    worker->watermark_cb = cb;
+    worker->watermark_user = user;
+    worker->above_watermark = 0;
+    pthread_mutex_unlock(&worker->mutex);
+    return 0;
+}
+
+size_t cbox_worker_queue_depth(cbox_worker_t *worker)
+{
+    size_t depth = 0;
+
+    if (worker == NULL)
+        return 0;
+
+    pthread_mutex_lock(&worker->mutex);
+    depth = worker->task_count;
+    pthread_mutex_unlock(&worker->mutex);
+    return depth;
+}
+
+int cbox_worker_set_stats(cbox_worker_t *worker, int enable)
+{
+    if (worker == NULL)
+        return -1;
+
+    __atomic_store_n(&worker->stats_enabled, enable ? 1 : 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void cbox_worker_histogram_copy(cbox_worker_histogram_t *dst, cbox_worker_histogram_t *src)
+{
+    int i = 0;
+    dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum = __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    dst->max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    for (i = 0; i < CBOX_WORKER_HISTOGRAM_BUCKETS; ++i)
+        dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+}
+
+static void cbox_worker_latency_copy(cbox_worker_latency_t *dst, cbox_worker_latency_t *src)
+{
+    cbox_worker_histogram_copy(&dst->wait, &src->wait);
+    cbox_worker_histogram_copy(&dst->run, &src->run);
+    cbox_worker_histogram_copy(&dst->delivery, &src->delivery);
+}
+
+int cbox_worker_stats_get(cbox_worker_t *worker, cbox_worker_stats_t *stats)
+{
+    int i = 0;
+
+    if (worker == NULL || stats == NULL)
+        return -1;
+
+    cbox_worker_stats_t *src = &worker->stats->stats;
+    stats->enqueued = __atomic_load_n(&src->enqueued, __ATOMIC_RELAXED);
+    stats->completed = __atomic_load_n(&src->completed, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&src->rejected, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&src->dropped, __ATOMIC_RELAXED);
+    stats->caller_runs = __atomic_load_n(&src->caller_runs, __ATOMIC_RELAXED);
+    stats->deadline_missed = __atomic_load_n(&src->deadline_missed, __ATOMIC_RELAXED);
+    stats->depth = cbox_worker_queue_depth(worker);
+
+    cbox_worker_latency_copy(&stats->total, &src->total);
+    for (i = 0; i < CBOX_WORKER_TAG_NUM; ++i)
+        cbox_worker_latency_copy(&stats->tags[i], &src->tags[i]);
+
+    return 0;
+}
+
+void cbox_worker_stats_reset(cbox_worker_t *worker)
+{
+    if (worker == NULL)
+        return;
+
+    // racing updates may survive the reset, it is only used between measurements
+    memset(&worker->stats->stats, 0, sizeof(worker->stats->stats));
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+uint64_t cbox_worker_histogram_percentile(const cbox_worker_histogram_t *histogram, double percentile)
+{
+    uint64_t seen = 0, target = 0;
+    int i = 0;
+
+    if (histogram == NULL || histogram->count == 0 || percentile <= 0)
+        return 0;
+
+    target = (uint64_t)(histogram->count * (percentile > 100 ? 100 : percentile) / 100.0 + 0.5);
+    if (target == 0)
+        target = 1;
+
+    for (i = 0; i < CBOX_WORKER_HISTOGRAM_BUCKETS - 1; ++i) {
+        seen += histogram->buckets[i];
+        if (seen >= target)
+            return i == 0 ? 1 : (1ull << i);
+    }
+
+    return histogram->max;
+}
+
+static void cbox_worker_histogram_add(cbox_worker_histogram_t *histogram, uint64_t us)
+{
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+    if (bucket >= CBOX_WORKER_HISTOGRAM_BUCKETS)
+        bucket = CBOX_WORKER_HISTOGRAM_BUCKETS - 1;
+
+    CBOX_STATS_ADD(histogram->count, 1);
+    CBOX_STATS_ADD(histogram->sum, us);
+    CBOX_STATS_ADD(histogram->buckets[bucket], 1);
+
+    while (us > max && !__atomic_compare_exchange_n(&histogram->max, &max, us, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ *@param which - offset of the histogram in cbox_worker_latency_t
+ */
+static void cbox_worker_stats_record(cbox_task_t *task, size_t which, uint64_t ns)
+{
+    cbox_worker_stats_t *stats = &task->stats->stats;
+    cbox_worker_histogram_add((cbox_worker_histogram_t *)((char *)&stats->total + which), ns / 1000);
+    cbox_worker_histogram_add((cbox_worker_histogram_t *)((char *)&stats->tags[task->tag] + which), ns / 1000);
+}
+
+static void cbox_worker_stats_release(cbox_worker_stats_block_t *block)
+{
+    if (block && __atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        CBOX_SAFETY_FREE(block);
+}
+
+static void cbox_worker_on_task_done(void *arg)
+{
+    cbox_task_t *task = (cbox_task_t *)arg;
+
+    cbox_worker_stats_record(task, offsetof(cbox_worker_latency_t, delivery), cbox_worker_now_ns() - task->finish_ns);
+    task->done(task->arg);
+
+    cbox_worker_stats_release(task->stats);
+    CBOX_SAFETY_FREE(task);
+}
+
+static void cbox_worker_run_task(cbox_worker_t *worker, cbox_task_t *task)
+{
+    uint64_t start_ns = 0;
+
+    if (task->stats == NULL) {
+        if (task->func)
+            task->func(task->arg);
+        if (task->done)
+            cbox_loop_delegate(worker->loop, task->done, task->arg);
+        CBOX_SAFETY_FREE(task);
+        return;
+    }
+
+    start_ns = cbox_worker_now_ns();
+    if (task->has_deadline && start_ns / 1000000 > task->expired)
+        CBOX_STATS_ADD(task->stats->stats.deadline_missed, 1);
+    cbox_worker_stats_record(task, offsetof(cbox_worker_latency_t, wait), start_ns - task->enqueue_ns);
+
+    if (task->func)
+        task->func(task->arg);
+
+    task->finish_ns = cbox_worker_now_ns();
+    cbox_worker_stats_record(task, offsetof(cbox_worker_latency_t, run), task->finish_ns - start_ns);
+    CBOX_STATS_ADD(task->stats->stats.completed, 1);
+
+    if (task->done) {
+        // the task is freed in loop thread, hold the stats for it
+        __atomic_add_fetch(&task->stats->refs, 1, __ATOMIC_RELAXED);
+        cbox_loop_delegate(worker->loop, cbox_worker_on_task_done, task);
+        return;
+    }
+
+    CBOX_SAFETY_FREE(task);
+}
+
+int cbox_worker_set_affinity(cbox_worker_t *worker, const char *cpulist)
+{
+    if (worker == NULL || cpulist == NULL)
+        return -1;
+
+    return cbox_utils_set_threads_affinity(worker->threads, worker->max_worker, cpulist);
+}
+
+int cbox_worker_set_numa_node(cbox_worker_t *worker, int node)
+{
+    char cpulist[256];
+
+    if (worker == NULL || node < 0 || cbox_utils_numa_node_cpulist(node, cpulist, sizeof(cpulist)) != 0)
+        return -1;
+
+    if (cbox_worker_set_affinity(worker, cpulist) != 0)
+        return -1;
+
+    pthread_mutex_lock(&worker->mutex);
+    worker->numa_node = node;
+    worker->numa_version ++;
+    pthread_cond_broadcast(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+
+    return 0;
+}
+
+cbox_loop_t *cbox_worker_loop(cbox_worker_t *worker)
+{
+    if (worker)
+        return worker->loop;
+
+    return NULL;
+}
+
+static void cbox_parallel_release(cbox_parallel_t *ctx)
+{
+    if (__atomic_sub_fetch(&ctx->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    pthread_cond_destroy(&ctx->cond);
+    pthread_mutex_destroy(&ctx->mutex);
+    CBOX_SAFETY_FREE(ctx);
+}
+
+/*
+ * guided self-scheduling: every grab takes a share of what is left,
+ * so the chunks are big at first and shrink to grain near the end
+ */
+static int cbox_parallel_grab(cbox_parallel_t *ctx, size_t *begin, size_t *end)
+{
+    size_t cur = __atomic_load_n(&ctx->next, __ATOMIC_RELAXED);
+    size_t size = 0;
+
+    do {
+        if (cur >= ctx->end)
+            return 0;
+
+        size = (ctx->end - cur) / (2 * ctx->participants);
+        if (size < ctx->grain)
+            size = ctx->grain;
+        if (size > ctx->end - cur)
+            size = ctx->end - cur;
+    } while (!__atomic_compare_exchange_n(&ctx->next, &cur, cur + size, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    *begin = cur;
+    *end = cur + size;
+    return 1;
+}
+
+static void cbox_parallel_run(void *arg)
+{
+    cbox_parallel_t *ctx = (cbox_parallel_t *)arg;
+    size_t begin = 0, end = 0, finished = 0;
+    void *acc = NULL;
+
+    if (ctx->map) {
+        acc = malloc(ctx->result_size);
+        // without accumulator run nothing, the others will take the chunks
+        if (acc == NULL)
+            goto RELEASE;
+
+        memcpy(acc, ctx->identity, ctx->result_size);
+    }
+
+    while (cbox_parallel_grab(ctx, &begin, &end)) {
+        if (ctx->map)
+            ctx->map(begin, end, acc, ctx->user);
+        else
+            ctx->func(begin, end, ctx->user);
+
+        finished += end - begin;
+    }
+
+    if (finished == 0)
+        goto RELEASE;
+
+    if (ctx->map) {
+        pthread_mutex_lock(&ctx->mutex);
+        ctx->reduce(ctx->result, acc, ctx->user);
+        pthread_mutex_unlock(&ctx->mutex);
+    }
+
+    if (__atomic_sub_fetch(&ctx->remaining, finished, __ATOMIC_ACQ_REL) == 0) {
+        if (ctx->done) {
+            cbox_loop_delegate(ctx->worker->loop, ctx->done, ctx->user);
+        } else {
+            pthread_mutex_lock(&ctx->mutex);
+            ctx->finished = 1;
+            pthread_cond_broadcast(&ctx->cond);
+            pthread_mutex_unlock(&ctx->mutex);
+        }
+    }
+
+RELEASE:
+    CBOX_SAFETY_FREE(acc);
+    cbox_parallel_release(ctx);
+}
+
+static int cbox_parallel_start(cbox_worker_t *worker, size_t begin, size_t end, size_t grain,
+                               cbox_parallel_func_t func, cbox_parallel_map_func_t map, cbox_parallel_reduce_func_t reduce,
+                               void *result, size_t result_size, cbox_work_func_t done, void *user)
+{
+    int i = 0, helpers = 0, async = (done != NULL);
+
+    if (worker == NULL || (func == NULL && (map == NULL || reduce == NULL || result == NULL || result_size == 0)))
+        return -1;
+
+    if (begin >= end) {
+        if (async)
+            cbox_loop_delegate(worker->loop, done, user);
+        return 0;
+    }
+
+    cbox_parallel_t *ctx = (cbox_parallel_t *)calloc(1, sizeof(cbox_parallel_t) + (map ? result_size : 0));
+    if (ctx == NULL)
+        return -1;
+
+    ctx->worker = worker;
+    ctx->next = begin;
+    ctx->end = end;
+    ctx->grain = grain ? grain : 1;
+    ctx->remaining = end - begin;
+    ctx->func = func;
+    ctx->map = map;
+    ctx->reduce = reduce;
+    ctx->result = result;
+    ctx->result_size = result_size;
+    ctx->done = done;
+    ctx->user = user;
+    if (map)
+        memcpy(ctx->identity, result, result_size);
+    pthread_mutex_init(&ctx->mutex, NULL);
+    pthread_cond_init(&ctx->cond, NULL);
+
+    // the blocking caller takes part in the work, so it never waits on a busy pool
+    size_t chunks = (end - begin + ctx->grain - 1) / ctx->grain;
+    helpers = worker->max_worker;
+    if (!async && chunks - 1 < (size_t)helpers)
+        helpers = (int)(chunks - 1);
+    else if (async && chunks < (size_t)helpers)
+        helpers = (int)chunks;
+
+    // the blocking caller holds one more reference for waiting on the context
+    ctx->participants = helpers + (async ? 0 : 1);
+    ctx->refs = ctx->participants + (async ? 0 : 1);
+
+    for (i = 0; i < helpers; ++i) {
+        if (cbox_worker_push_task(worker, NULL, cbox_parallel_run, NULL, ctx) != 0)
+            break;
+    }
+
+    // give back the references of the helpers we failed to enqueue
+    for (; i < helpers; ++i) {
+        if (async && i == 0) {
+            // nobody runs the chunks, do them here
+            __atomic_add_fetch(&ctx->refs, 1, __ATOMIC_RELAXED);
+            cbox_parallel_run(ctx);
+        }
+        cbox_parallel_release(ctx);
+    }
+
+    if (async)
+        return 0;
+
+    cbox_parallel_run(ctx);
+
+    pthread_mutex_lock(&ctx->mutex);
+    while (!ctx->finished)
+        pthread_cond_wait(&ctx->cond, &ctx->mutex);
+    pthread_mutex_unlock(&ctx->mutex);
+
+    cbox_parallel_release(ctx);
+    return 0;
+}
+
+int cbox_worker_parallel_for(cbox_worker_t *worker, size_t begin, size_t end, size_t grain, cbox_parallel_func_t fn, void *user)
+{
+    return cbox_parallel_start(worker, begin, end, grain, fn, NULL, NULL, NULL, 0, NULL, user);
+}
+
+int cbox_worker_parallel_for_async(cbox_worker_t *worker, size_t begin, size_t end, size_t grain,
+                                   cbox_parallel_func_t fn, cbox_work_func_t done, void *user)
+{
+    if (done == NULL)
+        return -1;
+
+    return cbox_parallel_start(worker, begin, end, grain, fn, NULL, NULL, NULL, 0, done, user);
+}
+
+int cbox_worker_parallel_reduce(cbox_worker_t *worker, size_t begin, size_t end, size_t grain,
+                                cbox_parallel_map_func_t map, cbox_parallel_reduce_func_t reduce,
+                                void *result, size_t result_size, void *user)
+{
+    return cbox_parallel_start(worker, begin, end, grain, NULL, map, reduce, result, result_size, NULL, user);
+}
+
+int cbox_worker_parallel_reduce_async(cbox_worker_t *worker, size_t begin, size_t end, size_t grain,
+                                      cbox_parallel_map_func_t map, cbox_parallel_reduce_func_t reduce,
+                                      void *result, size_t result_size, cbox_work_func_t done, void *user)
+{
+    if (done == NULL)
+        return -1;
+
+    return cbox_parallel_start(worker, begin, end, grain, NULL, map, reduce, result, result_size, done, user);
 }
 
 cbox_perform_task_t *cbox_worker_perform_task(cbox_work_func_t func, void *user)
 {
     cbox_task_t *task = (cbox_task_t *)malloc(sizeof(cbox_task_t));
+    if (task == NULL)
+        return NULL;
+
     task->arg = user;
     task->func = func;
     task->done = NULL;
 
     pthread_t *thread = (pthread_t *)malloc(sizeof(pthread_t));
-    if (thread == NULL)
+    if (thread == NULL) {
+        CBOX_SAFETY_FREE(task);
         return NULL;
+    }
 
     pthread_attr_t attr;
     pthread_attr_init(&attr);
@@ -133,30 +828,101 @@ void cbox_worker_perform_wait_task_done(cbox_perform_task_t *task)
 
     pthread_t *thread = (pthread_t *)task;
     pthread_join(*thread, NULL);
+    CBOX_SAFETY_FREE(thread);
+}
+
+static int cbox_worker_task_empty(cbox_worker_t *worker)
+{
+    int i = 0;
+    for (i = 0; i < CBOX_WORKER_PRIORITY_NUM; ++i) {
+        if (!DQUEUE_EMPTY(&worker->task_list[i]))
+            return 0;
+    }
+
+    return DQUEUE_EMPTY(&worker->deadline_list);
+}
+
+/*
+ * every list is already ordered by expired, so the EDF pick only compares the heads,
+ * on a tie the deadline task wins, then the higher priority
+ */
+static cbox_task_t *cbox_worker_pick_task(cbox_worker_t *worker)
+{
+    int i = 0;
+    struct list_head *head = NULL;
+    cbox_task_t *task = NULL;
+
+    if (!DQUEUE_EMPTY(&worker->deadline_list)) {
+        head = &worker->deadline_list;
+        task = DQUEUE_FRONT(head, cbox_task_t, node);
+    }
+
+    for (i = 0; i < CBOX_WORKER_PRIORITY_NUM; ++i) {
+        if (DQUEUE_EMPTY(&worker->task_list[i]))
+            continue;
+
+        cbox_task_t *front = DQUEUE_FRONT(&worker->task_list[i], cbox_task_t, node);
+        if (task == NULL || front->expired < task->expired) {
+            head = &worker->task_list[i];
+            task = front;
+        }
+    }
+
+    if (head == NULL)
+        return NULL;
+
+    cbox_worker_remove_task(worker, task);
+    return task;
+}
+
+/*
+ * must be called with mutex locked
+ */
+static void cbox_worker_remove_task(cbox_worker_t *worker, cbox_task_t *task)
+{
+    list_del_init(&task->node);
+
+    if (!list_empty(&task->age_node)) {
+        list_del_init(&task->age_node);
+        worker->bounded_count --;
+        pthread_cond_signal(&worker->space_cond);
+    }
+
+    worker->task_count --;
+    cbox_worker_check_watermark(worker);
 }
 
 static void *cbox_worker_thread_func(void *arg)
 {
     cbox_worker_t *worker = (cbox_worker_t *)arg;
-    while (!worker->exit) {
+    unsigned int numa_version = 0;
+
+    for (;;) {
         pthread_mutex_lock(&worker->mutex);
-        if (DQUEUE_EMPTY(&worker->task_list))
+        for (;;) {
+            // the memory policy is per thread, so every thread sets its own
+            if (numa_version != worker->numa_version) {
+                numa_version = worker->numa_version;
+                cbox_utils_set_numa_preferred(worker->numa_node);
+            }
+
+            if (worker->exit || !cbox_worker_task_empty(worker))
+                break;
+
             pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
 
-        if (DQUEUE_EMPTY(&worker->task_list) || worker->exit) {
+        // drain the queue before exiting, a strand turn or a graph node may push more
+        if (worker->exit && cbox_worker_task_empty(worker)) {
             pthread_mutex_unlock(&worker->mutex);
             return NULL;
         }
 
-        cbox_task_t *task = DQUEUE_POP_FRONT(&worker->task_list, cbox_task_t, node);
+        cbox_task_t *task = cbox_worker_pick_task(worker);
         pthread_mutex_unlock(&worker->mutex);
 
-        if (task && task->func) {
-            task->func(task->arg);
-            if (task->done)
-                cbox_loop_delegate(worker->loop, task->done, task->arg);
-        }
-        CBOX_SAFETY_FREE(task);
+        if (task)
+            cbox_worker_run_task(worker, task);
     }
 
     return NULL;
@@ -164,7 +930,7 @@ static void *cbox_worker_thread_func(void *arg)
 
 static void *cbox_worker_perform_thread_func(void *arg)
 {
-    cbox_task_t *task = (cbox_task_t *)arg; 
+    cbox_task_t *task = (cbox_task_t *)arg;
     if (task && task->func)
         task->func(task->arg);
 
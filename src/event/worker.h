@@ -10,8 +10,85 @@ typedef struct cbox_worker cbox_worker_t;
 typedef void cbox_perform_task_t;
 
 typedef void (*cbox_work_func_t)(void *user);
+typedef void (*cbox_parallel_func_t)(size_t begin, size_t end, void *user);
+typedef void (*cbox_parallel_map_func_t)(size_t begin, size_t end, void *acc, void *user);
+typedef void (*cbox_parallel_reduce_func_t)(void *acc, const void *partial, void *user);
+
+/*
+ *@param depth - number of queued tasks
+ *@param high - 1: depth reached the high watermark, 0: depth fell back to the low watermark
+ */
+typedef void (*cbox_worker_watermark_func_t)(size_t depth, int high, void *user);
+
+typedef enum {
+    CBOX_WORKER_PRIORITY_HIGH = 0,
+    CBOX_WORKER_PRIORITY_NORMAL,
+    CBOX_WORKER_PRIORITY_LOW,
+    CBOX_WORKER_PRIORITY_NUM
+} cbox_worker_priority_t;
+
+#define CBOX_WORKER_TAG_NUM (8)
+#define CBOX_WORKER_HISTOGRAM_BUCKETS (32)
+
+typedef struct
+{
+    cbox_worker_priority_t priority;    //!< default: CBOX_WORKER_PRIORITY_NORMAL
+    uint64_t deadline;                  //!< relative deadline in miliseconds, 0 means no deadline
+    unsigned int tag;                   //!< breakdown of the stats, [0, CBOX_WORKER_TAG_NUM), default: 0
+} cbox_worker_task_attr_t;
+
+#define CBOX_WORKER_TASK_ATTR_INITIALIZER { CBOX_WORKER_PRIORITY_NORMAL, 0, 0 }
+
+/*
+ * latency histogram in microseconds, buckets[0] counts [0, 1us),
+ * buckets[i] counts [2^(i-1), 2^i) us, the last one also counts everything above
+ */
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[CBOX_WORKER_HISTOGRAM_BUCKETS];
+} cbox_worker_histogram_t;
+
+typedef struct
+{
+    cbox_worker_histogram_t wait;       //!< from enqueue to start in worker thread
+    cbox_worker_histogram_t run;        //!< task body
+    cbox_worker_histogram_t delivery;   //!< from task finished to done called in loop thread
+} cbox_worker_latency_t;
+
+typedef struct
+{
+    uint64_t enqueued;
+    uint64_t completed;
+    uint64_t rejected;                  //!< failed with EAGAIN
+    uint64_t dropped;                   //!< dropped by CBOX_WORKER_POLICY_DROP_OLDEST
+    uint64_t caller_runs;               //!< run by CBOX_WORKER_POLICY_CALLER_RUNS
+    uint64_t deadline_missed;           //!< started after its deadline
+    size_t depth;
+    cbox_worker_latency_t total;
+    cbox_worker_latency_t tags[CBOX_WORKER_TAG_NUM];
+} cbox_worker_stats_t;
+
+/*
+ * what cbox_worker_enqueue_task() does when the queue is full
+ */
+typedef enum {
+    CBOX_WORKER_POLICY_BLOCK = 0,       //!< block the caller until there is room
+    CBOX_WORKER_POLICY_REJECT,          //!< return -1 with errno EAGAIN
+    CBOX_WORKER_POLICY_DROP_OLDEST,     //!< discard the oldest queued task, neither its task nor done is called
+    CBOX_WORKER_POLICY_CALLER_RUNS      //!< run the task in the caller's thread, done is still called in loop thread
+} cbox_worker_policy_t;
 
 cbox_worker_t *cbox_worker_new(cbox_loop_t *loop, unsigned int max_worker);
+
+/*
+ *@brief stop the threads and free the worker. the queued tasks are not discarded, the threads
+ *       run them all before exiting, including the ones they push meanwhile, e.g., the next turn
+ *       of a strand or the successors of a graph node. their done callbacks are delegated to the
+ *       loop as usual and run the next time it is dispatched
+ */
 void cbox_worker_delete(cbox_worker_t *worker);
 
 /*
@@ -20,8 +97,138 @@ void cbox_worker_delete(cbox_worker_t *worker);
  *@param task - the task to excute
  *@param done - the callback to be excuted in loop thread when the task is done
  *@param user - the user data
+ *@return 0: succeed, -1: failed, errno is EAGAIN when the queue is full, ENOMEM when out of memory
+ */
+int cbox_worker_enqueue_task(cbox_worker_t *worker, cbox_work_func_t task, cbox_work_func_t done, void *user);
+
+/*
+ *@brief push the task with priority and deadline to thread pool
+ *       the idle thread always picks the task with the earliest effective deadline,
+ *       for tasks without deadline it is the enqueue time plus the aging of its priority,
+ *       so the lower priority tasks will not starve behind the higher ones
+ *@param worker - the worker object
+ *@param attr - the task attribute, NULL means CBOX_WORKER_TASK_ATTR_INITIALIZER
+ *@param task - the task to excute
+ *@param done - the callback to be excuted in loop thread when the task is done
+ *@param user - the user data
+ *@return same as cbox_worker_enqueue_task
+ */
+int cbox_worker_enqueue_task_with_attr(cbox_worker_t *worker, const cbox_worker_task_attr_t *attr,
+                                       cbox_work_func_t task, cbox_work_func_t done, void *user);
+
+/*
+ *@brief set the aging of the priority level
+ *       default: HIGH 0ms, NORMAL 100ms, LOW 1000ms
+ *@param worker - the worker object
+ *@param priority - the priority level
+ *@param miliseconds - how long a task waits before it competes with a fresh task of the highest priority
+ *@return 0: succeed, -1: failed
+ */
+int cbox_worker_set_aging(cbox_worker_t *worker, cbox_worker_priority_t priority, uint64_t miliseconds);
+
+/*
+ *@brief bound the number of queued tasks
+ *       the tasks pushed by strands, task graphs and parallel helpers are not bounded
+ *@param worker - the worker object
+ *@param capacity - max queued tasks, 0 means unlimited (default)
+ *@param policy - what to do when the queue is full, default: CBOX_WORKER_POLICY_BLOCK
+ *@return 0: succeed, -1: failed
+ */
+int cbox_worker_set_capacity(cbox_worker_t *worker, size_t capacity, cbox_worker_policy_t policy);
+
+/*
+ *@brief watch the queue depth, cb is called in loop thread once when the depth reaches high,
+ *       and once again when it falls back to low
+ *@param cb - the callback, NULL to disable
+ *@return 0: succeed, -1: failed (low must be less than high)
+ */
+int cbox_worker_set_watermark(cbox_worker_t *worker, size_t high, size_t low, cbox_worker_watermark_func_t cb, void *user);
+
+/*
+ *@brief get number of queued tasks
+ */
+size_t cbox_worker_queue_depth(cbox_worker_t *worker);
+
+/*
+ *@brief enable the latency stats, disabled by default
+ *       it costs a few clock reads per task, and the done callback is delivered through
+ *       an internal one to measure the delivery delay
+ *@return 0: succeed, -1: failed
+ */
+int cbox_worker_set_stats(cbox_worker_t *worker, int enable);
+
+/*
+ *@brief get a copy of the stats since enabled or reset
+ *@return 0: succeed, -1: failed
+ */
+int cbox_worker_stats_get(cbox_worker_t *worker, cbox_worker_stats_t *stats);
+void cbox_worker_stats_reset(cbox_worker_t *worker);
+
+/*
+ *@brief estimate the percentile from the histogram
+ *@param percentile - (0, 100]
+ *@return the upper bound of the bucket in microseconds
+ */
+uint64_t cbox_worker_histogram_percentile(const cbox_worker_histogram_t *histogram, double percentile);
+
+/*
+ *@brief pin all threads of the worker to the cpus
+ *@param cpulist - cpus in the kernel cpulist format, e.g., "0-3,8"
+ *@return 0: succeed, -1: failed, the threads are left as they were
+ */
+int cbox_worker_set_affinity(cbox_worker_t *worker, const char *cpulist);
+
+/*
+ *@brief pin all threads of the worker to the cpus of the numa node, and make the memory
+ *       they allocate prefer the node, e.g., the nodes of task graphs and the parallel accumulators.
+ *       pin the loop to the same node with cbox_loop_set_numa_node() so the task nodes
+ *       and the queue are node local too
+ *@return 0: succeed, -1: failed, e.g., no numa support, nothing is changed
+ */
+int cbox_worker_set_numa_node(cbox_worker_t *worker, int node);
+
+/*
+ *@brief run fn over [begin, end) in chunks on the thread pool and the calling thread,
+ *       block until every chunk is finished.
+ *       chunks are grabbed dynamically, big at first and shrinking to grain near the end,
+ *       so the busy threads do not hold up the whole range
+ *@param worker - the worker object
+ *@param begin - the first index
+ *@param end - the index after the last one
+ *@param grain - the minimal chunk size, 0 means 1
+ *@param fn - called with [chunk_begin, chunk_end), may run in any thread
+ *@param user - the user data
+ *@return 0: succeed, -1: failed
+ */
+int cbox_worker_parallel_for(cbox_worker_t *worker, size_t begin, size_t end, size_t grain, cbox_parallel_func_t fn, void *user);
+
+/*
+ *@brief same as cbox_worker_parallel_for, but returns at once and calls done in loop thread
+ *       when every chunk is finished. only the pool threads run the chunks
+ */
+int cbox_worker_parallel_for_async(cbox_worker_t *worker, size_t begin, size_t end, size_t grain,
+                                   cbox_parallel_func_t fn, cbox_work_func_t done, void *user);
+
+/*
+ *@brief map every chunk of [begin, end) into a thread private accumulator and reduce
+ *       the accumulators into result, block until finished
+ *@param result - holds the identity value on input and the reduced value on output
+ *@param result_size - size of the accumulator in bytes
+ *@param map - accumulates [chunk_begin, chunk_end) into acc
+ *@param reduce - merges partial into acc, called with an internal lock held
+ *@return 0: succeed, -1: failed
+ */
+int cbox_worker_parallel_reduce(cbox_worker_t *worker, size_t begin, size_t end, size_t grain,
+                                cbox_parallel_map_func_t map, cbox_parallel_reduce_func_t reduce,
+                                void *result, size_t result_size, void *user);
+
+/*
+ *@brief same as cbox_worker_parallel_reduce, but calls done in loop thread when finished,
+ *       result must stay valid until then
  */
-void cbox_worker_enqueue_task(cbox_worker_t *worker, cbox_work_func_t task, cbox_work_func_t done, void *user);
+int cbox_worker_parallel_reduce_async(cbox_worker_t *worker, size_t begin, size_t end, size_t grain,
+                                      cbox_parallel_map_func_t map, cbox_parallel_reduce_func_t reduce,
+                                      void *result, size_t result_size, cbox_work_func_t done, void *user);
 
 /*
  *@brief create an new threaed to excute the task
@@ -1,6 +1,9 @@
 
 #include <gtest/gtest.h>
+#include <sched.h>
 #include <unistd.h>
+#include <vector>
+#include <string>
 #include "base/utils.h"
 #include "base/macros.h"
 #include "loop.h"
@@ -15,8 +18,9 @@ protected:
     }
 
     void TearDown() override {
-        cbox_loop_delete(loop_);
+        // the worker delegates the done callbacks of the tasks it drains to the loop
         cbox_worker_delete(worker_);
+        cbox_loop_delete(loop_);
     }
 
 
@@ -65,3 +69,335 @@ TEST_F(WorkerTest, Perform) {
     EXPECT_EQ(this->count_, 1);
 }
 
+
+static int g_drain_run = 0;
+static int g_drain_done = 0;
+
+static void drain_task(void *arg)
+{
+    usleep(100);
+    __atomic_add_fetch(&g_drain_run, 1, __ATOMIC_RELAXED);
+    (void)arg;
+}
+
+static void drain_done(void *arg)
+{
+    WorkerTest *self = (WorkerTest *)arg;
+    if (++g_drain_done == 100)
+        cbox_loop_exit(self->loop_);
+}
+
+TEST_F(WorkerTest, DeleteDrains) {
+    g_drain_run = 0;
+    g_drain_done = 0;
+    for (int i = 0; i < 100; ++i)
+        EXPECT_EQ(cbox_worker_enqueue_task(worker_, drain_task, drain_done, this), 0);
+
+    cbox_worker_delete(worker_);
+    worker_ = nullptr;
+    EXPECT_EQ(g_drain_run, 100);
+
+    cbox_loop_dispatch(loop_, CBOX_RUN_MODE_FOREVER);
+    EXPECT_EQ(g_drain_done, 100);
+}
+
+struct PriorityContext {
+    volatile int started = 0;
+    volatile int release = 0;
+    int order[8] = { 0 };
+    int count = 0;
+};
+
+static PriorityContext g_priority_ctx;
+
+static void gate_task(void *arg)
+{
+    (void)arg;
+    g_priority_ctx.started = 1;
+    while (!g_priority_ctx.release)
+        usleep(1000);
+}
+
+static void record_task(void *arg)
+{
+    g_priority_ctx.order[g_priority_ctx.count ++] = (int)(intptr_t)arg;
+}
+
+TEST(WorkerPriority, EarliestDeadlineFirst) {
+    cbox_loop_t *loop = cbox_loop_new();
+    cbox_worker_t *worker = cbox_worker_new(loop, 1);
+    ASSERT_TRUE(worker != nullptr);
+    g_priority_ctx = PriorityContext();
+
+    cbox_worker_enqueue_task(worker, gate_task, NULL, NULL);
+    while (!g_priority_ctx.started)
+        usleep(1000);
+
+    cbox_worker_task_attr_t low = { CBOX_WORKER_PRIORITY_LOW, 0 };
+    cbox_worker_task_attr_t high = { CBOX_WORKER_PRIORITY_HIGH, 0 };
+    cbox_worker_task_attr_t urgent = { CBOX_WORKER_PRIORITY_LOW, 10 };
+    cbox_worker_enqueue_task_with_attr(worker, &low, record_task, NULL, (void *)1);
+    cbox_worker_enqueue_task(worker, record_task, NULL, (void *)2);
+    cbox_worker_enqueue_task_with_attr(worker, &high, record_task, NULL, (void *)3);
+    cbox_worker_enqueue_task_with_attr(worker, &urgent, record_task, NULL, (void *)4);
+
+    g_priority_ctx.release = 1;
+    while (g_priority_ctx.count < 4)
+        usleep(1000);
+
+    EXPECT_EQ(g_priority_ctx.order[0], 3);
+    EXPECT_EQ(g_priority_ctx.order[1], 4);
+    EXPECT_EQ(g_priority_ctx.order[2], 2);
+    EXPECT_EQ(g_priority_ctx.order[3], 1);
+
+    cbox_worker_delete(worker);
+    cbox_loop_delete(loop);
+}
+
+TEST(WorkerPriority, Aging) {
+    cbox_loop_t *loop = cbox_loop_new();
+    cbox_worker_t *worker = cbox_worker_new(loop, 1);
+    ASSERT_TRUE(worker != nullptr);
+    g_priority_ctx = PriorityContext();
+    EXPECT_EQ(cbox_worker_set_aging(worker, CBOX_WORKER_PRIORITY_LOW, 0), 0);
+    EXPECT_EQ(cbox_worker_set_aging(worker, CBOX_WORKER_PRIORITY_NUM, 0), -1);
+
+    cbox_worker_enqueue_task(worker, gate_task, NULL, NULL);
+    while (!g_priority_ctx.started)
+        usleep(1000);
+
+    cbox_worker_task_attr_t low = { CBOX_WORKER_PRIORITY_LOW, 0 };
+    cbox_worker_task_attr_t high = { CBOX_WORKER_PRIORITY_HIGH, 0 };
+    cbox_worker_enqueue_task_with_attr(worker, &low, record_task, NULL, (void *)1);
+    usleep(5000);
+    cbox_worker_enqueue_task_with_attr(worker, &high, record_task, NULL, (void *)2);
+
+    g_priority_ctx.release = 1;
+    while (g_priority_ctx.count < 2)
+        usleep(1000);
+
+    EXPECT_EQ(g_priority_ctx.order[0], 1);
+    EXPECT_EQ(g_priority_ctx.order[1], 2);
+
+    cbox_worker_delete(worker);
+    cbox_loop_delete(loop);
+}
+
+static void sum_chunk(size_t begin, size_t end, void *user)
+{
+    uint64_t *values = (uint64_t *)user;
+    for (size_t i = begin; i < end; ++i)
+        values[i] = i * 2;
+}
+
+TEST_F(WorkerTest, ParallelFor) {
+    std::vector<uint64_t> values(100000, 0);
+    EXPECT_EQ(cbox_worker_parallel_for(worker_, 0, values.size(), 64, sum_chunk, values.data()), 0);
+    for (size_t i = 0; i < values.size(); ++i)
+        ASSERT_EQ(values[i], i * 2);
+
+    EXPECT_EQ(cbox_worker_parallel_for(worker_, 10, 10, 64, sum_chunk, values.data()), 0);
+    EXPECT_EQ(cbox_worker_parallel_for(worker_, 0, 10, 64, NULL, values.data()), -1);
+}
+
+static void checksum_map(size_t begin, size_t end, void *acc, void *user)
+{
+    (void)user;
+    for (size_t i = begin; i < end; ++i)
+        *(uint64_t *)acc += i;
+}
+
+static void checksum_reduce(void *acc, const void *partial, void *user)
+{
+    (void)user;
+    *(uint64_t *)acc += *(const uint64_t *)partial;
+}
+
+TEST_F(WorkerTest, ParallelReduce) {
+    uint64_t sum = 0;
+    EXPECT_EQ(cbox_worker_parallel_reduce(worker_, 0, 1000000, 100, checksum_map, checksum_reduce, &sum, sizeof(sum), NULL), 0);
+    EXPECT_EQ(sum, 999999ull * 1000000ull / 2);
+}
+
+static uint64_t g_async_sum = 0;
+
+static void parallel_done(void *arg)
+{
+    WorkerTest *self = (WorkerTest *)arg;
+    EXPECT_EQ(cbox_utils_running_in_main(), 1);
+    self->count_ ++;
+    cbox_loop_exit(self->loop_);
+}
+
+TEST_F(WorkerTest, ParallelReduceAsync) {
+    g_async_sum = 0;
+    EXPECT_EQ(cbox_worker_parallel_reduce_async(worker_, 0, 1000, 10, checksum_map, checksum_reduce,
+                &g_async_sum, sizeof(g_async_sum), parallel_done, this), 0);
+    cbox_loop_dispatch(loop_, CBOX_RUN_MODE_FOREVER);
+    EXPECT_EQ(count_, 1);
+    EXPECT_EQ(g_async_sum, 999ull * 1000ull / 2);
+}
+
+static void noop_task(void *arg)
+{
+    (void)arg;
+}
+
+TEST(WorkerBounded, Policies) {
+    cbox_loop_t *loop = cbox_loop_new();
+    cbox_worker_t *worker = cbox_worker_new(loop, 1);
+    ASSERT_TRUE(worker != nullptr);
+    g_priority_ctx = PriorityContext();
+
+    cbox_worker_enqueue_task(worker, gate_task, NULL, NULL);
+    while (!g_priority_ctx.started)
+        usleep(1000);
+
+    EXPECT_EQ(cbox_worker_set_capacity(worker, 2, CBOX_WORKER_POLICY_REJECT), 0);
+    EXPECT_EQ(cbox_worker_enqueue_task(worker, record_task, NULL, (void *)1), 0);
+    EXPECT_EQ(cbox_worker_enqueue_task(worker, record_task, NULL, (void *)2), 0);
+    EXPECT_EQ(cbox_worker_enqueue_task(worker, record_task, NULL, (void *)3), -1);
+    EXPECT_EQ(errno, EAGAIN);
+    EXPECT_EQ(cbox_worker_queue_depth(worker), 2u);
+
+    EXPECT_EQ(cbox_worker_set_capacity(worker, 2, CBOX_WORKER_POLICY_DROP_OLDEST), 0);
+    EXPECT_EQ(cbox_worker_enqueue_task(worker, record_task, NULL, (void *)4), 0);
+    EXPECT_EQ(cbox_worker_queue_depth(worker), 2u);
+
+    EXPECT_EQ(cbox_worker_set_capacity(worker, 2, CBOX_WORKER_POLICY_CALLER_RUNS), 0);
+    EXPECT_EQ(cbox_worker_enqueue_task(worker, record_task, NULL, (void *)5), 0);
+    EXPECT_EQ(g_priority_ctx.count, 1);
+    EXPECT_EQ(g_priority_ctx.order[0], 5);
+
+    g_priority_ctx.release = 1;
+    while (g_priority_ctx.count < 3)
+        usleep(1000);
+
+    EXPECT_EQ(g_priority_ctx.order[1], 2);
+    EXPECT_EQ(g_priority_ctx.order[2], 4);
+
+    cbox_worker_delete(worker);
+    cbox_loop_delete(loop);
+}
+
+static int g_watermarks[2] = { 0 };
+
+static void on_watermark(size_t depth, int high, void *user)
+{
+    cbox_loop_t *loop = (cbox_loop_t *)user;
+    EXPECT_EQ(cbox_utils_running_in_main(), 1);
+    if (high) {
+        EXPECT_GE(depth, 4u);
+    } else {
+        EXPECT_LE(depth, 1u);
+    }
+
+    if (++g_watermarks[high] == 1 && high == 0)
+        cbox_loop_exit(loop);
+}
+
+TEST(WorkerBounded, Watermark) {
+    cbox_loop_t *loop = cbox_loop_new();
+    cbox_worker_t *worker = cbox_worker_new(loop, 1);
+    ASSERT_TRUE(worker != nullptr);
+    g_priority_ctx = PriorityContext();
+
+    EXPECT_EQ(cbox_worker_set_watermark(worker, 4, 4, on_watermark, loop), -1);
+    EXPECT_EQ(cbox_worker_set_watermark(worker, 4, 1, on_watermark, loop), 0);
+
+    cbox_worker_enqueue_task(worker, gate_task, NULL, NULL);
+    while (!g_priority_ctx.started)
+        usleep(1000);
+
+    for (int i = 0; i < 8; ++i)
+        cbox_worker_enqueue_task(worker, noop_task, NULL, NULL);
+
+    g_priority_ctx.release = 1;
+    cbox_loop_dispatch(loop, CBOX_RUN_MODE_FOREVER);
+
+    EXPECT_EQ(g_watermarks[1], 1);
+    EXPECT_EQ(g_watermarks[0], 1);
+
+    cbox_worker_delete(worker);
+    cbox_loop_delete(loop);
+}
+
+static void sleep_task(void *arg)
+{
+    (void)arg;
+    usleep(2000);
+}
+
+static void stats_done(void *arg)
+{
+    WorkerTest *self = (WorkerTest *)arg;
+    if (++self->count_ == 10)
+        cbox_loop_exit(self->loop_);
+}
+
+TEST_F(WorkerTest, Stats) {
+    cbox_worker_stats_t stats;
+    cbox_worker_task_attr_t attr = CBOX_WORKER_TASK_ATTR_INITIALIZER;
+    attr.tag = 1;
+
+    EXPECT_EQ(cbox_worker_set_stats(worker_, 1), 0);
+    for (int i = 0; i < 10; ++i)
+        EXPECT_EQ(cbox_worker_enqueue_task_with_attr(worker_, &attr, sleep_task, stats_done, this), 0);
+
+    cbox_loop_dispatch(loop_, CBOX_RUN_MODE_FOREVER);
+
+    EXPECT_EQ(cbox_worker_stats_get(worker_, &stats), 0);
+    EXPECT_EQ(stats.enqueued, 10u);
+    EXPECT_EQ(stats.completed, 10u);
+    EXPECT_EQ(stats.total.wait.count, 10u);
+    EXPECT_EQ(stats.tags[1].run.count, 10u);
+    EXPECT_EQ(stats.tags[1].delivery.count, 10u);
+    EXPECT_EQ(stats.tags[0].run.count, 0u);
+    EXPECT_GE(stats.total.run.max, 2000u);
+    EXPECT_GE(cbox_worker_histogram_percentile(&stats.total.run, 50), 2000u);
+
+    cbox_worker_stats_reset(worker_);
+    EXPECT_EQ(cbox_worker_stats_get(worker_, &stats), 0);
+    EXPECT_EQ(stats.completed, 0u);
+}
+
+static int affinity_cpu = -1;
+
+static void affinity_task(void *arg)
+{
+    WorkerTest *self = (WorkerTest *)arg;
+    EXPECT_EQ(sched_getcpu(), affinity_cpu);
+    self->count_ ++;
+}
+
+static void affinity_done(void *arg)
+{
+    WorkerTest *self = (WorkerTest *)arg;
+    EXPECT_EQ(sched_getcpu(), affinity_cpu);
+    cbox_loop_exit(self->loop_);
+}
+
+TEST_F(WorkerTest, Affinity) {
+    // the loop runs in this thread, its mask is inherited by the threads of the later tests, restore it
+    cpu_set_t saved;
+    CPU_ZERO(&saved);
+    ASSERT_EQ(sched_getaffinity(0, sizeof(saved), &saved), 0);
+
+    // pin to a cpu the test is allowed to run on, cpu 0 may be outside the cpuset
+    for (affinity_cpu = 0; affinity_cpu < CPU_SETSIZE && !CPU_ISSET(affinity_cpu, &saved); ++affinity_cpu);
+    ASSERT_LT(affinity_cpu, CPU_SETSIZE);
+    std::string cpulist = std::to_string(affinity_cpu);
+
+    // the numa node sets the cpus of the node, so it goes before the single cpu
+    EXPECT_EQ(cbox_worker_set_numa_node(worker_, -1), -1);
+    cbox_worker_set_numa_node(worker_, 0);
+    EXPECT_EQ(cbox_worker_set_affinity(worker_, cpulist.c_str()), 0);
+    EXPECT_EQ(cbox_worker_set_affinity(worker_, "x"), -1);
+    EXPECT_EQ(cbox_loop_set_affinity(loop_, cpulist.c_str()), 0);
+
+    cbox_worker_enqueue_task(worker_, affinity_task, affinity_done, this);
+    cbox_loop_dispatch(loop_, CBOX_RUN_MODE_FOREVER);
+    EXPECT_EQ(count_, 1);
+
+    EXPECT_EQ(sched_setaffinity(0, sizeof(saved), &saved), 0);
+}
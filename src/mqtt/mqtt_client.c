@@ -325,7 +325,7 @@ static void mqtt_connect_async_task(void *arg)
 
 static int mqtt_proc_reconnect(cbox_mqtt_client_t *mqtt)
 {
-    LOGI("try to reconnect...");
+    LOGI_RATELIMIT(1000, 5, "try to reconnect...");
     int rc = 0;
     rc = mosquitto_reconnect_async(mqtt->mosquitto_instance);
     if (MOSQ_ERR_INVAL == rc) {
@@ -360,9 +360,9 @@ static void mqtt_handle_rc(cbox_mqtt_client_t *mqtt, int rc, const char *functio
         return;
 
     if (rc < MOSQ_ERR_SUCCESS)
-        LOGI("MQTT[%s] handler rc:[%d][%s] errno:[%d], sock:%d", mqtt->client_id, rc, mosquitto_strerror(rc), errno, mosq_sock);
+        LOGI_RATELIMIT(1000, 5, "MQTT[%s] handler rc:[%d][%s] errno:[%d], sock:%d", mqtt->client_id, rc, mosquitto_strerror(rc), errno, mosq_sock);
     else
-        LOGE("MQTT[%s] handler rc:[%d][%s] errno:[%d], sock:%d", mqtt->client_id, rc, mosquitto_strerror(rc), errno, mosq_sock);
+        LOGE_RATELIMIT(1000, 5, "MQTT[%s] handler rc:[%d][%s] errno:[%d], sock:%d", mqtt->client_id, rc, mosquitto_strerror(rc), errno, mosq_sock);
 
     mqtt->connected = false;
     if (mqtt->keep_connect) {